@@ -1,7 +1,46 @@
-from .pgmmv import decrypt_key, decrypt_resource_bytes, decrypt_resource_file
+from .pgmmv import (
+    ResourceStore,
+    decrypt_key,
+    decrypt_many,
+    decrypt_resource_batch,
+    decrypt_resource_bytes,
+    decrypt_resource_bytes_async,
+    decrypt_resource_file,
+    decrypt_resource_file_async,
+    decrypt_resource_file_inplace,
+    decrypt_resource_prefix,
+    decrypt_tree,
+    iter_decrypted,
+    open,
+    peak_inflight_bytes,
+    scan_tree,
+    set_huge_pages,
+    set_max_inflight_bytes,
+)
 
 __all__ = [
+    'ResourceStore',
     'decrypt_key',
+    'decrypt_many',
+    'decrypt_resource_batch',
     'decrypt_resource_bytes',
+    'decrypt_resource_bytes_async',
     'decrypt_resource_file',
+    'decrypt_resource_file_async',
+    'decrypt_resource_file_inplace',
+    'decrypt_resource_prefix',
+    'decrypt_tree',
+    'get_include',
+    'iter_decrypted',
+    'open',
+    'peak_inflight_bytes',
+    'scan_tree',
+    'set_huge_pages',
+    'set_max_inflight_bytes',
 ]
+
+
+def get_include() -> str:
+    '''Return the directory of the C headers of the `_minicrypto` C API.'''
+    from os.path import dirname, join
+    return join(dirname(__file__), '_minicrypto')
@@ -1,6 +1,11 @@
 '''Minimal set of cryptographic algorithms for PGMMV.'''
 
-from typing import Iterable, Self
+from io import RawIOBase
+from os import PathLike
+from typing import Any, Iterable, Self, Sequence
+
+_C_API: Any
+'''Capsule of the C API function table, see `minicrypto_capi.h`.'''
 
 def xor_bytes(bytes1: bytes | bytearray, bytes2: bytes | bytearray, *, strict: bool = False) -> bytes:
     '''
@@ -13,6 +18,200 @@ def xor_bytes(bytes1: bytes | bytearray, bytes2: bytes | bytearray, *, strict: b
     ...
 
 
+# PGMMV resources
+# Backed by libpgmmv, the GIL is released while decrypting
+
+def decrypt_key(encrypted_key: bytes | bytearray) -> bytes:
+    '''Decrypt the key stored in info.json.'''
+    ...
+
+def derive_subkey(key: bytes | bytearray, plaintext_len: int) -> bytes:
+    '''Derive the Twofish key of a resource from the resource key and the plaintext length.'''
+    ...
+
+def decrypt_resource_bytes(file_bytes: bytes | bytearray, key: bytes | bytearray) -> bytes:
+    '''Decrypt a resource held in memory, an unencrypted resource is returned as is.'''
+    ...
+
+def decrypt_resource_prefix(file: str | PathLike | bytes | bytearray | memoryview, key: bytes | bytearray, n: int) -> bytes:
+    '''
+    Decrypt only the first `n` bytes of a resource, or all of it if shorter, decrypting only the blocks holding them.
+    A bytes-like `file` holds the whole resource, whose length the key is derived from;
+    a path names a resource file, of which only the header and those blocks are read.
+    '''
+    ...
+
+def decrypt_resource_file(file: str | bytes | PathLike, out: str | bytes | PathLike, key: bytes | bytearray, *, buffer_size: int | None = None,
+                          drop_cache: bool = False, direct: bool = False) -> int:
+    '''
+    Decrypt a resource file into `out` and return the plaintext length.
+
+    :param int | None buffer_size: Stream through two buffers of this many bytes, one written while the other is decrypted,
+        so that memory use stays bounded whatever the file size. None lets large files be decrypted between memory mappings.
+    :param bool drop_cache: Drop the file and its output from the page cache once done, the output written back first,
+        so that a pass over many files does not evict what else is cached.
+    :param bool direct: Write outputs of a few MiB and more with O_DIRECT where supported, around the page cache, implies `drop_cache`.
+    '''
+    ...
+
+def decrypt_resource_file_inplace(path: str | bytes | PathLike, key: bytes | bytearray, *, journal: bool = False, drop_cache: bool = False) -> int:
+    '''
+    Decrypt a resource file over itself and return the plaintext length, unencrypted resources are left untouched.
+    An interrupted decryption leaves the file neither encrypted nor decrypted.
+
+    :param bool journal: Log each window next to the file first, so that an interrupted decryption is resumed by the next call.
+    :param bool drop_cache: Drop the file from the page cache once rewritten, see decrypt_resource_file().
+    '''
+    ...
+
+def decrypt_resource_batch(buffers: Sequence[bytes | bytearray], key: bytes | bytearray, *, threads: int | None = None) -> list[bytes]:
+    '''
+    Decrypt many resources held in memory at once on a pool of `threads` threads.
+
+    :param int | None threads: Number of threads, None for one per CPU.
+    '''
+    ...
+
+def decrypt_many(pairs: Sequence[tuple[str | PathLike, str | PathLike]], key: bytes | bytearray, *, threads: int | None = None,
+                 link_plain: bool = False, in_place: bool = False, journal: bool = False,
+                 pipeline: bool = False, readers: int | None = None, writers: int | None = None,
+                 drop_cache: bool = False, direct: bool = False, disk_order: bool = False,
+                 fail_fast: bool = False) -> list[int]:
+    '''
+    Decrypt many resource files at once on a pool of `threads` threads,
+    largest files first, huge files split across threads.
+    Every file is tried, the first failure in `pairs` order is raised afterwards.
+
+    :param int | None threads: Number of threads, None for one per CPU.
+    :param bool link_plain: Hardlink files which are not encrypted to their output where possible, instead of copying them.
+    :param bool in_place: Decrypt every file over itself as decrypt_resource_file_inplace() does, the outputs are ignored.
+    :param bool journal: Journal in-place decryption, see decrypt_resource_file_inplace().
+    :param bool pipeline: Read, decrypt and write in separate stages of threads connected by bounded queues,
+        so that I/O and decryption overlap across files. `threads` then sizes the decryption stage.
+    :param int | None readers: Reader threads of the pipeline, None for 2.
+    :param int | None writers: Writer threads of the pipeline, None for 2.
+    :param bool drop_cache: Drop every file and output from the page cache once done, see decrypt_resource_file().
+        Small files are then read one by one instead of on io_uring.
+    :param bool direct: Write large outputs with O_DIRECT, see decrypt_resource_file().
+    :param bool disk_order: Read the files in the order they lie on disk instead of largest first, output directory
+        by output directory, so that a spinning disk seeks once per directory. Physical places come from FS_IOC_FIEMAP,
+        inode numbers stand in where it is not supported.
+    :param bool fail_fast: Start no file after one failed, the failure raised then notes how many files were not decrypted.
+    :return: Plaintext length of every file.
+    '''
+    ...
+
+def decrypt_tree(src: str | PathLike, dst: str | PathLike, key: bytes | bytearray, *, threads: int | None = None,
+                 link_plain: bool = False, in_place: bool = False, journal: bool = False,
+                 pipeline: bool = False, readers: int | None = None, writers: int | None = None,
+                 drop_cache: bool = False, direct: bool = False, disk_order: bool = False,
+                 auto_tune: bool = False, tune_profile: str | PathLike | None = None, fail_fast: bool = False) -> int:
+    '''
+    Decrypt every file below the directory `src` into the same tree below `dst`, or the file `src` into `dst`.
+    A native thread walks the tree relative to directory descriptors and creates each output directory once,
+    the files found so far are decrypted meanwhile in batches as decrypt_many() does.
+    Every file of a batch is tried, the first failure in walking order stops the walk and is raised;
+    with `fail_fast` no file is started after it.
+
+    Keywords are those of decrypt_many(), `in_place` ignores `dst` and skips the journals.
+
+    :param bool auto_tune: Spend the first seconds decrypting samples of files with other thread counts, chunk sizes
+        and split sizes, one at a time, and decrypt the rest with the fastest.
+    :param tune_profile: File of the profile to start from, if it exists, explicit `threads` taking precedence;
+        with `auto_tune`, the fastest profile is saved to it for the next runs on this host.
+
+    :return: Number of files decrypted.
+    '''
+    ...
+
+def scan_tree(src: str | PathLike, *, threads: int | None = None) -> list[tuple[str, int, bool, int, int, int]]:
+    '''
+    Read the header alone of every file below the directory `src`, or of the file `src`, walking the tree
+    as decrypt_tree() does and opening the files found so far on `threads` threads meanwhile.
+
+    :return: `(path, file_size, encrypted, pad, plaintext_len, errno)` of each file in walking order,
+        `errno` being nonzero for a file or directory which could not be scanned, EBADMSG for a malformed header.
+    '''
+    ...
+
+def set_huge_pages(enable: bool) -> None:
+    '''
+    Back the native I/O buffers of 2 MiB and more with transparent huge pages where supported, off by default.
+    Each native thread keeps the buffers of its last files for the next ones, whether or not they are huge pages.
+    '''
+    ...
+
+def set_max_inflight_bytes(limit: int | None) -> None:
+    '''
+    Cap the bytes of file data the native decryptions of this process hold at once, None (the default) for no cap.
+    A file which would be mapped whole is streamed through a small buffer instead when it does not fit,
+    a file streamed waits for the others to make room unless none is in flight, small files skip io_uring
+    when its buffers do not fit, and a pipeline shortens its queues, then its chunks, to fit.
+    The one buffer each batch worker keeps is counted but not capped.
+    '''
+    ...
+
+def peak_inflight_bytes(*, reset: bool = False) -> int:
+    '''
+    Return the most bytes of file data held at once since the module was loaded, or since the last call with `reset`.
+    '''
+    ...
+
+class DecryptedFile(RawIOBase):
+    '''
+    Read-only, seekable view of the plaintext of a resource file, registered as an `io.RawIOBase`.
+    A read decrypts only the cipher blocks covering it, each chain started from the ciphertext block before it,
+    reads smaller than `readahead` go through a window of that many plaintext bytes kept for the next ones.
+    Reads release the GIL, the file is closed with the object.
+    '''
+
+    def __init__(self, file: str | bytes | PathLike, key: bytes | bytearray, *, readahead: int | None = None) -> None:
+        '''
+        :param int | None readahead: Bytes of the window, None for 64 KiB.
+        '''
+        ...
+    def readinto(self, buffer: bytearray | memoryview) -> int: ...
+    def readall(self) -> bytes: ...
+    def seek(self, offset: int, whence: int = 0) -> int: ...
+    def tell(self) -> int: ...
+    @property
+    def name(self) -> str: ...
+    @property
+    def size(self) -> int:
+        '''Plaintext length of the resource.'''
+        ...
+
+
+class AsyncQueue():
+    '''
+    Decrypt resources on a private pool of native threads without the GIL.
+    Completions are signalled through `fileno()`, ready for `loop.add_reader()`.
+    '''
+
+    def __init__(self, *, threads: int | None = None) -> None: ...
+    def fileno(self) -> int: ...
+    def submit_file(self, file: str | PathLike, out: str | PathLike, key: bytes | bytearray) -> int:
+        '''Queue a file decryption, return its token.'''
+        ...
+    def submit_bytes(self, file_bytes: bytes | bytearray, key: bytes | bytearray) -> int:
+        '''Queue an in-memory decryption, return its token.'''
+        ...
+    def submit_read(self, file: str | PathLike, key: bytes | bytearray) -> int:
+        '''
+        Queue the decryption of a file into memory, its result being the plaintext bytes, return its token.
+        The file is opened and its header read before returning, failures to do so are raised here.
+        '''
+        ...
+    def drain(self) -> list[tuple[int, Any, BaseException | None]]:
+        '''Return `(token, result, exception)` of every job completed since the last call.'''
+        ...
+    def close(self) -> None:
+        '''Wait for the queued jobs, drop their results and release the threads.'''
+        ...
+    @property
+    def pending(self) -> int: ...
+
+
 # Block ciphers
 
 class Cipher():
@@ -1,9 +1,22 @@
-#define PY_SSIZE_T_CLEAN
-#include <Python.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fatal.h"
 
 
 /* general fatal function */
 
+static void _cipher_default_fatal(const char* msg) {
+    fprintf(stderr, "Fatal error: %s\n", msg);
+    abort();
+}
+
+static cipher_fatal_handler _cipher_fatal_handler = _cipher_default_fatal;
+
+void cipher_set_fatal_handler(cipher_fatal_handler handler) {
+    _cipher_fatal_handler = (handler) ? handler : _cipher_default_fatal;
+}
+
 void cipher_fatal(const char* msg) {
-    Py_FatalError(msg);
+    _cipher_fatal_handler(msg);
 }
@@ -5,4 +5,12 @@
  * leave it clean
  */
 
+typedef void (*cipher_fatal_handler)(const char* msg);
+
 void cipher_fatal(const char* msg);
+
+/*
+ * replace the fatal handler, NULL restores the default one
+ * the handler MUST NOT return
+ */
+void cipher_set_fatal_handler(cipher_fatal_handler handler);
@@ -0,0 +1,176 @@
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "pgmmv.h"
+#include "weakfish.h"
+#include "fatal.h"
+
+
+const uint8_t PGMMV_IV[PGMMV_BLOCKSIZE] = {
+    0xA0, 0x47, 0xE9, 0x3D, 0x23, 0x0A, 0x4C, 0x62,
+    0xA7, 0x44, 0xB1, 0xA4, 0xEE, 0x85, 0x7F, 0xBA,
+};
+
+static const uint8_t PGMMV_SIGNATURE[3] = { 'e', 'n', 'c' };
+
+
+/* initialization */
+
+static void _pgmmv_initialise_once() {
+    Twofish_initialise();
+    Weakfish_selftest();
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK _pgmmv_initialise_callback(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+    (void)once; (void)param; (void)ctx;
+    _pgmmv_initialise_once();
+    return TRUE;
+}
+
+void pgmmv_initialise() {
+    static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+    InitOnceExecuteOnce(&once, _pgmmv_initialise_callback, NULL, NULL);
+}
+#else
+void pgmmv_initialise() {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, _pgmmv_initialise_once);
+}
+#endif
+
+void pgmmv_set_fatal_handler(void (*handler)(const char* msg)) {
+    cipher_set_fatal_handler(handler);
+}
+
+/* end initialization */
+
+
+/* key handling */
+
+static void _pgmmv_block_decrypt(const pgmmv_cipher* cipher, uint8_t dst[PGMMV_BLOCKSIZE], uint8_t src[PGMMV_BLOCKSIZE]) {
+    if (cipher->is_weak) Weakfish_decrypt(src, dst);
+    else Twofish_decrypt((Twofish_key*)&cipher->xkey, src, dst);
+}
+
+int pgmmv_decrypt_key(uint8_t* dst, const uint8_t* src, size_t len) {
+    /* the key of the encrypted key is "key", too short to use anything but Weakfish */
+    static const pgmmv_cipher weak_cipher = { .is_weak = 1 };
+
+    uint8_t iv[PGMMV_BLOCKSIZE];
+    memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+    return pgmmv_cbc_decrypt(&weak_cipher, iv, dst, src, len);
+}
+
+int pgmmv_derive_subkey(uint8_t subkey[PGMMV_MAXKEYLEN], const uint8_t* key, size_t key_len, uint64_t pt_len) {
+    if (key_len > PGMMV_MAXKEYLEN) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* the key is zero-padded to at least 8 bytes so that any length value fits */
+    memset(subkey, 0, PGMMV_MAXKEYLEN);
+    memcpy(subkey, key, key_len);
+
+    /* xor in the significant little-endian bytes of the length, zeros become ones */
+    for (size_t idx = 0; pt_len; idx++, pt_len >>= 8) {
+        subkey[idx] ^= (uint8_t)pt_len;
+        if (!subkey[idx]) subkey[idx] = 1;
+    }
+    return (int)((key_len < PGMMV_WEAKKEYLEN) ? PGMMV_WEAKKEYLEN : key_len);
+}
+
+int pgmmv_prepare_key(pgmmv_cipher* cipher, const uint8_t* key, size_t key_len, uint64_t pt_len) {
+    if (key_len > PGMMV_MAXKEYLEN) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cipher->is_weak = (key_len <= PGMMV_WEAKKEYLEN);
+    if (cipher->is_weak) return 0;
+
+    uint8_t subkey[PGMMV_MAXKEYLEN];
+    int subkey_len = pgmmv_derive_subkey(subkey, key, key_len, pt_len);
+    Twofish_prepare_key(subkey, subkey_len, &cipher->xkey);
+    memset(subkey, 0, sizeof(subkey));
+    return 0;
+}
+
+/* end key handling */
+
+
+/* decryption */
+
+int pgmmv_cbc_decrypt(const pgmmv_cipher* cipher, uint8_t iv[PGMMV_BLOCKSIZE], uint8_t* dst, const uint8_t* src, size_t len) {
+    if (len % PGMMV_BLOCKSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint8_t block[PGMMV_BLOCKSIZE];
+    for (size_t offset = 0; offset < len; offset += PGMMV_BLOCKSIZE) {
+        /* keep the ciphertext block, `dst` may overwrite it */
+        memcpy(block, src + offset, PGMMV_BLOCKSIZE);
+        _pgmmv_block_decrypt(cipher, dst + offset, block);
+        for (size_t idx = 0; idx < PGMMV_BLOCKSIZE; idx++) dst[offset + idx] ^= iv[idx];
+        memcpy(iv, block, PGMMV_BLOCKSIZE);
+    }
+    return 0;
+}
+
+int pgmmv_parse_header(pgmmv_header* header, const uint8_t* head, size_t head_len, uint64_t file_size) {
+    header->is_encrypted = (head_len >= sizeof(PGMMV_SIGNATURE) && !memcmp(head, PGMMV_SIGNATURE, sizeof(PGMMV_SIGNATURE)));
+    header->pad = 0;
+    header->pt_len = file_size;
+    if (!header->is_encrypted) return 0;
+
+    /* encrypted resources always carry the pad byte and whole blocks */
+    if (head_len < PGMMV_HEADERSIZE || file_size < PGMMV_HEADERSIZE
+        || (file_size - PGMMV_HEADERSIZE) % PGMMV_BLOCKSIZE
+        || head[3] > file_size - PGMMV_HEADERSIZE) {
+        errno = EBADMSG;
+        return -1;
+    }
+    header->pad = head[3];
+    header->pt_len = file_size - PGMMV_HEADERSIZE - header->pad;
+    return 0;
+}
+
+int64_t pgmmv_decrypt_resource(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* key, size_t key_len) {
+    /* the plaintext is never longer than the resource */
+    return pgmmv_decrypt_prefix(dst, len, src, len, key, key_len);
+}
+
+int64_t pgmmv_decrypt_prefix(uint8_t* dst, size_t n, const uint8_t* src, size_t len, const uint8_t* key, size_t key_len) {
+    pgmmv_header header;
+    if (pgmmv_parse_header(&header, src, len, len) < 0) return -1;
+    if (n > header.pt_len) n = (size_t)header.pt_len;
+    if (!header.is_encrypted) {
+        memmove(dst, src, n);
+        return (int64_t)n;
+    }
+
+    pgmmv_cipher cipher;
+    if (pgmmv_prepare_key(&cipher, key, key_len, header.pt_len) < 0) return -1;
+
+    /* whole blocks go straight to `dst`, the block holding the end goes through a buffer */
+    uint8_t iv[PGMMV_BLOCKSIZE], block[PGMMV_BLOCKSIZE];
+    size_t whole_len = n - n % PGMMV_BLOCKSIZE;
+    memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+    pgmmv_cbc_decrypt(&cipher, iv, dst, src + PGMMV_HEADERSIZE, whole_len);
+    if (whole_len < n) {
+        pgmmv_cbc_decrypt(&cipher, iv, block, src + PGMMV_HEADERSIZE + whole_len, PGMMV_BLOCKSIZE);
+        memcpy(dst + whole_len, block, n - whole_len);
+    }
+
+    memset(&cipher, 0, sizeof(cipher));
+    return (int64_t)n;
+}
+
+/* end decryption */
@@ -0,0 +1,416 @@
+#pragma once
+
+/*
+ * libpgmmv, PGMMV resource decryption library
+ * pure C, no Python dependency, safe to call without the GIL
+ *
+ * functions returning int report failure by returning -1 and setting errno,
+ * a malformed resource is reported as EBADMSG, an illegal argument as EINVAL
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "twofish.h"
+
+
+#define PGMMV_BLOCKSIZE     16      /* cipher block size */
+#define PGMMV_HEADERSIZE    4       /* "enc" signature followed by one pad byte */
+#define PGMMV_MAXKEYLEN     32      /* longest key accepted by Twofish */
+#define PGMMV_WEAKKEYLEN    8       /* keys not longer than this use Weakfish */
+
+#define PGMMV_VERSION_MAJOR 0
+#define PGMMV_VERSION_MINOR 1
+
+extern const uint8_t PGMMV_IV[PGMMV_BLOCKSIZE];
+
+
+/* initialization */
+
+/*
+ * initialize and self-test the underlying ciphers
+ * MUST be called before any other function, extra calls are no-ops
+ */
+void pgmmv_initialise();
+
+/*
+ * replace the handler called when a self-test fails, NULL restores the default
+ * which prints the message and aborts, the handler MUST NOT return
+ */
+void pgmmv_set_fatal_handler(void (*handler)(const char* msg));
+
+/*
+ * back I/O buffers of 2 MiB and more with transparent huge pages where supported, off by default
+ * fewer page faults and TLB misses on large files, for memory rounded up to whole huge pages
+ */
+void pgmmv_set_hugepages(int enable);
+
+/*
+ * cap the bytes of file data the decryptions of this process hold at once, 0 (the default) for no cap
+ * a file which would be mapped whole is streamed through a small buffer instead when it does not fit,
+ * a file streamed waits for the others to make room, unless none is in flight,
+ * small files skip io_uring when its buffers do not fit, and a pipeline shortens its queues, then its chunks,
+ * to fit; the one buffer each batch worker keeps is counted but not capped
+ */
+void pgmmv_set_max_inflight(uint64_t bytes);
+
+/*
+ * most bytes held at once since the start of the process, or since the last call with `reset`
+ */
+uint64_t pgmmv_peak_inflight(int reset);
+
+
+/* key handling */
+
+/*
+ * prepared resource cipher
+ * treat it as opaque, wipe it once done
+ */
+typedef struct _pgmmv_cipher {
+    int is_weak;
+    Twofish_key xkey;
+} pgmmv_cipher;
+
+/*
+ * decrypt the key stored in info.json (base64-decoded)
+ * `len` must be a multiple of PGMMV_BLOCKSIZE, `dst` may be `src`
+ */
+int pgmmv_decrypt_key(uint8_t* dst, const uint8_t* src, size_t len);
+
+/*
+ * derive the per-resource subkey from the key and the plaintext length
+ * return the subkey length
+ */
+int pgmmv_derive_subkey(uint8_t subkey[PGMMV_MAXKEYLEN], const uint8_t* key, size_t key_len, uint64_t pt_len);
+
+/*
+ * prepare the cipher of a resource with the given plaintext length
+ */
+int pgmmv_prepare_key(pgmmv_cipher* cipher, const uint8_t* key, size_t key_len, uint64_t pt_len);
+
+
+/* decryption */
+
+/*
+ * decrypt `len` bytes in CBC mode, `len` must be a multiple of PGMMV_BLOCKSIZE
+ * `iv` is updated with the last ciphertext block so calls can be chained
+ * `dst` may be `src`
+ */
+int pgmmv_cbc_decrypt(const pgmmv_cipher* cipher, uint8_t iv[PGMMV_BLOCKSIZE], uint8_t* dst, const uint8_t* src, size_t len);
+
+/*
+ * resource metadata taken from the first PGMMV_HEADERSIZE bytes of a resource
+ */
+typedef struct _pgmmv_header {
+    int is_encrypted;
+    uint8_t pad;
+    uint64_t pt_len;        /* length of the decrypted resource */
+} pgmmv_header;
+
+/*
+ * parse the header of a resource of `file_size` bytes
+ * `head` holds the first `head_len` bytes of the resource
+ */
+int pgmmv_parse_header(pgmmv_header* header, const uint8_t* head, size_t head_len, uint64_t file_size);
+
+/*
+ * decrypt a whole resource held in memory, unencrypted resources are copied
+ * `dst` must hold at least `header.pt_len` bytes, `dst` may be `src`
+ * return the plaintext length, or -1 on failure
+ */
+int64_t pgmmv_decrypt_resource(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* key, size_t key_len);
+
+/*
+ * pgmmv_decrypt_resource() of only the first `n` bytes of plaintext, decrypting only the blocks holding them
+ * `src` still holds the whole resource, whose length the key is derived from, see pgmmv_reader for files
+ * `dst` must hold at least `n` bytes, or `header.pt_len` if fewer, `dst` may be `src`
+ * return the plaintext length written, or -1 on failure
+ */
+int64_t pgmmv_decrypt_prefix(uint8_t* dst, size_t n, const uint8_t* src, size_t len, const uint8_t* key, size_t key_len);
+
+
+/* file decryption */
+
+/*
+ * decrypt the resource read from `ifd` into `ofd`, unencrypted resources are copied
+ * by the kernel where possible (reflink, copy_file_range(), sendfile())
+ * `ifd` must be positioned at the start of a regular file
+ * return the plaintext length, or -1 on failure
+ */
+int64_t pgmmv_decrypt_fd(int ifd, int ofd, const uint8_t* key, size_t key_len);
+
+/*
+ * decrypt the resource file `src` into `dst`, which is created or truncated
+ * large regular files are decrypted between memory mappings, others are streamed
+ * inputs are read with sequential readahead, started as soon as they are opened
+ * return the plaintext length, or -1 on failure
+ */
+int64_t pgmmv_decrypt_file(const char* src, const char* dst, const uint8_t* key, size_t key_len);
+
+#define PGMMV_DROPCACHE     0x20    /* drop each input and output from the page cache once done, outputs written back first */
+#define PGMMV_DIRECT        0x40    /* write outputs of a few MiB and more with O_DIRECT where supported, implies PGMMV_DROPCACHE */
+
+/*
+ * pgmmv_decrypt_file() with PGMMV_DROPCACHE or PGMMV_DIRECT, so that a pass over many files
+ * does not evict what else is cached, a file cached before is dropped all the same
+ * outputs written with O_DIRECT are not mapped, and their last partial block is written through the page cache
+ */
+int64_t pgmmv_decrypt_file_ex(const char* src, const char* dst, const uint8_t* key, size_t key_len, int flags);
+
+/*
+ * decrypt the resource read from `ifd` into `ofd` through two buffers of `buffer_size` bytes,
+ * a helper thread writes one while the next is read and decrypted
+ * memory use stays at twice `buffer_size` whatever the file size, 0 means a few MiB
+ * `ifd` must be positioned at the start of a regular file
+ */
+int64_t pgmmv_decrypt_stream(int ifd, int ofd, const uint8_t* key, size_t key_len, size_t buffer_size);
+
+/*
+ * pgmmv_decrypt_stream() from the resource file `src` into `dst`, which is created or truncated
+ * PGMMV_DROPCACHE and PGMMV_DIRECT apply as to pgmmv_decrypt_file_ex()
+ */
+int64_t pgmmv_decrypt_file_stream(const char* src, const char* dst, const uint8_t* key, size_t key_len, size_t buffer_size, int flags);
+
+#define PGMMV_JOURNAL       0x10    /* log each window of an in-place decryption, so that it can be resumed */
+#define PGMMV_JOURNALSUFFIX ".pgmmv-journal"
+
+/*
+ * decrypt the resource file `path` over itself through a sliding window,
+ * each window of plaintext is written a header length before the ciphertext it came from,
+ * then the file is truncated to the plaintext length, unencrypted resources are left untouched
+ * an interruption leaves the file neither encrypted nor decrypted, unless PGMMV_JOURNAL is set:
+ * each window is then logged to `path` PGMMV_JOURNALSUFFIX before it is written,
+ * and a decryption interrupted that way is resumed from its journal by the next call
+ * PGMMV_DROPCACHE drops the file from the page cache once rewritten
+ * return the plaintext length, or -1 on failure
+ */
+int64_t pgmmv_decrypt_file_inplace(const char* path, const uint8_t* key, size_t key_len, int flags);
+
+
+/* random access */
+
+/*
+ * plaintext view of a resource file, read at any offset
+ * a read decrypts only the cipher blocks covering it, chained from the ciphertext block before them,
+ * reads smaller than the readahead window go through a window of plaintext kept for the next ones
+ * a reader MUST NOT be used by two threads at once
+ */
+typedef struct _pgmmv_reader pgmmv_reader;
+
+/*
+ * open the resource file `path` with a window of `readahead` bytes, 0 means 64 KiB
+ * return NULL on failure
+ */
+pgmmv_reader* pgmmv_reader_open(const char* path, const uint8_t* key, size_t key_len, size_t readahead);
+
+/*
+ * plaintext length of the resource
+ */
+uint64_t pgmmv_reader_size(const pgmmv_reader* reader);
+
+/*
+ * read up to `len` bytes of plaintext at `offset`, fewer only at the end of the resource
+ * return the bytes read, or -1 on failure
+ */
+int64_t pgmmv_reader_pread(pgmmv_reader* reader, void* buf, size_t len, uint64_t offset);
+
+/*
+ * close the file and wipe the key, NULL is ignored
+ */
+void pgmmv_reader_close(pgmmv_reader* reader);
+
+
+/* batch decryption */
+
+/*
+ * number of CPUs this process may run on, capped by the CPU quota of its cgroup
+ */
+int pgmmv_cpu_count();
+
+typedef struct _pgmmv_buffer_task {
+    const uint8_t* src;
+    size_t src_len;
+    uint8_t* dst;           /* at least `header.pt_len` bytes, may be `src` */
+    int64_t result;         /* plaintext length, or -1 on failure */
+    int error;              /* errno of the failure */
+} pgmmv_buffer_task;
+
+typedef struct _pgmmv_file_task {
+    const char* src;
+    const char* dst;
+    int64_t result;         /* plaintext length, or -1 on failure */
+    int error;              /* errno of the failure */
+} pgmmv_file_task;
+
+/*
+ * decrypt every task with `threads` threads, 0 means pgmmv_cpu_count()
+ * a failed task does not stop the others
+ * return 0 if all tasks succeeded, or -1 with errno of the first failed task
+ */
+int pgmmv_decrypt_buffers(pgmmv_buffer_task* tasks, size_t count, const uint8_t* key, size_t key_len, int threads);
+
+/*
+ * files are scheduled largest first and huge files are split across threads,
+ * small files are kept in flight by the dozen on io_uring where available,
+ * tasks may complete in any order
+ */
+int pgmmv_decrypt_files(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len, int threads);
+
+#define PGMMV_FAILFAST      0x1     /* start no task after one failed, the rest fail with ECANCELED */
+#define PGMMV_NOURING       0x2     /* do not use io_uring for small files, even where available */
+#define PGMMV_LINKPLAIN     0x4     /* hardlink files which are not encrypted to their output where possible */
+#define PGMMV_INPLACE       0x8     /* decrypt every `src` over itself, `dst` is ignored, PGMMV_JOURNAL applies */
+#define PGMMV_DISKORDER     0x80    /* read files in the order they lie on disk, one output directory after another */
+
+/*
+ * pgmmv_decrypt_files() with PGMMV_* flags
+ * PGMMV_DROPCACHE and PGMMV_DIRECT apply to every file, small files then skip io_uring
+ * PGMMV_DISKORDER queues files by their first extent from FS_IOC_FIEMAP, or by inode number without it,
+ * instead of largest first, so that a spinning disk seeks once per directory rather than once per file
+ * errno is ECANCELED only if no task failed otherwise
+ */
+int pgmmv_decrypt_files_ex(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len, int threads, int flags);
+
+typedef struct _pgmmv_tune_profile {
+    int threads;            /* decryption threads, 0 means pgmmv_cpu_count() */
+    size_t chunk_size;      /* bytes read at a time from a split file, or per pipeline chunk, 0 means the default */
+    uint64_t split_size;    /* smallest ciphertext split across threads, 0 means 8 MiB */
+} pgmmv_tune_profile;
+
+/*
+ * pgmmv_decrypt_files_ex() with the parameters of `profile`
+ */
+int pgmmv_decrypt_files_tuned(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len,
+                              const pgmmv_tune_profile* profile, int flags);
+
+/*
+ * read the fields of `profile` from the "name=value" lines of the file `path`,
+ * fields it does not name, or names with an invalid value, are left as they are
+ * return -1 with errno on failure, ENOENT if there is no such file
+ */
+int pgmmv_tune_load(pgmmv_tune_profile* profile, const char* path);
+
+/*
+ * write `profile` to the file `path` for pgmmv_tune_load(), replacing it at once
+ */
+int pgmmv_tune_save(const pgmmv_tune_profile* profile, const char* path);
+
+typedef struct _pgmmv_pipeline_config {
+    int readers;            /* reader threads, 0 means 2 */
+    int decrypters;         /* decryption threads, 0 means pgmmv_cpu_count() */
+    int writers;            /* writer threads, 0 means 2 */
+    size_t chunk_size;      /* ciphertext bytes per chunk, 0 means 1 MiB */
+    size_t queue_depth;     /* chunks held by each queue between stages, 0 means twice the busier stage */
+} pgmmv_pipeline_config;
+
+/*
+ * pgmmv_decrypt_files_ex() through separate reader, decryption and writer stages
+ * connected by bounded queues, so that reading, decryption and writing overlap across files
+ * each reader reads its files chunk by chunk, chunks are decrypted and written in any order
+ * memory stays at about (2 * queue_depth + all threads) chunks, `config` may be NULL,
+ * `queue_depth`, then `chunk_size` down to 64 KiB, are lowered for the chunks to fit pgmmv_set_max_inflight()
+ * PGMMV_INPLACE is passed on to pgmmv_decrypt_files_ex() with `config->decrypters` threads
+ * with PGMMV_DIRECT, chunks are rounded up to whole pages
+ * with PGMMV_DISKORDER, readers take the files in disk order
+ */
+int pgmmv_decrypt_files_pipeline(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len,
+                                 const pgmmv_pipeline_config* config, int flags);
+
+
+/* tree decryption */
+
+/*
+ * called on the calling thread with each batch of tasks once it is done, batches come in walk order
+ * the tasks and their paths are freed on return, return nonzero to stop the walk
+ */
+typedef int (*pgmmv_tree_callback)(const pgmmv_file_task* tasks, size_t count, void* ctx);
+
+/*
+ * decrypt every file below the directory `src` into the same tree below `dst`
+ * a helper thread walks the tree relative to directory descriptors, taking entry types from the directory
+ * without a stat per file, and creates each output directory once; meanwhile the calling thread decrypts
+ * the files found so far as one batch of pgmmv_decrypt_files_ex() with `threads` threads,
+ * or of pgmmv_decrypt_files_pipeline() if `pipeline` is not NULL
+ * a file `src` is decrypted to `dst` alone, PGMMV_INPLACE ignores `dst` and skips journals
+ * a directory which cannot be read or created ends the walk, reported as a failed task of its own paths,
+ * with PGMMV_FAILFAST so does a failed file
+ * return 0 if every file succeeded, or -1 with errno of the first failure,
+ * ECANCELED if only `done` stopped the walk
+ */
+int pgmmv_decrypt_tree(const char* src, const char* dst, const uint8_t* key, size_t key_len, int threads,
+                       const pgmmv_pipeline_config* pipeline, int flags, pgmmv_tree_callback done, void* ctx);
+
+#define PGMMV_AUTOTUNE      0x100   /* try other profiles on the first files and keep the fastest */
+
+/*
+ * pgmmv_decrypt_tree() with `profile->threads` decryption threads and the parameters of `profile`,
+ * which override `pipeline->decrypters` and `pipeline->chunk_size` where set
+ * with PGMMV_AUTOTUNE, the first seconds of the run decrypt samples of files with one parameter changed
+ * at a time from `profile`: threads, then chunk size, then split size where the files seen are large enough;
+ * the rest of the files go with the fastest, stored back to `profile` with every zero resolved
+ */
+int pgmmv_decrypt_tree_tuned(const char* src, const char* dst, const uint8_t* key, size_t key_len,
+                             pgmmv_tune_profile* profile, const pgmmv_pipeline_config* pipeline, int flags,
+                             pgmmv_tree_callback done, void* ctx);
+
+
+/* scanning */
+
+typedef struct _pgmmv_scan_task {
+    const char* path;
+    uint64_t file_size;     /* set once the file is opened */
+    pgmmv_header header;    /* set if `result` is 0 */
+    int result;             /* 0, or -1 on failure */
+    int error;              /* errno of the failure, EBADMSG for a malformed header */
+} pgmmv_scan_task;
+
+/*
+ * stat every file and read its header alone, with `threads` threads, 0 means pgmmv_cpu_count()
+ * a failed task does not stop the others
+ * return 0 if all tasks succeeded, or -1 with errno of the first failed task
+ */
+int pgmmv_scan_files(pgmmv_scan_task* tasks, size_t count, int threads);
+
+/*
+ * called as pgmmv_tree_callback is, with scanned tasks
+ */
+typedef int (*pgmmv_scan_callback)(const pgmmv_scan_task* tasks, size_t count, void* ctx);
+
+/*
+ * scan every file below the directory `src` with the walk of pgmmv_decrypt_tree(), the files found so far
+ * going as one batch of pgmmv_scan_files() while the rest of the tree is still walked
+ * a directory which cannot be read ends the walk, reported as a failed task of its own path
+ * return 0 if every file was scanned, or -1 with errno of the first failure,
+ * ECANCELED if only `done` stopped the walk
+ */
+int pgmmv_scan_tree(const char* src, int threads, pgmmv_scan_callback done, void* ctx);
+
+
+/* thread pool */
+
+/*
+ * pool of long-lived worker threads running jobs in submission order
+ */
+typedef struct _pgmmv_pool pgmmv_pool;
+
+/*
+ * job embedded by the caller in its own structure, it MUST stay valid until `run` is called
+ * `run` is called on a worker thread, it may free the job
+ */
+typedef struct _pgmmv_pool_job {
+    void (*run)(struct _pgmmv_pool_job* job);
+    struct _pgmmv_pool_job* next;   /* owned by the pool */
+} pgmmv_pool_job;
+
+/*
+ * start a pool of `threads` threads, 0 means pgmmv_cpu_count()
+ * return NULL on failure
+ */
+pgmmv_pool* pgmmv_pool_create(int threads);
+
+void pgmmv_pool_submit(pgmmv_pool* pool, pgmmv_pool_job* job);
+
+/*
+ * run the jobs still queued, then stop and free the pool
+ */
+void pgmmv_pool_destroy(pgmmv_pool* pool);
@@ -0,0 +1,207 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+
+/* buffer arena */
+
+/*
+ * each thread keeps the buffers it gave back, by power-of-two size class, for the next files it decrypts,
+ * so that a batch costs a few allocations and page faults per thread instead of per file
+ */
+
+#define PGMMV_ARENAMIN      15          /* log2 of the smallest size class, PGMMV_SMALLSIZE */
+#define PGMMV_ARENAMAX      23          /* log2 of the largest size class kept */
+#define PGMMV_ARENASLOTS    2           /* buffers kept per size class, a double-buffered stream takes two */
+#define PGMMV_ARENABYTES    (1 << 24)   /* most bytes kept by one thread */
+#define PGMMV_HUGESIZE      (1 << 21)   /* transparent huge page size */
+
+typedef struct _pgmmv_arena {
+    uint8_t* slots[PGMMV_ARENAMAX - PGMMV_ARENAMIN + 1][PGMMV_ARENASLOTS];
+    size_t held;                /* bytes kept */
+} pgmmv_arena;
+
+static pthread_key_t _pgmmv_arena_key;
+static pthread_once_t _pgmmv_arena_once = PTHREAD_ONCE_INIT;
+static int _pgmmv_arena_ready;
+static atomic_int _pgmmv_hugepages;
+
+void pgmmv_set_hugepages(int enable) {
+    atomic_store(&_pgmmv_hugepages, enable != 0);
+}
+
+/* the buffers kept go along with their thread */
+static void _pgmmv_arena_destroy(void* arg) {
+    pgmmv_arena* arena = (pgmmv_arena*)arg;
+    for (int cls = 0; cls <= PGMMV_ARENAMAX - PGMMV_ARENAMIN; cls++) {
+        for (int slot = 0; slot < PGMMV_ARENASLOTS; slot++) free(arena->slots[cls][slot]);
+    }
+    free(arena);
+}
+
+static void _pgmmv_arena_init() {
+    _pgmmv_arena_ready = (pthread_key_create(&_pgmmv_arena_key, _pgmmv_arena_destroy) == 0);
+}
+
+/* the arena of the calling thread, NULL if it cannot have one */
+static pgmmv_arena* _pgmmv_arena() {
+    pthread_once(&_pgmmv_arena_once, _pgmmv_arena_init);
+    if (!_pgmmv_arena_ready) return NULL;
+
+    pgmmv_arena* arena = (pgmmv_arena*)pthread_getspecific(_pgmmv_arena_key);
+    if (arena) return arena;
+    arena = (pgmmv_arena*)calloc(1, sizeof(pgmmv_arena));
+    if (arena && pthread_setspecific(_pgmmv_arena_key, arena) != 0) {
+        free(arena);
+        arena = NULL;
+    }
+    return arena;
+}
+
+/* log2 of the size class of `size`, above PGMMV_ARENAMAX if buffers that large are not kept */
+static int _pgmmv_size_class(size_t size) {
+    int cls = PGMMV_ARENAMIN;
+    while (cls <= PGMMV_ARENAMAX && ((size_t)1 << cls) < size) cls++;
+    return cls;
+}
+
+static uint8_t* _pgmmv_buffer_alloc(size_t size) {
+    /* a huge page only backs a range aligned to it */
+    int huge = atomic_load_explicit(&_pgmmv_hugepages, memory_order_relaxed) && size >= PGMMV_HUGESIZE;
+    void* buffer;
+    if (posix_memalign(&buffer, (huge) ? PGMMV_HUGESIZE : PGMMV_DIRECTALIGN, size) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+    return (uint8_t*)buffer;
+}
+
+uint8_t* pgmmv_buffer_get(size_t size) {
+    int cls = _pgmmv_size_class(size);
+    if (cls > PGMMV_ARENAMAX) return _pgmmv_buffer_alloc(size);
+
+    pgmmv_arena* arena = _pgmmv_arena();
+    for (int slot = 0; arena && slot < PGMMV_ARENASLOTS; slot++) {
+        uint8_t* buffer = arena->slots[cls - PGMMV_ARENAMIN][slot];
+        if (!buffer) continue;
+        arena->slots[cls - PGMMV_ARENAMIN][slot] = NULL;
+        arena->held -= (size_t)1 << cls;
+        return buffer;
+    }
+    return _pgmmv_buffer_alloc((size_t)1 << cls);
+}
+
+void pgmmv_buffer_put(uint8_t* buffer, size_t size) {
+    if (!buffer) return;
+
+    int cls = _pgmmv_size_class(size);
+    pgmmv_arena* arena = (cls <= PGMMV_ARENAMAX) ? _pgmmv_arena() : NULL;
+    if (arena && arena->held + ((size_t)1 << cls) <= PGMMV_ARENABYTES) {
+        for (int slot = 0; slot < PGMMV_ARENASLOTS; slot++) {
+            if (arena->slots[cls - PGMMV_ARENAMIN][slot]) continue;
+            arena->slots[cls - PGMMV_ARENAMIN][slot] = buffer;
+            arena->held += (size_t)1 << cls;
+            return;
+        }
+    }
+    free(buffer);
+}
+
+/* end buffer arena */
+
+
+/* memory budget */
+
+/*
+ * bytes of file data held by the decryptions of this process, charged by files as they start and
+ * by workers for the buffers they keep over a batch; only file charges wait, so that the ones in flight
+ * always finish and make room
+ */
+static pthread_mutex_t _pgmmv_budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _pgmmv_budget_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t _pgmmv_budget_limit;        /* 0 for no limit */
+static uint64_t _pgmmv_budget_used, _pgmmv_budget_peak;
+static size_t _pgmmv_budget_files;          /* file charges in flight */
+
+void pgmmv_set_max_inflight(uint64_t bytes) {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    _pgmmv_budget_limit = bytes;
+    pthread_cond_broadcast(&_pgmmv_budget_cond);
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+}
+
+uint64_t pgmmv_peak_inflight(int reset) {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    uint64_t peak = _pgmmv_budget_peak;
+    if (reset) _pgmmv_budget_peak = _pgmmv_budget_used;
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+    return peak;
+}
+
+uint64_t pgmmv_budget_limit() {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    uint64_t limit = _pgmmv_budget_limit;
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+    return limit;
+}
+
+/* with the lock held */
+static void _pgmmv_budget_charge(uint64_t bytes) {
+    _pgmmv_budget_used += bytes;
+    if (_pgmmv_budget_used > _pgmmv_budget_peak) _pgmmv_budget_peak = _pgmmv_budget_used;
+}
+
+int pgmmv_budget_admit(uint64_t bytes, int wait) {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    for (;;) {
+        int fits = !_pgmmv_budget_limit || _pgmmv_budget_used + bytes <= _pgmmv_budget_limit;
+        /* waiting on nothing in flight would be forever */
+        if (fits || (wait && !_pgmmv_budget_files)) break;
+        if (!wait) {
+            pthread_mutex_unlock(&_pgmmv_budget_lock);
+            return 0;
+        }
+        pthread_cond_wait(&_pgmmv_budget_cond, &_pgmmv_budget_lock);
+    }
+    _pgmmv_budget_charge(bytes);
+    _pgmmv_budget_files++;
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+    return 1;
+}
+
+void pgmmv_budget_leave(uint64_t bytes) {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    _pgmmv_budget_used -= bytes;
+    _pgmmv_budget_files--;
+    if (_pgmmv_budget_limit) pthread_cond_broadcast(&_pgmmv_budget_cond);
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+}
+
+int pgmmv_budget_hold(uint64_t bytes, int force) {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    int fits = force || !_pgmmv_budget_limit || _pgmmv_budget_used + bytes <= _pgmmv_budget_limit;
+    if (fits) _pgmmv_budget_charge(bytes);
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+    return fits;
+}
+
+void pgmmv_budget_unhold(uint64_t bytes) {
+    pthread_mutex_lock(&_pgmmv_budget_lock);
+    _pgmmv_budget_used -= bytes;
+    if (_pgmmv_budget_limit) pthread_cond_broadcast(&_pgmmv_budget_cond);
+    pthread_mutex_unlock(&_pgmmv_budget_lock);
+}
+
+/* end memory budget */
@@ -0,0 +1,660 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+
+/* thread helpers */
+
+#ifdef __linux__
+/* read a small text file whole, return its length, or -1 on failure */
+static ssize_t _pgmmv_read_text(const char* path, char* text, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t ret = pgmmv_read_full(fd, text, len - 1);
+    close(fd);
+    if (ret >= 0) text[ret] = '\0';
+    return ret;
+}
+
+/* the quota in `dir` in CPUs, rounded up, 0 if there is none */
+static int _pgmmv_cgroup_quota(const char* dir, int v2) {
+    char path[PATH_MAX + sizeof("/cpu.cfs_period_us")], text[64];
+    long long quota = -1, period = 0;
+    if (v2) {
+        /* "max 100000" without a quota */
+        snprintf(path, sizeof(path), "%s/cpu.max", dir);
+        if (_pgmmv_read_text(path, text, sizeof(text)) < 0 || sscanf(text, "%lld %lld", &quota, &period) != 2) return 0;
+    } else {
+        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+        if (_pgmmv_read_text(path, text, sizeof(text)) < 0 || sscanf(text, "%lld", &quota) != 1) return 0;
+        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+        if (_pgmmv_read_text(path, text, sizeof(text)) < 0 || sscanf(text, "%lld", &period) != 1) return 0;
+    }
+    return (quota > 0 && period > 0) ? (int)((quota + period - 1) / period) : 0;
+}
+
+/* CPUs the cgroup CPU quota of this process allows, the tightest from its cgroup up, 0 if there is none */
+static int _pgmmv_cpu_quota() {
+    char cgroups[4096];
+    if (_pgmmv_read_text("/proc/self/cgroup", cgroups, sizeof(cgroups)) < 0) return 0;
+
+    /* "0::/path" for cgroup v2, "N:cpu,cpuacct:/path" for v1 */
+    int quota = 0;
+    char* saved;
+    for (char* line = strtok_r(cgroups, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+        char* controllers = strchr(line, ':');
+        char* cgroup = (controllers) ? strchr(controllers + 1, ':') : NULL;
+        if (!cgroup) continue;
+        *cgroup++ = '\0';
+        controllers++;
+
+        int v2 = !*controllers, v1 = 0;
+        for (char* name = controllers; !v2 && name; name = strchr(name, ',')) {
+            name += (*name == ',');
+            v1 |= (!strncmp(name, "cpu", 3) && (name[3] == ',' || !name[3]));
+        }
+        if (!v1 && !v2) continue;
+
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s%s", (v2) ? "/sys/fs/cgroup" : "/sys/fs/cgroup/cpu", cgroup);
+        size_t root_len = strlen((v2) ? "/sys/fs/cgroup" : "/sys/fs/cgroup/cpu");
+        for (;;) {
+            int dir_quota = _pgmmv_cgroup_quota(dir, v2);
+            if (dir_quota && (!quota || dir_quota < quota)) quota = dir_quota;
+            char* slash = strrchr(dir, '/');
+            if (!slash || (size_t)(slash - dir) < root_len) break;
+            *slash = '\0';
+        }
+    }
+    return quota;
+}
+#endif
+
+int pgmmv_cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) count = CPU_COUNT(&set);
+    /* a container may run on many CPUs with the time of a few */
+    int quota = _pgmmv_cpu_quota();
+    if (quota && quota < count) count = quota;
+#endif
+    return (count > 0) ? (int)count : 1;
+}
+
+typedef struct _pgmmv_parallel {
+    atomic_size_t next;
+    size_t count;
+    pgmmv_jobproc job;
+    void* ctx;
+} pgmmv_parallel;
+
+static void* _pgmmv_parallel_worker(void* arg) {
+    pgmmv_parallel* parallel = (pgmmv_parallel*)arg;
+    for (;;) {
+        size_t idx = atomic_fetch_add(&parallel->next, 1);
+        if (idx >= parallel->count) return NULL;
+        parallel->job(parallel->ctx, idx);
+    }
+}
+
+void pgmmv_run_threads(int threads, void* (*worker)(void*), void* arg) {
+    /* the calling thread is one of the workers, failing to spawn only lowers the parallelism */
+    pthread_t* workers = (threads > 1) ? (pthread_t*)malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+    int spawned = 0;
+    while (workers && spawned < threads - 1) {
+        if (pthread_create(&workers[spawned], NULL, worker, arg) != 0) break;
+        spawned++;
+    }
+
+    worker(arg);
+    for (int idx = 0; idx < spawned; idx++) pthread_join(workers[idx], NULL);
+    free(workers);
+}
+
+void pgmmv_parallel_for(size_t count, int threads, pgmmv_jobproc job, void* ctx) {
+    if (threads <= 0) threads = pgmmv_cpu_count();
+    if ((size_t)threads > count) threads = (int)count;
+
+    pgmmv_parallel parallel = { .count = count, .job = job, .ctx = ctx };
+    atomic_init(&parallel.next, 0);
+    pgmmv_run_threads(threads, _pgmmv_parallel_worker, &parallel);
+}
+
+/* end thread helpers */
+
+
+/* batch decryption */
+
+typedef struct _pgmmv_batch {
+    void* tasks;
+    const uint8_t* key;
+    size_t key_len;
+} pgmmv_batch;
+
+static void _pgmmv_buffer_job(void* ctx, size_t idx) {
+    pgmmv_batch* batch = (pgmmv_batch*)ctx;
+    pgmmv_buffer_task* task = (pgmmv_buffer_task*)batch->tasks + idx;
+    task->result = pgmmv_decrypt_resource(task->dst, task->src, task->src_len, batch->key, batch->key_len);
+    task->error = (task->result < 0) ? errno : 0;
+}
+
+int pgmmv_decrypt_buffers(pgmmv_buffer_task* tasks, size_t count, const uint8_t* key, size_t key_len, int threads) {
+    pgmmv_batch batch = { .tasks = tasks, .key = key, .key_len = key_len };
+
+    /* small batches finish before extra threads would even start */
+    size_t total = 0;
+    for (size_t idx = 0; idx < count; idx++) total += tasks[idx].src_len;
+    if (threads <= 0) threads = pgmmv_cpu_count();
+    if ((size_t)threads > total / PGMMV_THREADBYTES + 1) threads = (int)(total / PGMMV_THREADBYTES + 1);
+    pgmmv_parallel_for(count, threads, _pgmmv_buffer_job, &batch);
+
+    for (size_t idx = 0; idx < count; idx++) {
+        if (tasks[idx].result < 0) {
+            errno = tasks[idx].error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* end batch decryption */
+
+
+/* scanning */
+
+static void _pgmmv_scan_job(void* ctx, size_t idx) {
+    pgmmv_scan_task* task = (pgmmv_scan_task*)ctx + idx;
+    task->result = -1;
+    int fd = open(task->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        task->error = errno;
+        return;
+    }
+
+    /* a malformed header still tells the file size */
+    struct stat st;
+    uint8_t head[PGMMV_HEADERSIZE];
+    ssize_t head_len = -1;
+    if (fstat(fd, &st) == 0) {
+        task->file_size = (uint64_t)st.st_size;
+        head_len = pgmmv_pread_full(fd, head, PGMMV_HEADERSIZE, 0);
+    }
+    if (head_len >= 0) task->result = pgmmv_parse_header(&task->header, head, (size_t)head_len, task->file_size);
+    task->error = (task->result < 0) ? errno : 0;
+    close(fd);
+}
+
+int pgmmv_scan_files(pgmmv_scan_task* tasks, size_t count, int threads) {
+    pgmmv_parallel_for(count, threads, _pgmmv_scan_job, tasks);
+    for (size_t idx = 0; idx < count; idx++) {
+        if (tasks[idx].result < 0) {
+            errno = tasks[idx].error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* end scanning */
+
+
+/* disk order */
+
+typedef struct _pgmmv_place {
+    size_t task_idx;
+    const char* src;
+    const char* dir;            /* output directory, the first `dir_len` bytes of the output path */
+    size_t dir_len;
+    int kind;                   /* 0 for a physical offset, 1 for an inode number, 2 if unknown; only a kind orders itself */
+    uint64_t pos;
+    int group_kind;             /* of the first file of the directory on disk */
+    uint64_t group_pos;
+} pgmmv_place;
+
+static void _pgmmv_place_job(void* ctx, size_t idx) {
+    pgmmv_place* place = (pgmmv_place*)ctx + idx;
+    int ret = pgmmv_disk_place(place->src, &place->pos);
+    place->kind = (ret == 1) ? 0 : (ret == 0) ? 1 : 2;
+}
+
+static int _pgmmv_dir_compare(const pgmmv_place* left, const pgmmv_place* right) {
+    int cmp = memcmp(left->dir, right->dir, (left->dir_len < right->dir_len) ? left->dir_len : right->dir_len);
+    if (cmp) return cmp;
+    return (left->dir_len > right->dir_len) - (left->dir_len < right->dir_len);
+}
+
+static int _pgmmv_pos_compare(int left_kind, uint64_t left_pos, int right_kind, uint64_t right_pos) {
+    if (left_kind != right_kind) return (left_kind < right_kind) ? -1 : 1;
+    return (left_pos > right_pos) - (left_pos < right_pos);
+}
+
+static int _pgmmv_place_by_dir(const void* lhs, const void* rhs) {
+    const pgmmv_place* left = (const pgmmv_place*)lhs, * right = (const pgmmv_place*)rhs;
+    int cmp = _pgmmv_dir_compare(left, right);
+    if (!cmp) cmp = _pgmmv_pos_compare(left->kind, left->pos, right->kind, right->pos);
+    return (cmp) ? cmp : (left->task_idx > right->task_idx) - (left->task_idx < right->task_idx);
+}
+
+static int _pgmmv_place_by_group(const void* lhs, const void* rhs) {
+    const pgmmv_place* left = (const pgmmv_place*)lhs, * right = (const pgmmv_place*)rhs;
+    int cmp = _pgmmv_pos_compare(left->group_kind, left->group_pos, right->group_kind, right->group_pos);
+    return (cmp) ? cmp : _pgmmv_place_by_dir(lhs, rhs);
+}
+
+size_t* pgmmv_disk_order(const pgmmv_file_task* tasks, size_t count, int threads) {
+    pgmmv_place* places = (pgmmv_place*)calloc(count ? count : 1, sizeof(pgmmv_place));
+    size_t* order = (size_t*)malloc(sizeof(size_t) * (count ? count : 1));
+    if (!places || !order) {
+        free(places);
+        free(order);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (size_t idx = 0; idx < count; idx++) {
+        const char* slash = strrchr(tasks[idx].dst, '/');
+        places[idx] = (pgmmv_place){
+            .task_idx = idx, .src = tasks[idx].src, .dir = tasks[idx].dst, .dir_len = (slash) ? (size_t)(slash - tasks[idx].dst) : 0,
+        };
+    }
+    pgmmv_parallel_for(count, threads, _pgmmv_place_job, places);
+
+    /* each directory goes where its first file lies, so that reads seek once per directory and outputs are written together */
+    qsort(places, count, sizeof(pgmmv_place), _pgmmv_place_by_dir);
+    for (size_t idx = 0; idx < count; idx++) {
+        const pgmmv_place* first = (idx && !_pgmmv_dir_compare(&places[idx - 1], &places[idx])) ? &places[idx - 1] : NULL;
+        places[idx].group_kind = (first) ? first->group_kind : places[idx].kind;
+        places[idx].group_pos = (first) ? first->group_pos : places[idx].pos;
+    }
+    qsort(places, count, sizeof(pgmmv_place), _pgmmv_place_by_group);
+
+    for (size_t idx = 0; idx < count; idx++) order[idx] = places[idx].task_idx;
+    free(places);
+    return order;
+}
+
+/* end disk order */
+
+
+/* file scheduler */
+
+/*
+ * files are decrypted by a pool of workers taking work items from the front of a shared queue
+ * items are sorted by size, largest first (LPT), so that the makespan stays close to optimal;
+ * a huge encrypted file is split into parts decrypted concurrently with positional I/O,
+ * the first worker to reach a part opens the file for all of them, the last one closes it;
+ * with PGMMV_DISKORDER, items are queued in disk order instead and small files are not set apart
+ */
+
+typedef struct _pgmmv_split_file {
+    pthread_mutex_t lock;
+    int state;                      /* SPLIT_* */
+    int ifd, ofd;
+    int direct;                     /* `ofd` opened with O_DIRECT */
+    pgmmv_header header;
+    pgmmv_cipher cipher;
+    atomic_int parts_left;
+    atomic_int error;               /* errno of the first failed part */
+} pgmmv_split_file;
+
+enum { SPLIT_PENDING, SPLIT_OPENED, SPLIT_WHOLE, SPLIT_FAILED };
+
+typedef struct _pgmmv_file_item {
+    size_t task_idx;
+    uint64_t cost;                  /* bytes to process, the sort key */
+    pgmmv_split_file* split;        /* NULL for a whole file */
+    uint64_t offset, len;           /* ciphertext range of a part */
+    int last;                       /* last part of a split file */
+} pgmmv_file_item;
+
+typedef struct _pgmmv_file_sched {
+    pgmmv_file_task* tasks;
+    uint64_t* sizes;
+    pgmmv_file_item* items;
+    size_t item_count;
+    atomic_size_t next;
+    atomic_int failed;
+    int flags;
+    const uint8_t* key;
+    size_t key_len;
+    size_t chunk_size;              /* bytes per read of a part */
+    uint64_t split_size, part_size;
+} pgmmv_file_sched;
+
+static void _pgmmv_task_done(pgmmv_file_sched* sched, pgmmv_file_task* task, int64_t result, int err) {
+    task->result = result;
+    task->error = (result < 0) ? err : 0;
+    if (result < 0) atomic_store(&sched->failed, 1);
+}
+
+/* planned size of a task done while planning */
+#define PGMMV_PLANNED_DONE  UINT64_MAX
+
+static void _pgmmv_stat_job(void* ctx, size_t idx) {
+    pgmmv_file_sched* sched = (pgmmv_file_sched*)ctx;
+    pgmmv_file_task* task = &sched->tasks[idx];
+    struct stat st;
+    int regular = (stat(task->src, &st) == 0 && S_ISREG(st.st_mode));
+    sched->sizes[idx] = (regular) ? (uint64_t)st.st_size : 0;
+    if (!regular || !(sched->flags & PGMMV_LINKPLAIN) || (sched->flags & PGMMV_INPLACE)) return;
+    if ((sched->flags & PGMMV_FAILFAST) && atomic_load(&sched->failed)) return;
+
+    int64_t result = pgmmv_link_plain(task->src, task->dst);
+    if (result == PGMMV_NOLINK) return;
+    _pgmmv_task_done(sched, task, result, errno);
+    sched->sizes[idx] = PGMMV_PLANNED_DONE;
+}
+
+static uint64_t _pgmmv_split_len(const pgmmv_file_sched* sched, uint64_t file_size, int threads) {
+    /* the ciphertext length if the file is worth splitting, 0 otherwise, a file rewritten in place is never split */
+    uint64_t ct_len = (file_size > PGMMV_HEADERSIZE) ? file_size - PGMMV_HEADERSIZE : 0;
+    if (sched->flags & PGMMV_INPLACE) return 0;
+    return (threads > 1 && ct_len >= sched->split_size && ct_len % PGMMV_BLOCKSIZE == 0) ? ct_len : 0;
+}
+
+static int _pgmmv_item_compare(const void* lhs, const void* rhs) {
+    const pgmmv_file_item* left = (const pgmmv_file_item*)lhs, * right = (const pgmmv_file_item*)rhs;
+    if (left->cost != right->cost) return (left->cost < right->cost) ? 1 : -1;
+    if (left->task_idx != right->task_idx) return (left->task_idx < right->task_idx) ? -1 : 1;
+    return (left->offset < right->offset) ? -1 : (left->offset > right->offset);
+}
+
+static int _pgmmv_split_open(pgmmv_split_file* split, const pgmmv_file_task* task, const uint8_t* key, size_t key_len, int flags) {
+    uint64_t file_size;
+    if (pgmmv_open_resource(task->src, &split->ifd, &split->header, &file_size) < 0) return SPLIT_FAILED;
+    pgmmv_advise_input(split->ifd);
+
+    /* no longer encrypted since planned, the part opening it does the whole file */
+    if (!split->header.is_encrypted) {
+        close(split->ifd);
+        return SPLIT_WHOLE;
+    }
+
+    if (pgmmv_prepare_key(&split->cipher, key, key_len, split->header.pt_len) == 0) {
+        split->direct = (flags & PGMMV_DIRECT) != 0;
+        split->ofd = pgmmv_open_output(task->dst, &split->direct);
+        if (split->ofd >= 0 && ftruncate(split->ofd, (off_t)split->header.pt_len) == 0) return SPLIT_OPENED;
+        if (split->ofd >= 0) {
+            int err = errno;
+            close(split->ofd);
+            errno = err;
+        }
+    }
+
+    int err = errno;
+    close(split->ifd);
+    errno = err;
+    return SPLIT_FAILED;
+}
+
+static void _pgmmv_split_fail(pgmmv_split_file* split, int err) {
+    int expected = 0;
+    atomic_compare_exchange_strong(&split->error, &expected, err);
+}
+
+static void _pgmmv_split_part(pgmmv_file_sched* sched, const pgmmv_file_item* item, uint8_t* buffer) {
+    pgmmv_split_file* split = item->split;
+    pgmmv_file_task* task = &sched->tasks[item->task_idx];
+
+    int whole = 0;
+    pthread_mutex_lock(&split->lock);
+    if (split->state == SPLIT_PENDING && !atomic_load(&split->error)) {
+        split->state = _pgmmv_split_open(split, task, sched->key, sched->key_len, sched->flags);
+        if (split->state == SPLIT_FAILED) _pgmmv_split_fail(split, errno);
+        whole = (split->state == SPLIT_WHOLE);
+    }
+    pthread_mutex_unlock(&split->lock);
+
+    if (whole) {
+        int64_t result = pgmmv_decrypt_file_ex(task->src, task->dst, sched->key, sched->key_len, sched->flags & PGMMV_IOFLAGS);
+        _pgmmv_task_done(sched, task, result, errno);
+    } else if (split->state == SPLIT_OPENED && !atomic_load(&split->error)) {
+        /* the last part runs to the end of plaintext, wherever that is by now */
+        uint64_t len = (item->last) ? UINT64_MAX - item->offset : item->len;
+        if (!buffer) _pgmmv_split_fail(split, ENOMEM);
+        else if (pgmmv_decrypt_range(split->ifd, split->ofd, &split->cipher, split->header.pt_len,
+                                     item->offset, len, buffer, sched->chunk_size, split->direct) < 0) _pgmmv_split_fail(split, errno);
+    }
+
+    /* the last part to finish closes the file and reports the result */
+    if (atomic_fetch_sub(&split->parts_left, 1) > 1) return;
+    if (split->state == SPLIT_WHOLE) return;
+
+    if (split->state == SPLIT_OPENED) {
+        if ((sched->flags & PGMMV_IOFLAGS) && !atomic_load(&split->error)) {
+            pgmmv_drop_cache(split->ifd, 0);
+            if (pgmmv_drop_cache(split->ofd, 1) < 0) _pgmmv_split_fail(split, errno);
+        }
+        close(split->ifd);
+        if (close(split->ofd) < 0) _pgmmv_split_fail(split, errno);
+        memset(&split->cipher, 0, sizeof(split->cipher));
+    }
+    int err = atomic_load(&split->error);
+    _pgmmv_task_done(sched, task, (err) ? -1 : (int64_t)split->header.pt_len, err);
+}
+
+/* small files, the tail of the queue since it is sorted by size */
+
+typedef struct _pgmmv_small_feed {
+    pgmmv_small_source base;
+    pgmmv_file_sched* sched;
+    pgmmv_file_item* first;         /* already taken from the queue */
+} pgmmv_small_feed;
+
+static int _pgmmv_small_next(pgmmv_small_source* source, pgmmv_file_task** task, uint64_t* size) {
+    pgmmv_small_feed* feed = (pgmmv_small_feed*)source;
+    pgmmv_file_sched* sched = feed->sched;
+
+    for (;;) {
+        pgmmv_file_item* item = feed->first;
+        feed->first = NULL;
+        if (!item) {
+            size_t idx = atomic_fetch_add(&sched->next, 1);
+            if (idx >= sched->item_count) return 0;
+            item = &sched->items[idx];
+        }
+
+        *task = &sched->tasks[item->task_idx];
+        *size = item->cost;
+        if (!((sched->flags & PGMMV_FAILFAST) && atomic_load(&sched->failed))) return 1;
+        _pgmmv_task_done(sched, *task, -1, ECANCELED);
+    }
+}
+
+static void _pgmmv_small_done(pgmmv_small_source* source, pgmmv_file_task* task, int64_t result, int err) {
+    _pgmmv_task_done(((pgmmv_small_feed*)source)->sched, task, result, err);
+}
+
+static void _pgmmv_small_files(pgmmv_file_sched* sched, pgmmv_file_item* first) {
+    pgmmv_small_feed feed = {
+        .base = { .next = _pgmmv_small_next, .done = _pgmmv_small_done, .key = sched->key, .key_len = sched->key_len },
+        .sched = sched,
+        .first = first,
+    };
+
+    /*
+     * many files in flight on io_uring, or one at a time with pread/pwrite without it, to drop them from the cache,
+     * or when its buffers do not fit the memory budget
+     */
+    uint64_t ring_len = (uint64_t)PGMMV_URINGDEPTH * PGMMV_SMALLSIZE;
+    int ring = !(sched->flags & (PGMMV_NOURING | PGMMV_IOFLAGS)) && pgmmv_budget_hold(ring_len, 0);
+    pgmmv_uring* engine = (ring) ? pgmmv_uring_create() : NULL;
+    if (engine) {
+        pgmmv_uring_run(engine, &feed.base);
+        pgmmv_uring_destroy(engine);
+    }
+    if (ring) pgmmv_budget_unhold(ring_len);
+    if (engine) return;
+
+    uint8_t* buffer = pgmmv_buffer_get(PGMMV_SMALLSIZE);
+    if (buffer) pgmmv_budget_hold(PGMMV_SMALLSIZE, 1);
+    pgmmv_file_task* task;
+    uint64_t size;
+    while (_pgmmv_small_next(&feed.base, &task, &size)) {
+        int64_t result = (buffer) ? pgmmv_decrypt_small(task, buffer, PGMMV_SMALLSIZE, sched->key, sched->key_len, sched->flags)
+                                  : pgmmv_decrypt_file_ex(task->src, task->dst, sched->key, sched->key_len, sched->flags & PGMMV_IOFLAGS);
+        _pgmmv_task_done(sched, task, result, errno);
+    }
+    if (buffer) pgmmv_budget_unhold(PGMMV_SMALLSIZE);
+    pgmmv_buffer_put(buffer, PGMMV_SMALLSIZE);
+}
+
+static void* _pgmmv_file_worker(void* arg) {
+    pgmmv_file_sched* sched = (pgmmv_file_sched*)arg;
+    uint8_t* buffer = NULL;
+
+    for (;;) {
+        size_t idx = atomic_fetch_add(&sched->next, 1);
+        if (idx >= sched->item_count) break;
+
+        pgmmv_file_item* item = &sched->items[idx];
+        if (!item->split && item->cost < PGMMV_SMALLSIZE && !(sched->flags & (PGMMV_INPLACE | PGMMV_DISKORDER))) {
+            _pgmmv_small_files(sched, item);
+            break;
+        }
+
+        int cancel = (sched->flags & PGMMV_FAILFAST) && atomic_load(&sched->failed);
+        if (!item->split) {
+            pgmmv_file_task* task = &sched->tasks[item->task_idx];
+            int64_t result;
+            if (cancel) {
+                errno = ECANCELED;
+                result = -1;
+            } else if (sched->flags & PGMMV_INPLACE) {
+                result = pgmmv_decrypt_file_inplace(task->src, sched->key, sched->key_len, sched->flags & (PGMMV_JOURNAL | PGMMV_IOFLAGS));
+            } else {
+                result = pgmmv_decrypt_file_ex(task->src, task->dst, sched->key, sched->key_len, sched->flags & PGMMV_IOFLAGS);
+            }
+            _pgmmv_task_done(sched, task, result, errno);
+            continue;
+        }
+
+        if (cancel) _pgmmv_split_fail(item->split, ECANCELED);
+
+        /* aligned for parts written with O_DIRECT */
+        if (!buffer && (buffer = pgmmv_buffer_get(sched->chunk_size))) pgmmv_budget_hold(sched->chunk_size, 1);
+        _pgmmv_split_part(sched, item, buffer);
+    }
+
+    if (buffer) pgmmv_budget_unhold(sched->chunk_size);
+    pgmmv_buffer_put(buffer, sched->chunk_size);
+    return NULL;
+}
+
+int pgmmv_files_status(const pgmmv_file_task* tasks, size_t count) {
+    /* a cancelled task is only reported if nothing else failed */
+    int err = 0;
+    for (size_t idx = 0; idx < count; idx++) {
+        if (tasks[idx].result >= 0) continue;
+        if (tasks[idx].error != ECANCELED) {
+            errno = tasks[idx].error;
+            return -1;
+        }
+        err = ECANCELED;
+    }
+    if (err) errno = err;
+    return (err) ? -1 : 0;
+}
+
+int pgmmv_decrypt_files(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len, int threads) {
+    return pgmmv_decrypt_files_ex(tasks, count, key, key_len, threads, 0);
+}
+
+int pgmmv_decrypt_files_ex(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len, int threads, int flags) {
+    pgmmv_tune_profile profile = { .threads = threads };
+    return pgmmv_decrypt_files_tuned(tasks, count, key, key_len, &profile, flags);
+}
+
+int pgmmv_decrypt_files_tuned(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len,
+                              const pgmmv_tune_profile* profile, int flags) {
+    int threads = (profile->threads > 0) ? profile->threads : pgmmv_cpu_count();
+
+    /* whole pages, so that parts written with O_DIRECT stay aligned */
+    pgmmv_file_sched sched = { .tasks = tasks, .flags = flags, .key = key, .key_len = key_len };
+    sched.chunk_size = (profile->chunk_size) ? profile->chunk_size : PGMMV_CHUNKSIZE;
+    sched.chunk_size = (sched.chunk_size < PGMMV_DIRECTALIGN) ? PGMMV_DIRECTALIGN : sched.chunk_size - sched.chunk_size % PGMMV_DIRECTALIGN;
+    sched.split_size = (profile->split_size > PGMMV_MAPSIZE) ? profile->split_size : (profile->split_size) ? PGMMV_MAPSIZE : PGMMV_SPLITSIZE;
+    sched.part_size = sched.split_size / 2 - (sched.split_size / 2) % PGMMV_DIRECTALIGN;
+    sched.sizes = (uint64_t*)calloc(count ? count : 1, sizeof(uint64_t));
+    if (!sched.sizes) return -1;
+
+    /* plan: sizes first, then one item per file or per part of a huge file */
+    atomic_init(&sched.failed, 0);
+    pgmmv_parallel_for(count, threads, _pgmmv_stat_job, &sched);
+
+    size_t item_count = 0, split_count = 0;
+    for (size_t idx = 0; idx < count; idx++) {
+        if (sched.sizes[idx] == PGMMV_PLANNED_DONE) continue;
+        uint64_t ct_len = _pgmmv_split_len(&sched, sched.sizes[idx], threads);
+        item_count += (ct_len) ? (size_t)(ct_len / sched.part_size) : 1;
+        split_count += (ct_len) ? 1 : 0;
+    }
+
+    sched.items = (pgmmv_file_item*)calloc(item_count ? item_count : 1, sizeof(pgmmv_file_item));
+    pgmmv_split_file* splits = (pgmmv_split_file*)calloc(split_count ? split_count : 1, sizeof(pgmmv_split_file));
+    size_t* order = (flags & PGMMV_DISKORDER) ? pgmmv_disk_order(tasks, count, threads) : NULL;
+    if (!sched.items || !splits || ((flags & PGMMV_DISKORDER) && !order)) {
+        free(order);
+        free(sched.items);
+        free(splits);
+        free(sched.sizes);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* in disk order, items are made in the order they are run, parts of a split file in file order */
+    pgmmv_split_file* next_split = splits;
+    for (size_t pos = 0; pos < count; pos++) {
+        size_t idx = (order) ? order[pos] : pos;
+        if (sched.sizes[idx] == PGMMV_PLANNED_DONE) continue;
+        uint64_t ct_len = _pgmmv_split_len(&sched, sched.sizes[idx], threads);
+        if (!ct_len) {
+            sched.items[sched.item_count++] = (pgmmv_file_item){ .task_idx = idx, .cost = sched.sizes[idx] };
+            continue;
+        }
+
+        pgmmv_split_file* split = next_split++;
+        pthread_mutex_init(&split->lock, NULL);
+        /* the last part takes the remainder, so that no part is smaller than the others */
+        int parts = (int)(ct_len / sched.part_size);
+        for (int part = 0; part < parts; part++) {
+            uint64_t offset = (uint64_t)part * sched.part_size;
+            uint64_t len = (part == parts - 1) ? ct_len - offset : sched.part_size;
+            sched.items[sched.item_count++] = (pgmmv_file_item){
+                .task_idx = idx, .cost = len, .split = split, .offset = offset, .len = len, .last = (part == parts - 1),
+            };
+        }
+        atomic_init(&split->parts_left, parts);
+        atomic_init(&split->error, 0);
+    }
+    if (!order) qsort(sched.items, sched.item_count, sizeof(pgmmv_file_item), _pgmmv_item_compare);
+
+    atomic_init(&sched.next, 0);
+    pgmmv_run_threads((threads < (int)sched.item_count) ? threads : (int)sched.item_count, _pgmmv_file_worker, &sched);
+
+    for (size_t idx = 0; idx < split_count; idx++) pthread_mutex_destroy(&splits[idx].lock);
+    free(order);
+    free(splits);
+    free(sched.items);
+    free(sched.sizes);
+
+    return pgmmv_files_status(tasks, count);
+}
+
+/* end file scheduler */
@@ -0,0 +1,566 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC   0
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT    0
+#endif
+
+
+/* I/O helpers */
+
+ssize_t pgmmv_read_full(int fd, void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = read(fd, (uint8_t*)buf + done, len - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+        done += (size_t)ret;
+    }
+    return (ssize_t)done;
+}
+
+int pgmmv_write_full(int fd, const void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = write(fd, (const uint8_t*)buf + done, len - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        done += (size_t)ret;
+    }
+    return 0;
+}
+
+ssize_t pgmmv_pread_full(int fd, void* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = pread(fd, (uint8_t*)buf + done, len - done, (off_t)(offset + done));
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        if (ret == 0) break;
+        done += (size_t)ret;
+    }
+    return (ssize_t)done;
+}
+
+int pgmmv_pwrite_full(int fd, const void* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t ret = pwrite(fd, (const uint8_t*)buf + done, len - done, (off_t)(offset + done));
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        done += (size_t)ret;
+    }
+    return 0;
+}
+
+/* the rest of an output goes through the page cache */
+static int _pgmmv_clear_direct(int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0 || !(fl & O_DIRECT)) return fl;
+    return fcntl(fd, F_SETFL, fl & ~O_DIRECT);
+}
+
+/* `offset` is -1 to write at the file position */
+static int _pgmmv_write_out(int fd, const uint8_t* buf, size_t len, int64_t offset, int direct) {
+    size_t done = 0;
+    while (done < len) {
+        size_t remaining = len - done;
+        if (direct && (remaining < PGMMV_DIRECTALIGN || (uintptr_t)(buf + done) % PGMMV_DIRECTALIGN)) {
+            if (_pgmmv_clear_direct(fd) < 0) return -1;
+            direct = 0;
+        }
+
+        size_t chunk = (direct) ? remaining - remaining % PGMMV_DIRECTALIGN : remaining;
+        ssize_t ret = (offset < 0) ? write(fd, buf + done, chunk) : pwrite(fd, buf + done, chunk, (off_t)(offset + done));
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && errno == EINVAL && direct) {
+            if (_pgmmv_clear_direct(fd) < 0) return -1;
+            direct = 0;
+            continue;
+        }
+        if (ret < 0) return -1;
+        done += (size_t)ret;
+    }
+    return 0;
+}
+
+int pgmmv_write_out(int fd, const void* buf, size_t len, int direct) {
+    return _pgmmv_write_out(fd, (const uint8_t*)buf, len, -1, direct);
+}
+
+int pgmmv_pwrite_out(int fd, const void* buf, size_t len, uint64_t offset, int direct) {
+    return _pgmmv_write_out(fd, (const uint8_t*)buf, len, (int64_t)offset, direct);
+}
+
+/* end I/O helpers */
+
+
+/* file helpers */
+
+int pgmmv_open_resource(const char* src, int* ifd, pgmmv_header* header, uint64_t* file_size) {
+    int fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    uint8_t head[PGMMV_HEADERSIZE];
+    ssize_t head_len = -1;
+    if (fstat(fd, &st) == 0) head_len = pgmmv_pread_full(fd, head, PGMMV_HEADERSIZE, 0);
+    if (head_len < 0 || pgmmv_parse_header(header, head, (size_t)head_len, (uint64_t)st.st_size) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    *ifd = fd;
+    *file_size = (uint64_t)st.st_size;
+    return 0;
+}
+
+void pgmmv_advise_input(int fd) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    /* a doubled readahead window, the first one in flight before the first read */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, PGMMV_STREAMSIZE, POSIX_FADV_WILLNEED);
+#else
+    (void)fd;
+#endif
+}
+
+int pgmmv_open_output(const char* dst, int* direct) {
+    if (!O_DIRECT) *direct = 0;
+    int fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | ((*direct) ? O_DIRECT : 0), 0666);
+    if (fd < 0 && *direct && errno == EINVAL) {
+        *direct = 0;
+        fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    }
+    return fd;
+}
+
+int pgmmv_drop_cache(int fd, int written) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return 0;
+
+    /* only clean pages can be dropped, waiting on the writeback of this file alone */
+#ifdef __linux__
+    if (written && sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) < 0) return -1;
+#else
+    if (written && fdatasync(fd) < 0) return -1;
+#endif
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    return 0;
+}
+
+int pgmmv_disk_place(const char* path, uint64_t* place) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    int ret = (fstat(fd, &st) == 0) ? 0 : -1;
+    *place = (uint64_t)st.st_ino;
+#ifdef FS_IOC_FIEMAP
+    /* the first extent is enough, files are read from their start */
+    uint64_t query[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1] = { 0 };
+    struct fiemap* map = (struct fiemap*)query;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (ret == 0 && ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents
+        && !(map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE))) {
+        *place = map->fm_extents[0].fe_physical;
+        ret = 1;
+    }
+#endif
+    close(fd);
+    return ret;
+}
+
+int pgmmv_decrypt_range(int ifd, int ofd, const pgmmv_cipher* cipher, uint64_t pt_len,
+                        uint64_t offset, uint64_t len, uint8_t* buffer, size_t buffer_len, int direct) {
+    /* the previous ciphertext block is the IV of the range */
+    uint8_t iv[PGMMV_BLOCKSIZE];
+    if (offset == 0) {
+        memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+    } else {
+        ssize_t ret = pgmmv_pread_full(ifd, iv, PGMMV_BLOCKSIZE, PGMMV_HEADERSIZE + offset - PGMMV_BLOCKSIZE);
+        if (ret < 0) return -1;
+        if (ret < PGMMV_BLOCKSIZE) {
+            errno = EBADMSG;
+            return -1;
+        }
+    }
+
+    /* only the blocks holding plaintext are read, `len` may run past them */
+    uint64_t ct_end = pt_len + (PGMMV_BLOCKSIZE - pt_len % PGMMV_BLOCKSIZE) % PGMMV_BLOCKSIZE;
+    len = (offset >= ct_end) ? 0 : (ct_end - offset < len) ? ct_end - offset : len;
+
+    buffer_len -= buffer_len % PGMMV_BLOCKSIZE;
+    for (uint64_t done = 0; done < len;) {
+        size_t chunk = (len - done < buffer_len) ? (size_t)(len - done) : buffer_len;
+        ssize_t ret = pgmmv_pread_full(ifd, buffer, chunk, PGMMV_HEADERSIZE + offset + done);
+        if (ret < 0) return -1;
+        if ((size_t)ret < chunk) {
+            errno = EBADMSG;    /* the file shrank since its header was parsed */
+            return -1;
+        }
+
+        uint64_t out_offset = offset + done;
+        size_t out_len = (pt_len - out_offset < chunk) ? (size_t)(pt_len - out_offset) : chunk;
+        pgmmv_cbc_decrypt(cipher, iv, buffer, buffer, chunk);
+        if (pgmmv_pwrite_out(ofd, buffer, out_len, out_offset, direct) < 0) return -1;
+        done += chunk;
+    }
+    return 0;
+}
+
+/* end file helpers */
+
+
+/* file decryption */
+
+#ifdef __linux__
+/* errors meaning the method does not apply to these files, not that copying failed */
+static int _pgmmv_copy_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ENOTTY || err == EBADF || err == ETXTBSY;
+}
+
+/*
+ * copy `ifd` from its start into `ofd` at its position without going through user space:
+ * reflink the whole file where the filesystem shares extents, then copy_file_range(), then sendfile()
+ * return the bytes copied, or -1 with *done bytes already copied when every method gave up
+ */
+static int64_t _pgmmv_copy_kernel(int ifd, int ofd, uint64_t* done) {
+    *done = 0;
+
+    /* a clone replaces the whole output, only for an empty one at its start */
+    struct stat st;
+    if (fstat(ofd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 0 && lseek(ofd, 0, SEEK_CUR) == 0
+        && ioctl(ofd, FICLONE, ifd) == 0 && fstat(ofd, &st) == 0) {
+        lseek(ifd, st.st_size, SEEK_SET);
+        lseek(ofd, st.st_size, SEEK_SET);
+        return (int64_t)st.st_size;
+    }
+
+    loff_t offset = 0;
+    for (;;) {
+        ssize_t len = copy_file_range(ifd, &offset, ofd, NULL, 1 << 30, 0);
+        if (len < 0 && errno == EINTR) continue;
+        if (len == 0) return (int64_t)offset;
+        if (len < 0) break;
+    }
+    if (!_pgmmv_copy_unsupported(errno)) return -1;
+
+    off_t sent = offset;
+    for (;;) {
+        ssize_t len = sendfile(ofd, ifd, &sent, 1 << 30);
+        if (len < 0 && errno == EINTR) continue;
+        if (len == 0) return (int64_t)sent;
+        if (len < 0) break;
+    }
+    *done = (uint64_t)sent;
+    return -1;
+}
+#endif
+
+int64_t pgmmv_copy_fd(int ifd, int ofd, uint8_t* buffer, const uint8_t* head, size_t head_len) {
+    uint64_t done = 0;
+#ifdef __linux__
+    /* the kernel copies from the start of file, the header included */
+    int64_t copied = _pgmmv_copy_kernel(ifd, ofd, &done);
+    if (copied >= 0) return copied;
+    if (!_pgmmv_copy_unsupported(errno)) return -1;
+    if (done) {
+        if (lseek(ifd, (off_t)done, SEEK_SET) < 0) return -1;
+        head_len = 0;
+    }
+#endif
+
+    if (pgmmv_write_full(ofd, head, head_len) < 0) return -1;
+
+    int64_t total = (int64_t)(done + head_len);
+    for (;;) {
+        ssize_t len = pgmmv_read_full(ifd, buffer, PGMMV_CHUNKSIZE);
+        if (len < 0) return -1;
+        if (len == 0) return total;
+        if (pgmmv_write_full(ofd, buffer, (size_t)len) < 0) return -1;
+        total += len;
+    }
+}
+
+static int64_t _pgmmv_decrypt_chunks(int ifd, int ofd, uint8_t* buffer, const pgmmv_cipher* cipher, uint64_t pt_len) {
+    uint8_t iv[PGMMV_BLOCKSIZE];
+    memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+
+    /* padding blocks past the plaintext are never written */
+    uint64_t remaining = pt_len;
+    while (remaining) {
+        ssize_t len = pgmmv_read_full(ifd, buffer, PGMMV_CHUNKSIZE);
+        if (len < 0) return -1;
+        if (len == 0 || len % PGMMV_BLOCKSIZE) {
+            errno = EBADMSG;    /* the file shrank since its header was parsed */
+            return -1;
+        }
+
+        size_t out_len = ((uint64_t)len < remaining) ? (size_t)len : (size_t)remaining;
+        pgmmv_cbc_decrypt(cipher, iv, buffer, buffer, (size_t)len);
+        if (pgmmv_write_full(ofd, buffer, out_len) < 0) return -1;
+        remaining -= out_len;
+    }
+    return (int64_t)pt_len;
+}
+
+int64_t pgmmv_decrypt_fd(int ifd, int ofd, const uint8_t* key, size_t key_len) {
+    struct stat st;
+    if (fstat(ifd, &st) < 0) return -1;
+
+    uint8_t head[PGMMV_HEADERSIZE];
+    ssize_t head_len = pgmmv_read_full(ifd, head, PGMMV_HEADERSIZE);
+    if (head_len < 0) return -1;
+
+    pgmmv_header header;
+    if (pgmmv_parse_header(&header, head, (size_t)head_len, (uint64_t)st.st_size) < 0) return -1;
+
+    pgmmv_budget_admit(PGMMV_CHUNKSIZE, 1);
+    uint8_t* buffer = pgmmv_buffer_get(PGMMV_CHUNKSIZE);
+    if (!buffer) {
+        pgmmv_budget_leave(PGMMV_CHUNKSIZE);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int64_t ret;
+    if (!header.is_encrypted) {
+        ret = pgmmv_copy_fd(ifd, ofd, buffer, head, (size_t)head_len);
+    } else {
+        pgmmv_cipher cipher;
+        ret = pgmmv_prepare_key(&cipher, key, key_len, header.pt_len);
+        if (ret == 0) ret = _pgmmv_decrypt_chunks(ifd, ofd, buffer, &cipher, header.pt_len);
+        memset(&cipher, 0, sizeof(cipher));
+    }
+
+    int err = errno;
+    pgmmv_buffer_put(buffer, PGMMV_CHUNKSIZE);
+    pgmmv_budget_leave(PGMMV_CHUNKSIZE);
+    errno = err;
+    return ret;
+}
+
+/*
+ * decrypt straight from a mapping of `ifd` into a mapping of `ofd`, both fresh regular files
+ * return PGMMV_NOMAP before touching `ofd` if mapping is not possible or worth it,
+ * or if both mappings resident would exceed the memory budget
+ * the input must not shrink meanwhile, reading a truncated mapping raises SIGBUS
+ */
+#define PGMMV_NOMAP     (-2)
+
+static int64_t _pgmmv_decrypt_mapped(int ifd, int ofd, const uint8_t* key, size_t key_len) {
+    struct stat ist, ost;
+    if (fstat(ifd, &ist) < 0 || fstat(ofd, &ost) < 0) return PGMMV_NOMAP;
+    if (!S_ISREG(ist.st_mode) || !S_ISREG(ost.st_mode) || ist.st_size < PGMMV_MAPSIZE) return PGMMV_NOMAP;
+    if ((fcntl(ofd, F_GETFL) & O_ACCMODE) != O_RDWR) return PGMMV_NOMAP;
+
+    uint8_t head[PGMMV_HEADERSIZE];
+    pgmmv_header header;
+    ssize_t head_len = pgmmv_pread_full(ifd, head, PGMMV_HEADERSIZE, 0);
+    if (head_len < 0) return -1;
+    if (pgmmv_parse_header(&header, head, (size_t)head_len, (uint64_t)ist.st_size) < 0) return -1;
+    if (!header.is_encrypted || !header.pt_len) return PGMMV_NOMAP;
+
+    size_t in_len = (size_t)ist.st_size, out_len = (size_t)header.pt_len;
+    if (!pgmmv_budget_admit((uint64_t)in_len + out_len, 0)) return PGMMV_NOMAP;
+    uint8_t* in = (uint8_t*)mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, ifd, 0);
+    if (in == MAP_FAILED) {
+        pgmmv_budget_leave((uint64_t)in_len + out_len);
+        return PGMMV_NOMAP;
+    }
+    madvise(in, in_len, MADV_SEQUENTIAL);
+    madvise(in, in_len, MADV_WILLNEED);
+
+    /* size the output once, reserving the blocks so that a full disk fails here and not as SIGBUS */
+    int64_t ret = -1;
+    int err;
+#ifdef __linux__
+    if (fallocate(ofd, 0, 0, (off_t)out_len) < 0 && errno != EOPNOTSUPP && errno != ENOSYS) goto finally;
+#endif
+    if (ftruncate(ofd, (off_t)out_len) < 0) goto finally;
+
+    /* the streaming fallback rewrites the sized output from its start */
+    uint8_t* out = (uint8_t*)mmap(NULL, out_len, PROT_READ | PROT_WRITE, MAP_SHARED, ofd, 0);
+    if (out == MAP_FAILED) {
+        ret = PGMMV_NOMAP;
+        goto finally;
+    }
+    madvise(out, out_len, MADV_SEQUENTIAL);
+
+    ret = pgmmv_decrypt_resource(out, in, in_len, key, key_len);
+    err = errno;
+    munmap(out, out_len);
+    errno = err;
+
+finally:
+    err = errno;
+    munmap(in, in_len);
+    pgmmv_budget_leave((uint64_t)in_len + out_len);
+    errno = err;
+    return ret;
+}
+
+/*
+ * decrypt a large encrypted `ifd` into `dst` opened with O_DIRECT, through an aligned buffer
+ * return PGMMV_NOMAP before opening `dst` if the output is too small to be worth it
+ */
+static int64_t _pgmmv_decrypt_direct(int ifd, const char* dst, int* ofd, const uint8_t* key, size_t key_len) {
+    struct stat st;
+    if (fstat(ifd, &st) < 0 || !S_ISREG(st.st_mode)) return PGMMV_NOMAP;
+
+    uint8_t head[PGMMV_HEADERSIZE];
+    pgmmv_header header;
+    ssize_t head_len = pgmmv_pread_full(ifd, head, PGMMV_HEADERSIZE, 0);
+    if (head_len < 0) return -1;
+    if (pgmmv_parse_header(&header, head, (size_t)head_len, (uint64_t)st.st_size) < 0) return -1;
+    if (!header.is_encrypted || header.pt_len < PGMMV_DIRECTSIZE) return PGMMV_NOMAP;
+
+    int direct = 1;
+    *ofd = pgmmv_open_output(dst, &direct);
+    if (*ofd < 0) return -1;
+
+    pgmmv_budget_admit(PGMMV_STREAMSIZE, 1);
+    uint8_t* buffer = pgmmv_buffer_get(PGMMV_STREAMSIZE);
+    if (!buffer) {
+        pgmmv_budget_leave(PGMMV_STREAMSIZE);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pgmmv_cipher cipher;
+    int ret = pgmmv_prepare_key(&cipher, key, key_len, header.pt_len);
+    if (ret == 0) ret = pgmmv_decrypt_range(ifd, *ofd, &cipher, header.pt_len, 0, UINT64_MAX, buffer, PGMMV_STREAMSIZE, direct);
+
+    int err = errno;
+    memset(&cipher, 0, sizeof(cipher));
+    pgmmv_buffer_put(buffer, PGMMV_STREAMSIZE);
+    pgmmv_budget_leave(PGMMV_STREAMSIZE);
+    errno = err;
+    return (ret < 0) ? -1 : (int64_t)header.pt_len;
+}
+
+int64_t pgmmv_decrypt_file(const char* src, const char* dst, const uint8_t* key, size_t key_len) {
+    return pgmmv_decrypt_file_ex(src, dst, key, key_len, 0);
+}
+
+int64_t pgmmv_decrypt_file_ex(const char* src, const char* dst, const uint8_t* key, size_t key_len, int flags) {
+    int ifd = open(src, O_RDONLY | O_CLOEXEC);
+    if (ifd < 0) return -1;
+    pgmmv_advise_input(ifd);
+
+    int ofd = -1;
+    int64_t ret = (flags & PGMMV_DIRECT) ? _pgmmv_decrypt_direct(ifd, dst, &ofd, key, key_len) : PGMMV_NOMAP;
+    if (ret == PGMMV_NOMAP) {
+        /* the output is mapped for writing, which needs it readable */
+        ofd = open(dst, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (ofd < 0 && errno == EACCES) ofd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        ret = (ofd < 0) ? -1 : _pgmmv_decrypt_mapped(ifd, ofd, key, key_len);
+        if (ret == PGMMV_NOMAP) ret = pgmmv_decrypt_fd(ifd, ofd, key, key_len);
+    }
+
+    if (ret >= 0 && (flags & PGMMV_IOFLAGS)) {
+        pgmmv_drop_cache(ifd, 0);
+        if (pgmmv_drop_cache(ofd, 1) < 0) ret = -1;
+    }
+
+    int err = errno;
+    close(ifd);
+    if (ofd >= 0 && close(ofd) < 0 && ret >= 0) {
+        err = errno;
+        ret = -1;
+    }
+    errno = err;
+    return ret;
+}
+
+int64_t pgmmv_decrypt_small(const pgmmv_file_task* task, uint8_t* buffer, size_t buffer_len, const uint8_t* key, size_t key_len,
+                            int flags) {
+    int ifd = open(task->src, O_RDONLY | O_CLOEXEC);
+    if (ifd < 0) return -1;
+
+    int ofd = open(task->dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (ofd < 0) {
+        int err = errno;
+        close(ifd);
+        errno = err;
+        return -1;
+    }
+
+    /* a full buffer means the file grew, it goes the long way */
+    int64_t ret = pgmmv_pread_full(ifd, buffer, buffer_len, 0);
+    if (ret == (int64_t)buffer_len) {
+        ret = pgmmv_decrypt_fd(ifd, ofd, key, key_len);
+    } else if (ret >= 0) {
+        ret = pgmmv_decrypt_resource(buffer, buffer, (size_t)ret, key, key_len);
+        if (ret >= 0 && pgmmv_pwrite_full(ofd, buffer, (size_t)ret, 0) < 0) ret = -1;
+    }
+
+    if (ret >= 0 && (flags & PGMMV_IOFLAGS)) {
+        pgmmv_drop_cache(ifd, 0);
+        if (pgmmv_drop_cache(ofd, 1) < 0) ret = -1;
+    }
+
+    int err = errno;
+    close(ifd);
+    if (close(ofd) < 0 && ret >= 0) {
+        err = errno;
+        ret = -1;
+    }
+    errno = err;
+    return ret;
+}
+
+int64_t pgmmv_link_plain(const char* src, const char* dst) {
+    int ifd;
+    pgmmv_header header;
+    uint64_t file_size;
+    if (pgmmv_open_resource(src, &ifd, &header, &file_size) < 0) return PGMMV_NOLINK;
+
+    struct stat ist, ost;
+    int ret = fstat(ifd, &ist);
+    close(ifd);
+    if (ret < 0 || header.is_encrypted || !S_ISREG(ist.st_mode)) return PGMMV_NOLINK;
+
+    /* an output which is the input already must not be unlinked */
+    if (stat(dst, &ost) == 0 && ost.st_dev == ist.st_dev && ost.st_ino == ist.st_ino) return (int64_t)file_size;
+
+    ret = link(src, dst);
+    if (ret < 0 && errno == EEXIST && unlink(dst) == 0) ret = link(src, dst);
+    if (ret == 0) return (int64_t)file_size;
+
+    /* links across file systems or to files of another owner are copied instead */
+    if (errno == EXDEV || errno == EPERM || errno == EMLINK || errno == ENOTSUP || errno == EOPNOTSUPP) return PGMMV_NOLINK;
+    return -1;
+}
+
+/* end file decryption */
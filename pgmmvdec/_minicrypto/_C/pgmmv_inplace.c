@@ -0,0 +1,248 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC   0
+#endif
+
+
+/* in-place decryption */
+
+/*
+ * the journal holds two records and two data slots, used in turns,
+ * so that the record of the last window written survives a torn write of the next one
+ */
+#define PGMMV_JOURNALMAGIC  "PGMMVJ1"
+
+typedef struct _pgmmv_journal_record {
+    uint8_t magic[8];
+    uint64_t file_size;             /* of the encrypted file */
+    uint64_t pt_len;
+    uint64_t window;                /* size of each data slot */
+    uint64_t offset;                /* plaintext offset of the window */
+    uint64_t len;                   /* plaintext bytes of the window */
+    uint8_t iv[PGMMV_BLOCKSIZE];    /* IV of the window after it */
+    uint64_t checksum;
+} pgmmv_journal_record;
+
+typedef struct _pgmmv_inplace {
+    int fd, jfd;                    /* `jfd` is -1 without journal */
+    uint64_t file_size;
+    uint64_t pt_len;
+    pgmmv_cipher cipher;
+    uint8_t* buffer;
+    size_t window;
+} pgmmv_inplace;
+
+static uint64_t _pgmmv_journal_checksum(const pgmmv_journal_record* record, const uint8_t* data) {
+    /* FNV-1a, only torn writes are to be caught */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const uint8_t* bytes = (const uint8_t*)record;
+    for (size_t idx = 0; idx < offsetof(pgmmv_journal_record, checksum); idx++) hash = (hash ^ bytes[idx]) * 0x100000001b3ULL;
+    for (uint64_t idx = 0; idx < record->len; idx++) hash = (hash ^ data[idx]) * 0x100000001b3ULL;
+    return hash;
+}
+
+static uint64_t _pgmmv_journal_data(uint64_t window, int slot) {
+    return 2 * sizeof(pgmmv_journal_record) + (uint64_t)slot * window;
+}
+
+static int _pgmmv_journal_write(pgmmv_inplace* ctx, int slot, uint64_t offset, size_t len, const uint8_t iv[PGMMV_BLOCKSIZE]) {
+    pgmmv_journal_record record = {
+        .file_size = ctx->file_size, .pt_len = ctx->pt_len, .window = ctx->window, .offset = offset, .len = len,
+    };
+    memcpy(record.magic, PGMMV_JOURNALMAGIC, sizeof(record.magic));
+    memcpy(record.iv, iv, PGMMV_BLOCKSIZE);
+    record.checksum = _pgmmv_journal_checksum(&record, ctx->buffer);
+
+    if (pgmmv_pwrite_full(ctx->jfd, ctx->buffer, len, _pgmmv_journal_data(ctx->window, slot)) < 0) return -1;
+    if (pgmmv_pwrite_full(ctx->jfd, &record, sizeof(record), (uint64_t)slot * sizeof(record)) < 0) return -1;
+    return fdatasync(ctx->jfd);
+}
+
+/*
+ * find the last record written in full and load its window into `ctx->buffer`
+ * return its slot, or -1 if no record was completed
+ */
+static int _pgmmv_journal_read(pgmmv_inplace* ctx, pgmmv_journal_record* last) {
+    pgmmv_journal_record records[2];
+    ssize_t len = pgmmv_pread_full(ctx->jfd, records, sizeof(records), 0);
+    if (len < 0) return -1;
+
+    int found = -1;
+    for (int slot = 0; slot < 2 && (size_t)len >= (size_t)(slot + 1) * sizeof(pgmmv_journal_record); slot++) {
+        pgmmv_journal_record* record = &records[slot];
+        if (memcmp(record->magic, PGMMV_JOURNALMAGIC, sizeof(record->magic)) != 0) continue;
+        if (record->window != ctx->window) {
+            errno = EBADMSG;    /* written by another build, its slots cannot be found */
+            return -1;
+        }
+        if (record->len > record->window) continue;
+        if (found >= 0 && record->offset < records[found].offset) continue;
+
+        ssize_t data_len = pgmmv_pread_full(ctx->jfd, ctx->buffer, (size_t)record->len, _pgmmv_journal_data(record->window, slot));
+        if (data_len < 0) return -1;
+        if ((uint64_t)data_len == record->len && _pgmmv_journal_checksum(record, ctx->buffer) == record->checksum) found = slot;
+    }
+
+    /* the data of the record found has to be loaded last */
+    if (found >= 0) {
+        *last = records[found];
+        if (pgmmv_pread_full(ctx->jfd, ctx->buffer, (size_t)last->len, _pgmmv_journal_data(last->window, found)) < 0) return -1;
+    }
+    errno = 0;
+    return found;
+}
+
+/* decrypt the windows from plaintext `offset` on, a header length before their ciphertext */
+static int _pgmmv_inplace_windows(pgmmv_inplace* ctx, uint64_t offset, uint8_t iv[PGMMV_BLOCKSIZE], int slot) {
+    /* only the blocks holding plaintext are read */
+    uint64_t ct_end = ctx->pt_len + (PGMMV_BLOCKSIZE - ctx->pt_len % PGMMV_BLOCKSIZE) % PGMMV_BLOCKSIZE;
+
+    for (; offset < ctx->pt_len; slot ^= 1) {
+        size_t len = (ct_end - offset < ctx->window) ? (size_t)(ct_end - offset) : ctx->window;
+        ssize_t ret = pgmmv_pread_full(ctx->fd, ctx->buffer, len, PGMMV_HEADERSIZE + offset);
+        if (ret < 0) return -1;
+        if ((size_t)ret < len) {
+            errno = EBADMSG;    /* the file shrank since its header was parsed */
+            return -1;
+        }
+
+        /* the window overwrites ciphertext already read, and the next window lies past it */
+        size_t out_len = (ctx->pt_len - offset < len) ? (size_t)(ctx->pt_len - offset) : len;
+        pgmmv_cbc_decrypt(&ctx->cipher, iv, ctx->buffer, ctx->buffer, len);
+        if (ctx->jfd >= 0 && _pgmmv_journal_write(ctx, slot, offset, out_len, iv) < 0) return -1;
+        if (pgmmv_pwrite_full(ctx->fd, ctx->buffer, out_len, offset) < 0) return -1;
+        if (ctx->jfd >= 0 && fdatasync(ctx->fd) < 0) return -1;
+        offset += out_len;
+    }
+    return 0;
+}
+
+/* redo the last window logged and carry on after it */
+static int _pgmmv_inplace_resume(pgmmv_inplace* ctx, const uint8_t* key, size_t key_len) {
+    pgmmv_journal_record record;
+    int slot = _pgmmv_journal_read(ctx, &record);
+    if (slot < 0 && errno) return -1;
+    if (slot < 0) return 0;     /* interrupted before the file was touched */
+
+    /* a journal of another file, or of another size of it, must not be replayed */
+    if ((ctx->file_size != record.file_size && ctx->file_size != record.pt_len) || record.offset + record.len > record.pt_len) {
+        errno = EBADMSG;
+        return -1;
+    }
+    ctx->file_size = record.file_size;
+    ctx->pt_len = record.pt_len;
+
+    if (pgmmv_prepare_key(&ctx->cipher, key, key_len, ctx->pt_len) < 0) return -1;
+    if (pgmmv_pwrite_full(ctx->fd, ctx->buffer, (size_t)record.len, record.offset) < 0) return -1;
+    if (fdatasync(ctx->fd) < 0) return -1;
+    if (_pgmmv_inplace_windows(ctx, record.offset + record.len, record.iv, slot ^ 1) < 0) return -1;
+    return 1;
+}
+
+/* make the entry of a new file durable along with the file */
+static int _pgmmv_sync_parent(const char* path) {
+    const char* slash = strrchr(path, '/');
+    char* dir = (slash) ? strndup(path, (slash == path) ? 1 : (size_t)(slash - path)) : strdup(".");
+    if (!dir) return -1;
+
+    int fd = open(dir, O_RDONLY | O_CLOEXEC);
+    free(dir);
+    if (fd < 0) return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+static int _pgmmv_inplace_start(pgmmv_inplace* ctx, const char* journal, const uint8_t* key, size_t key_len) {
+    uint8_t head[PGMMV_HEADERSIZE];
+    ssize_t head_len = pgmmv_pread_full(ctx->fd, head, PGMMV_HEADERSIZE, 0);
+    if (head_len < 0) return -1;
+
+    pgmmv_header header;
+    if (pgmmv_parse_header(&header, head, (size_t)head_len, ctx->file_size) < 0) return -1;
+    ctx->pt_len = (header.is_encrypted) ? header.pt_len : ctx->file_size;
+    if (!header.is_encrypted) return 0;
+    if (pgmmv_prepare_key(&ctx->cipher, key, key_len, ctx->pt_len) < 0) return -1;
+
+    /* the journal is durable before the file is first written */
+    if (journal) {
+        ctx->jfd = open(journal, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (ctx->jfd < 0 || fsync(ctx->jfd) < 0 || _pgmmv_sync_parent(journal) < 0) return -1;
+    }
+
+    uint8_t iv[PGMMV_BLOCKSIZE];
+    memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+    return (_pgmmv_inplace_windows(ctx, 0, iv, 0) < 0) ? -1 : 1;
+}
+
+int64_t pgmmv_decrypt_file_inplace(const char* path, const uint8_t* key, size_t key_len, int flags) {
+    pgmmv_inplace ctx = { .jfd = -1, .window = PGMMV_STREAMSIZE };
+    ctx.fd = open(path, O_RDWR | O_CLOEXEC);
+    if (ctx.fd < 0) return -1;
+    pgmmv_advise_input(ctx.fd);
+
+    char* journal = NULL;
+    struct stat st;
+    int ret = fstat(ctx.fd, &st);
+    if (ret == 0 && !S_ISREG(st.st_mode)) {
+        errno = EINVAL;     /* only a file can be rewritten in place */
+        ret = -1;
+    }
+    ctx.file_size = (uint64_t)st.st_size;
+
+    if (ret == 0 && (flags & PGMMV_JOURNAL)) {
+        size_t path_len = strlen(path);
+        journal = (char*)malloc(path_len + sizeof(PGMMV_JOURNALSUFFIX));
+        if (journal) memcpy(journal, path, path_len);
+        if (journal) memcpy(journal + path_len, PGMMV_JOURNALSUFFIX, sizeof(PGMMV_JOURNALSUFFIX));
+        ret = (journal) ? 0 : (errno = ENOMEM, -1);
+    }
+
+    int admitted = (ret == 0) && pgmmv_budget_admit(ctx.window, 1);
+    ctx.buffer = (admitted) ? pgmmv_buffer_get(ctx.window) : NULL;
+    if (ret == 0 && !ctx.buffer) {
+        errno = ENOMEM;
+        ret = -1;
+    }
+
+    /* a journal left behind means the file is half way, resume it instead */
+    if (ret == 0 && journal) {
+        ctx.jfd = open(journal, O_RDWR | O_CLOEXEC);
+        if (ctx.jfd >= 0) ret = _pgmmv_inplace_resume(&ctx, key, key_len);
+        else if (errno != ENOENT) ret = -1;
+    }
+    if (ret == 0) {
+        if (ctx.jfd >= 0) close(ctx.jfd);
+        ctx.jfd = -1;
+        ret = _pgmmv_inplace_start(&ctx, journal, key, key_len);
+    }
+
+    /* the journal goes only once the plaintext is durable at its length */
+    if (ret > 0 && ftruncate(ctx.fd, (off_t)ctx.pt_len) < 0) ret = -1;
+    if (ret > 0 && ctx.jfd >= 0 && (fsync(ctx.fd) < 0 || unlink(journal) < 0)) ret = -1;
+    if (ret >= 0 && (flags & PGMMV_IOFLAGS) && pgmmv_drop_cache(ctx.fd, ret > 0) < 0) ret = -1;
+
+    int err = errno;
+    if (ctx.jfd >= 0) close(ctx.jfd);
+    if (close(ctx.fd) < 0 && ret >= 0) {
+        err = errno;
+        ret = -1;
+    }
+    memset(&ctx.cipher, 0, sizeof(ctx.cipher));
+    pgmmv_buffer_put(ctx.buffer, ctx.window);
+    if (admitted) pgmmv_budget_leave(ctx.window);
+    free(journal);
+    errno = err;
+    return (ret < 0) ? -1 : (int64_t)ctx.pt_len;
+}
+
+/* end in-place decryption */
@@ -0,0 +1,249 @@
+#pragma once
+
+/*
+ * internal helpers shared by the libpgmmv sources
+ * not part of the public interface
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "pgmmv.h"
+
+
+#define PGMMV_CHUNKSIZE     (1 << 16)   /* I/O chunk size, a multiple of PGMMV_BLOCKSIZE */
+#define PGMMV_THREADBYTES   (1 << 18)   /* fewest bytes of in-memory work worth another thread */
+#define PGMMV_SPLITSIZE     (1 << 23)   /* default smallest ciphertext split across threads, in parts of half of it */
+#define PGMMV_PIPECHUNK     (1 << 20)   /* default ciphertext bytes per pipeline chunk */
+#define PGMMV_MAPSIZE       (1 << 20)   /* smallest file decrypted through memory mappings */
+#define PGMMV_SMALLSIZE     (1 << 15)   /* files below this are read whole into one buffer */
+#define PGMMV_URINGDEPTH    64          /* small files in flight on one io_uring */
+#define PGMMV_STREAMSIZE    (1 << 22)   /* default size of each buffer of a bounded stream */
+#define PGMMV_DIRECTSIZE    (1 << 22)   /* smallest output written with O_DIRECT */
+#define PGMMV_DIRECTALIGN   4096        /* alignment of O_DIRECT buffers, offsets and lengths */
+
+#define PGMMV_IOFLAGS       (PGMMV_DROPCACHE | PGMMV_DIRECT)
+
+
+/* I/O helpers, restarting on EINTR */
+
+/*
+ * read until `len` bytes or the end of file
+ * return the number of bytes read, or -1 on failure
+ */
+ssize_t pgmmv_read_full(int fd, void* buf, size_t len);
+
+/*
+ * write all `len` bytes
+ */
+int pgmmv_write_full(int fd, const void* buf, size_t len);
+
+/*
+ * positional variants of the above
+ */
+ssize_t pgmmv_pread_full(int fd, void* buf, size_t len, uint64_t offset);
+int pgmmv_pwrite_full(int fd, const void* buf, size_t len, uint64_t offset);
+
+/*
+ * write variants for an output opened by pgmmv_open_output(), which is `direct` if opened with O_DIRECT
+ * aligned blocks of a direct output go around the page cache, while its last partial block,
+ * or any write the file system refuses O_DIRECT for, clears O_DIRECT and goes through the page cache
+ */
+int pgmmv_write_out(int fd, const void* buf, size_t len, int direct);
+int pgmmv_pwrite_out(int fd, const void* buf, size_t len, uint64_t offset, int direct);
+
+
+/* file helpers */
+
+/*
+ * open `src` and parse its header, `*ifd` is left open on success
+ */
+int pgmmv_open_resource(const char* src, int* ifd, pgmmv_header* header, uint64_t* file_size);
+
+/*
+ * hint that the input `fd` is about to be read from its start to its end
+ */
+void pgmmv_advise_input(int fd);
+
+/*
+ * open `dst` for writing, created or truncated, with O_DIRECT if `*direct` is set,
+ * `*direct` is cleared if the file system or the platform does not allow it
+ */
+int pgmmv_open_output(const char* dst, int* direct);
+
+/*
+ * drop a regular file done with from the page cache, `written` ones are written back first
+ * return -1 only if writing back failed
+ */
+int pgmmv_drop_cache(int fd, int written);
+
+/*
+ * find where the file `path` starts on its device, with FS_IOC_FIEMAP where supported
+ * return 1 with the physical offset of its first extent, 0 with its inode number instead, or -1 on failure
+ */
+int pgmmv_disk_place(const char* path, uint64_t* place);
+
+/*
+ * copy an unencrypted resource, whose header `head` was already read from `ifd`, into `ofd`
+ * by the kernel where possible, otherwise through `buffer` of PGMMV_CHUNKSIZE bytes
+ */
+int64_t pgmmv_copy_fd(int ifd, int ofd, uint8_t* buffer, const uint8_t* head, size_t head_len);
+
+/*
+ * decrypt the ciphertext range [offset, offset + len) of an encrypted resource
+ * with positional I/O, so that ranges can be decrypted concurrently
+ * offsets count from the end of the header, `offset` and `len` are multiples of PGMMV_BLOCKSIZE
+ * ciphertext beyond the block holding the end of plaintext is neither read nor written
+ * a `direct` output needs `buffer` and `offset` aligned to PGMMV_DIRECTALIGN to bypass the page cache
+ */
+int pgmmv_decrypt_range(int ifd, int ofd, const pgmmv_cipher* cipher, uint64_t pt_len,
+                        uint64_t offset, uint64_t len, uint8_t* buffer, size_t buffer_len, int direct);
+
+
+/* small file engine */
+
+/*
+ * feed of small files for an engine, implemented by the scheduler
+ */
+typedef struct _pgmmv_small_source {
+    /* get the next file and its planned size, return 0 when none is left */
+    int (*next)(struct _pgmmv_small_source* source, pgmmv_file_task** task, uint64_t* size);
+    /* record the result of a file */
+    void (*done)(struct _pgmmv_small_source* source, pgmmv_file_task* task, int64_t result, int err);
+    const uint8_t* key;
+    size_t key_len;
+} pgmmv_small_source;
+
+/*
+ * decrypt a small file with one pread and one pwrite through `buffer`,
+ * a file which outgrew `buffer_len` since planned is handed to pgmmv_decrypt_fd(), PGMMV_DROPCACHE applies
+ */
+int64_t pgmmv_decrypt_small(const pgmmv_file_task* task, uint8_t* buffer, size_t buffer_len, const uint8_t* key, size_t key_len,
+                            int flags);
+
+/*
+ * hardlink `dst` to `src` if `src` is a regular resource which is not encrypted
+ * return the file size once linked, or PGMMV_NOLINK if the file has to be decrypted instead
+ */
+#define PGMMV_NOLINK        (-2)
+int64_t pgmmv_link_plain(const char* src, const char* dst);
+
+/*
+ * io_uring engine keeping up to PGMMV_URINGDEPTH small files in flight,
+ * each file is decrypted as soon as its read completes
+ */
+typedef struct _pgmmv_uring pgmmv_uring;
+
+/*
+ * return NULL if io_uring or one of the operations it needs is not available
+ */
+pgmmv_uring* pgmmv_uring_create();
+
+/*
+ * run every file of `source` to completion
+ */
+void pgmmv_uring_run(pgmmv_uring* ring, pgmmv_small_source* source);
+
+void pgmmv_uring_destroy(pgmmv_uring* ring);
+
+
+/* buffer arena */
+
+/*
+ * get a buffer of at least `size` bytes aligned to PGMMV_DIRECTALIGN, kept from an earlier file
+ * by the calling thread where possible
+ * return NULL on failure
+ */
+uint8_t* pgmmv_buffer_get(size_t size);
+
+/*
+ * give a buffer back to the calling thread for its next files, `size` as asked for, NULL is ignored
+ */
+void pgmmv_buffer_put(uint8_t* buffer, size_t size);
+
+
+/* memory budget */
+
+/*
+ * the limit set by pgmmv_set_max_inflight(), 0 for none
+ */
+uint64_t pgmmv_budget_limit();
+
+/*
+ * charge `bytes` a file is about to hold until pgmmv_budget_leave()
+ * without `wait`, return 0 if that would exceed the limit, otherwise return 1 once it fits
+ * or once no other file is in flight; a file holding a charge MUST NOT wait for another
+ */
+int pgmmv_budget_admit(uint64_t bytes, int wait);
+void pgmmv_budget_leave(uint64_t bytes);
+
+/*
+ * charge `bytes` a worker keeps over many files until pgmmv_budget_unhold(), never waiting
+ * unless `force`d, return 0 if that would exceed the limit
+ */
+int pgmmv_budget_hold(uint64_t bytes, int force);
+void pgmmv_budget_unhold(uint64_t bytes);
+
+
+/* auto-tuning */
+
+#define PGMMV_TUNEMAXTHREADS    256     /* most threads a profile may ask for */
+
+typedef struct _pgmmv_tuner {
+    pgmmv_tune_profile best;        /* fastest so far */
+    pgmmv_tune_profile trial;       /* to decrypt the next sample with */
+    double best_rate;
+    int pipeline;                   /* whether samples go through pgmmv_decrypt_files_pipeline() */
+    int measured;                   /* whether the starting profile has been measured */
+    int stage, step;
+    int base_threads;
+    uint64_t largest;               /* largest plaintext seen */
+    size_t sample;                  /* files of the next sample */
+    double started, sample_started;
+} pgmmv_tuner;
+
+/*
+ * start tuning from `seed`, its zeros resolved to what they mean
+ */
+void pgmmv_tuner_init(pgmmv_tuner* tuner, const pgmmv_tune_profile* seed, int pipeline);
+
+/*
+ * set `tuner->trial` for the next sample and lower `*count` to the files it should take,
+ * return 0 once tuning is over, `tuner->trial` is then the fastest profile
+ */
+int pgmmv_tuner_next(pgmmv_tuner* tuner, size_t* count);
+
+/*
+ * account for the sample of `count` tasks just decrypted with `tuner->trial`
+ */
+void pgmmv_tuner_report(pgmmv_tuner* tuner, const pgmmv_file_task* tasks, size_t count);
+
+
+/* thread helpers */
+
+typedef void (*pgmmv_jobproc)(void* ctx, size_t idx);
+
+/*
+ * run `worker(arg)` on `threads` threads, the calling thread being one of them
+ * return when all of them are done
+ */
+void pgmmv_run_threads(int threads, void* (*worker)(void*), void* arg);
+
+/*
+ * run `job(ctx, idx)` for every idx in [0, count) with up to `threads` threads
+ * the calling thread takes part, 0 threads means pgmmv_cpu_count()
+ */
+void pgmmv_parallel_for(size_t count, int threads, pgmmv_jobproc job, void* ctx);
+
+/*
+ * the return value of a batch of file tasks, all of them done
+ * -1 with errno of the first failed task, ECANCELED only if no task failed otherwise
+ */
+int pgmmv_files_status(const pgmmv_file_task* tasks, size_t count);
+
+/*
+ * order file tasks for PGMMV_DISKORDER: output directory by output directory, in the order their first file
+ * lies on disk, and the files of each directory in disk order
+ * return the task indices in that order, or NULL on failure
+ */
+size_t* pgmmv_disk_order(const pgmmv_file_task* tasks, size_t count, int threads);
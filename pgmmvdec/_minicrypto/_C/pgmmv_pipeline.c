@@ -0,0 +1,463 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+
+/* bounded queue */
+
+/*
+ * multi-producer multi-consumer ring of pointers, lock-free while neither full nor empty,
+ * a thread which would have to wait sleeps on the condition variable instead of spinning
+ */
+#define PGMMV_QUEUESPIN     64      /* failed attempts before sleeping */
+
+typedef struct _pgmmv_queue_cell {
+    atomic_size_t seq;
+    void* data;
+} pgmmv_queue_cell;
+
+typedef struct _pgmmv_queue {
+    pgmmv_queue_cell* cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t head;    /* next cell to push */
+    _Alignas(64) atomic_size_t tail;    /* next cell to pop */
+    _Alignas(64) atomic_int waiters;
+    atomic_int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} pgmmv_queue;
+
+static int _pgmmv_queue_init(pgmmv_queue* queue, size_t capacity) {
+    /* a single cell cannot tell full from empty */
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    queue->cells = (pgmmv_queue_cell*)malloc(sizeof(pgmmv_queue_cell) * size);
+    if (!queue->cells) return -1;
+
+    queue->mask = size - 1;
+    for (size_t idx = 0; idx < size; idx++) atomic_init(&queue->cells[idx].seq, idx);
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->waiters, 0);
+    atomic_init(&queue->closed, 0);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return 0;
+}
+
+static void _pgmmv_queue_destroy(pgmmv_queue* queue) {
+    if (!queue->cells) return;
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->cells);
+}
+
+static int _pgmmv_queue_try_push(pgmmv_queue* queue, void* data) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    pgmmv_queue_cell* cell;
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        intptr_t diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)pos;
+        if (diff < 0) return 0;     /* full */
+        if (diff > 0) {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+    cell->data = data;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+static void* _pgmmv_queue_try_pop(pgmmv_queue* queue) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    pgmmv_queue_cell* cell;
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        intptr_t diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)(pos + 1);
+        if (diff < 0) return NULL;  /* empty */
+        if (diff > 0) {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+    void* data = cell->data;
+    atomic_store_explicit(&cell->seq, pos + queue->mask + 1, memory_order_release);
+    return data;
+}
+
+/* wake the sleepers after a push or pop, the fences pair with those of the sleepers */
+static void _pgmmv_queue_wake(pgmmv_queue* queue) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&queue->waiters, memory_order_relaxed)) return;
+    pthread_mutex_lock(&queue->lock);
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void _pgmmv_queue_push(pgmmv_queue* queue, void* data) {
+    for (int spin = 0; !_pgmmv_queue_try_push(queue, data); spin++) {
+        if (spin < PGMMV_QUEUESPIN) continue;
+
+        pthread_mutex_lock(&queue->lock);
+        atomic_fetch_add(&queue->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        int pushed = _pgmmv_queue_try_push(queue, data);
+        if (!pushed) pthread_cond_wait(&queue->cond, &queue->lock);
+        atomic_fetch_sub(&queue->waiters, 1);
+        pthread_mutex_unlock(&queue->lock);
+        if (pushed) break;
+    }
+    _pgmmv_queue_wake(queue);
+}
+
+/* return NULL once the queue is closed and empty */
+static void* _pgmmv_queue_pop(pgmmv_queue* queue) {
+    void* data;
+    for (int spin = 0; !(data = _pgmmv_queue_try_pop(queue)); spin++) {
+        /* closed after the last push */
+        if (atomic_load(&queue->closed)) {
+            data = _pgmmv_queue_try_pop(queue);
+            if (!data) return NULL;
+            break;
+        }
+        if (spin < PGMMV_QUEUESPIN) continue;
+
+        pthread_mutex_lock(&queue->lock);
+        atomic_fetch_add(&queue->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        data = _pgmmv_queue_try_pop(queue);
+        if (!data && !atomic_load(&queue->closed)) pthread_cond_wait(&queue->cond, &queue->lock);
+        atomic_fetch_sub(&queue->waiters, 1);
+        pthread_mutex_unlock(&queue->lock);
+        if (data) break;
+    }
+    _pgmmv_queue_wake(queue);
+    return data;
+}
+
+static void _pgmmv_queue_close(pgmmv_queue* queue) {
+    atomic_store(&queue->closed, 1);
+    pthread_mutex_lock(&queue->lock);
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* end bounded queue */
+
+
+/* pipeline */
+
+#define PGMMV_PIPEREADERS   2           /* default reader and writer threads */
+
+typedef struct _pgmmv_pipe_file {
+    pgmmv_file_task* task;
+    int ofd;
+    int direct;                 /* `ofd` opened with O_DIRECT */
+    uint64_t pt_len;
+    pgmmv_cipher cipher;
+    atomic_size_t refs;         /* chunks in flight, and the reader until it issued them all */
+    atomic_int error;
+} pgmmv_pipe_file;
+
+typedef struct _pgmmv_chunk {
+    pgmmv_pipe_file* file;
+    uint64_t offset;            /* of the ciphertext */
+    size_t len;                 /* ciphertext bytes */
+    size_t out_len;             /* plaintext bytes */
+    uint8_t* data;              /* IV then ciphertext, decrypted in place */
+} pgmmv_chunk;
+
+typedef struct _pgmmv_pipeline {
+    pgmmv_file_task* tasks;
+    size_t count;
+    size_t* order;              /* task indices in disk order, NULL for input order */
+    atomic_size_t next;
+    atomic_int failed;
+    atomic_int readers_left, decrypters_left;
+    int flags;
+    const uint8_t* key;
+    size_t key_len;
+    size_t chunk_size;
+    pgmmv_queue free_q, decrypt_q, write_q;
+} pgmmv_pipeline;
+
+static void _pgmmv_pipe_task_done(pgmmv_pipeline* pipeline, pgmmv_file_task* task, int64_t result, int err) {
+    task->result = result;
+    task->error = (result < 0) ? err : 0;
+    if (result < 0) atomic_store(&pipeline->failed, 1);
+}
+
+static void _pgmmv_pipe_fail(pgmmv_pipe_file* file, int err) {
+    int expected = 0;
+    atomic_compare_exchange_strong(&file->error, &expected, err);
+}
+
+/* drop `refs` references, the last one closes the output and reports the result */
+static void _pgmmv_pipe_put(pgmmv_pipeline* pipeline, pgmmv_pipe_file* file, size_t refs) {
+    if (atomic_fetch_sub(&file->refs, refs) > refs) return;
+
+    if ((pipeline->flags & PGMMV_IOFLAGS) && !atomic_load(&file->error) && pgmmv_drop_cache(file->ofd, 1) < 0) _pgmmv_pipe_fail(file, errno);
+    if (close(file->ofd) < 0) _pgmmv_pipe_fail(file, errno);
+    int err = atomic_load(&file->error);
+    _pgmmv_pipe_task_done(pipeline, file->task, (err) ? -1 : (int64_t)file->pt_len, err);
+    memset(&file->cipher, 0, sizeof(file->cipher));
+    free(file);
+}
+
+/* files which need no decryption are done by the reader */
+static void _pgmmv_pipe_plain(pgmmv_pipeline* pipeline, pgmmv_file_task* task) {
+    int64_t result = PGMMV_NOLINK;
+    if (pipeline->flags & PGMMV_LINKPLAIN) result = pgmmv_link_plain(task->src, task->dst);
+    if (result == PGMMV_NOLINK) result = pgmmv_decrypt_file_ex(task->src, task->dst, pipeline->key, pipeline->key_len, pipeline->flags & PGMMV_IOFLAGS);
+    _pgmmv_pipe_task_done(pipeline, task, result, errno);
+}
+
+static pgmmv_pipe_file* _pgmmv_pipe_open(pgmmv_pipeline* pipeline, pgmmv_file_task* task, int* ifd) {
+    pgmmv_header header;
+    uint64_t file_size;
+    if (pgmmv_open_resource(task->src, ifd, &header, &file_size) < 0) {
+        _pgmmv_pipe_task_done(pipeline, task, -1, errno);
+        return NULL;
+    }
+    if (!header.is_encrypted) {
+        close(*ifd);
+        _pgmmv_pipe_plain(pipeline, task);
+        return NULL;
+    }
+    pgmmv_advise_input(*ifd);
+
+    /* chunks are written in any order, the output is sized up front */
+    pgmmv_pipe_file* file = (pgmmv_pipe_file*)calloc(1, sizeof(pgmmv_pipe_file));
+    int ret = (file) ? pgmmv_prepare_key(&file->cipher, pipeline->key, pipeline->key_len, header.pt_len) : (errno = ENOMEM, -1);
+    if (ret == 0) {
+        file->direct = (pipeline->flags & PGMMV_DIRECT) && header.pt_len >= PGMMV_DIRECTSIZE;
+        file->ofd = pgmmv_open_output(task->dst, &file->direct);
+        if (file->ofd < 0) ret = -1;
+        else if (ftruncate(file->ofd, (off_t)header.pt_len) < 0) ret = -1;
+        if (ret < 0 && file->ofd >= 0) {
+            int err = errno;
+            close(file->ofd);
+            errno = err;
+        }
+    }
+    if (ret < 0) {
+        int err = errno;
+        close(*ifd);
+        free(file);
+        _pgmmv_pipe_task_done(pipeline, task, -1, err);
+        return NULL;
+    }
+
+    file->task = task;
+    file->pt_len = header.pt_len;
+    atomic_init(&file->error, 0);
+    return file;
+}
+
+/* read every chunk of a file, each along with the ciphertext block before it as IV */
+static void _pgmmv_pipe_read(pgmmv_pipeline* pipeline, pgmmv_pipe_file* file, int ifd) {
+    uint64_t ct_end = file->pt_len + (PGMMV_BLOCKSIZE - file->pt_len % PGMMV_BLOCKSIZE) % PGMMV_BLOCKSIZE;
+    size_t chunks = (size_t)((ct_end + pipeline->chunk_size - 1) / pipeline->chunk_size), issued = 0;
+    atomic_init(&file->refs, chunks + 1);
+
+    for (uint64_t offset = 0; offset < ct_end && !atomic_load(&file->error); offset += pipeline->chunk_size) {
+        pgmmv_chunk* chunk = (pgmmv_chunk*)_pgmmv_queue_pop(&pipeline->free_q);
+        chunk->file = file;
+        chunk->offset = offset;
+        chunk->len = (ct_end - offset < pipeline->chunk_size) ? (size_t)(ct_end - offset) : pipeline->chunk_size;
+        chunk->out_len = (file->pt_len - offset < chunk->len) ? (size_t)(file->pt_len - offset) : chunk->len;
+
+        ssize_t ret;
+        if (offset == 0) {
+            memcpy(chunk->data, PGMMV_IV, PGMMV_BLOCKSIZE);
+            ret = pgmmv_pread_full(ifd, chunk->data + PGMMV_BLOCKSIZE, chunk->len, PGMMV_HEADERSIZE);
+            if (ret >= 0) ret += PGMMV_BLOCKSIZE;
+        } else {
+            ret = pgmmv_pread_full(ifd, chunk->data, PGMMV_BLOCKSIZE + chunk->len, PGMMV_HEADERSIZE + offset - PGMMV_BLOCKSIZE);
+        }
+        if (ret < 0 || (size_t)ret < PGMMV_BLOCKSIZE + chunk->len) {
+            _pgmmv_pipe_fail(file, (ret < 0) ? errno : EBADMSG);    /* the file shrank since its header was parsed */
+            _pgmmv_queue_push(&pipeline->free_q, chunk);
+            break;
+        }
+
+        _pgmmv_queue_push(&pipeline->decrypt_q, chunk);
+        issued++;
+    }
+
+    if (pipeline->flags & PGMMV_IOFLAGS) pgmmv_drop_cache(ifd, 0);
+    close(ifd);
+    _pgmmv_pipe_put(pipeline, file, chunks - issued + 1);
+}
+
+static void* _pgmmv_pipe_reader(void* arg) {
+    pgmmv_pipeline* pipeline = (pgmmv_pipeline*)arg;
+
+    for (;;) {
+        size_t idx = atomic_fetch_add(&pipeline->next, 1);
+        if (idx >= pipeline->count) break;
+
+        pgmmv_file_task* task = &pipeline->tasks[(pipeline->order) ? pipeline->order[idx] : idx];
+        if ((pipeline->flags & PGMMV_FAILFAST) && atomic_load(&pipeline->failed)) {
+            _pgmmv_pipe_task_done(pipeline, task, -1, ECANCELED);
+            continue;
+        }
+
+        int ifd;
+        pgmmv_pipe_file* file = _pgmmv_pipe_open(pipeline, task, &ifd);
+        if (file) _pgmmv_pipe_read(pipeline, file, ifd);
+    }
+
+    if (atomic_fetch_sub(&pipeline->readers_left, 1) == 1) _pgmmv_queue_close(&pipeline->decrypt_q);
+    return NULL;
+}
+
+static void* _pgmmv_pipe_decrypter(void* arg) {
+    pgmmv_pipeline* pipeline = (pgmmv_pipeline*)arg;
+
+    pgmmv_chunk* chunk;
+    while ((chunk = (pgmmv_chunk*)_pgmmv_queue_pop(&pipeline->decrypt_q))) {
+        pgmmv_pipe_file* file = chunk->file;
+        if (!atomic_load(&file->error)) {
+            pgmmv_cbc_decrypt(&file->cipher, chunk->data, chunk->data + PGMMV_BLOCKSIZE, chunk->data + PGMMV_BLOCKSIZE, chunk->len);
+        }
+        _pgmmv_queue_push(&pipeline->write_q, chunk);
+    }
+
+    if (atomic_fetch_sub(&pipeline->decrypters_left, 1) == 1) _pgmmv_queue_close(&pipeline->write_q);
+    return NULL;
+}
+
+static void* _pgmmv_pipe_writer(void* arg) {
+    pgmmv_pipeline* pipeline = (pgmmv_pipeline*)arg;
+
+    pgmmv_chunk* chunk;
+    while ((chunk = (pgmmv_chunk*)_pgmmv_queue_pop(&pipeline->write_q))) {
+        pgmmv_pipe_file* file = chunk->file;
+        if (!atomic_load(&file->error)
+            && pgmmv_pwrite_out(file->ofd, chunk->data + PGMMV_BLOCKSIZE, chunk->out_len, chunk->offset, file->direct) < 0) {
+            _pgmmv_pipe_fail(file, errno);
+        }
+        _pgmmv_queue_push(&pipeline->free_q, chunk);
+        _pgmmv_pipe_put(pipeline, file, 1);
+    }
+    return NULL;
+}
+
+/* spawn up to `count` threads of a stage, return how many run */
+static int _pgmmv_pipe_spawn(pthread_t* threads, int count, void* (*worker)(void*), pgmmv_pipeline* pipeline) {
+    int spawned = 0;
+    while (spawned < count && pthread_create(&threads[spawned], NULL, worker, pipeline) == 0) spawned++;
+    return spawned;
+}
+
+int pgmmv_decrypt_files_pipeline(pgmmv_file_task* tasks, size_t count, const uint8_t* key, size_t key_len,
+                                 const pgmmv_pipeline_config* config, int flags) {
+    /* in place, a chunk would overwrite the ciphertext of the one before it before that one is read */
+    pgmmv_pipeline_config conf = (config) ? *config : (pgmmv_pipeline_config){ 0 };
+    if (flags & PGMMV_INPLACE) return pgmmv_decrypt_files_ex(tasks, count, key, key_len, conf.decrypters, flags);
+
+    int readers = (conf.readers > 0) ? conf.readers : PGMMV_PIPEREADERS;
+    int decrypters = (conf.decrypters > 0) ? conf.decrypters : pgmmv_cpu_count();
+    int writers = (conf.writers > 0) ? conf.writers : PGMMV_PIPEREADERS;
+    size_t chunk_size = (conf.chunk_size) ? conf.chunk_size : PGMMV_PIPECHUNK;
+    chunk_size -= chunk_size % PGMMV_BLOCKSIZE;
+    if (chunk_size < PGMMV_BLOCKSIZE) chunk_size = PGMMV_BLOCKSIZE;
+    if (flags & PGMMV_DIRECT) chunk_size += (PGMMV_DIRECTALIGN - chunk_size % PGMMV_DIRECTALIGN) % PGMMV_DIRECTALIGN;
+    size_t depth = (conf.queue_depth) ? conf.queue_depth : 2 * (size_t)((decrypters > writers) ? decrypters : writers);
+
+    /* with O_DIRECT, the ciphertext of each chunk starts a page, its IV ends the page before */
+    size_t lead = (flags & PGMMV_DIRECT) ? PGMMV_DIRECTALIGN : PGMMV_BLOCKSIZE;
+
+    /*
+     * every queue full and every thread holding a chunk, no more
+     * under a memory budget, queues are shortened to fit it, then chunks down to PGMMV_CHUNKSIZE
+     */
+    size_t thread_chunks = (size_t)readers + (size_t)decrypters + (size_t)writers;
+    uint64_t limit = pgmmv_budget_limit();
+    if (limit && limit / (lead + chunk_size) < 2 * depth + thread_chunks) {
+        uint64_t fit = limit / (lead + chunk_size);
+        depth = (fit > thread_chunks + 2) ? (size_t)(fit - thread_chunks) / 2 : 1;
+        if (fit < thread_chunks + 2) {
+            uint64_t fit_size = limit / (thread_chunks + 2);
+            fit_size = (fit_size > lead + PGMMV_CHUNKSIZE) ? fit_size - lead : PGMMV_CHUNKSIZE;
+            fit_size -= fit_size % ((flags & PGMMV_DIRECT) ? PGMMV_DIRECTALIGN : PGMMV_BLOCKSIZE);
+            if (fit_size < chunk_size) chunk_size = (size_t)fit_size;
+        }
+    }
+    size_t chunk_count = 2 * depth + thread_chunks;
+    pgmmv_pipeline pipeline = {
+        .tasks = tasks, .count = count, .flags = flags, .key = key, .key_len = key_len, .chunk_size = chunk_size,
+    };
+    atomic_init(&pipeline.next, 0);
+    atomic_init(&pipeline.failed, 0);
+
+    pgmmv_chunk* chunks = (pgmmv_chunk*)calloc(chunk_count, sizeof(pgmmv_chunk));
+    size_t arena_len = chunk_count * (lead + chunk_size);
+    uint8_t* arena = pgmmv_buffer_get(arena_len);
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)(readers + decrypters + writers));
+    pipeline.order = (flags & PGMMV_DISKORDER) ? pgmmv_disk_order(tasks, count, readers) : NULL;
+    int ret = (chunks && arena && threads && (pipeline.order || !(flags & PGMMV_DISKORDER))) ? 0 : -1;
+    if (ret == 0) ret = _pgmmv_queue_init(&pipeline.free_q, chunk_count);
+    if (ret == 0) ret = _pgmmv_queue_init(&pipeline.decrypt_q, depth);
+    if (ret == 0) ret = _pgmmv_queue_init(&pipeline.write_q, depth);
+    if (ret < 0) {
+        _pgmmv_queue_destroy(&pipeline.free_q);
+        _pgmmv_queue_destroy(&pipeline.decrypt_q);
+        free(pipeline.order);
+        free(threads);
+        pgmmv_buffer_put(arena, arena_len);
+        free(chunks);
+        errno = ENOMEM;
+        return -1;
+    }
+    pgmmv_budget_hold(arena_len, 1);
+    for (size_t idx = 0; idx < chunk_count; idx++) {
+        chunks[idx].data = arena + idx * (lead + chunk_size) + lead - PGMMV_BLOCKSIZE;
+        _pgmmv_queue_try_push(&pipeline.free_q, &chunks[idx]);
+    }
+
+    /* stages start from the end, failing to spawn only lowers the parallelism of a stage */
+    int spawned_writers = _pgmmv_pipe_spawn(threads, writers, _pgmmv_pipe_writer, &pipeline);
+    int spawned_decrypters = (spawned_writers) ? _pgmmv_pipe_spawn(threads + spawned_writers, decrypters, _pgmmv_pipe_decrypter, &pipeline) : 0;
+    atomic_init(&pipeline.decrypters_left, spawned_decrypters);
+
+    /* the calling thread is one of the readers */
+    int spawned_readers = 0;
+    if (spawned_decrypters) {
+        atomic_init(&pipeline.readers_left, readers);
+        spawned_readers = _pgmmv_pipe_spawn(threads + spawned_writers + spawned_decrypters, readers - 1, _pgmmv_pipe_reader, &pipeline);
+        atomic_fetch_sub(&pipeline.readers_left, readers - 1 - spawned_readers);
+        _pgmmv_pipe_reader(&pipeline);
+    } else {
+        _pgmmv_queue_close(&pipeline.write_q);
+    }
+
+    for (int idx = 0; idx < spawned_writers + spawned_decrypters + spawned_readers; idx++) pthread_join(threads[idx], NULL);
+    _pgmmv_queue_destroy(&pipeline.write_q);
+    _pgmmv_queue_destroy(&pipeline.decrypt_q);
+    _pgmmv_queue_destroy(&pipeline.free_q);
+    free(pipeline.order);
+    free(threads);
+    pgmmv_budget_unhold(arena_len);
+    pgmmv_buffer_put(arena, arena_len);
+    free(chunks);
+
+    if (!spawned_decrypters) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return pgmmv_files_status(tasks, count);
+}
+
+/* end pipeline */
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pgmmv.h"
+
+
+/* thread pool */
+
+struct _pgmmv_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pgmmv_pool_job* head, * tail;   /* FIFO of queued jobs */
+    int stopping;
+    int thread_count;
+    pthread_t threads[];
+};
+
+static void* _pgmmv_pool_worker(void* arg) {
+    pgmmv_pool* pool = (pgmmv_pool*)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->stopping) pthread_cond_wait(&pool->cond, &pool->lock);
+        pgmmv_pool_job* job = pool->head;
+        if (!job) break;
+
+        pool->head = job->next;
+        if (!pool->head) pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        job->run(job);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+pgmmv_pool* pgmmv_pool_create(int threads) {
+    if (threads <= 0) threads = pgmmv_cpu_count();
+
+    pgmmv_pool* pool = (pgmmv_pool*)calloc(1, sizeof(pgmmv_pool) + sizeof(pthread_t) * threads);
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    /* failing to spawn only lowers the parallelism, as long as one thread runs */
+    while (pool->thread_count < threads) {
+        int err = pthread_create(&pool->threads[pool->thread_count], NULL, _pgmmv_pool_worker, pool);
+        if (err && !pool->thread_count) {
+            pgmmv_pool_destroy(pool);
+            errno = err;
+            return NULL;
+        }
+        if (err) break;
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+void pgmmv_pool_submit(pgmmv_pool* pool, pgmmv_pool_job* job) {
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) pool->tail->next = job;
+    else pool->head = job;
+    pool->tail = job;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pgmmv_pool_destroy(pgmmv_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int idx = 0; idx < pool->thread_count; idx++) pthread_join(pool->threads[idx], NULL);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/* end thread pool */
@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+
+/* random access */
+
+#define PGMMV_READAHEAD     (1 << 16)   /* default plaintext bytes decrypted ahead of a small read */
+
+struct _pgmmv_reader {
+    int fd;
+    pgmmv_header header;
+    pgmmv_cipher cipher;
+    uint64_t block_end;         /* end of the last block holding plaintext */
+
+    /* the ciphertext block before the window, then the window decrypted in place */
+    uint8_t* buffer;
+    size_t window_cap, window_len;
+    uint64_t window_offset;
+};
+
+pgmmv_reader* pgmmv_reader_open(const char* path, const uint8_t* key, size_t key_len, size_t readahead) {
+    pgmmv_reader* reader = (pgmmv_reader*)calloc(1, sizeof(pgmmv_reader));
+    if (!reader) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    uint64_t file_size;
+    if (pgmmv_open_resource(path, &reader->fd, &reader->header, &file_size) < 0) {
+        free(reader);
+        return NULL;
+    }
+    if (!reader->header.is_encrypted) return reader;
+
+    if (!readahead) readahead = PGMMV_READAHEAD;
+    reader->window_cap = readahead + (PGMMV_BLOCKSIZE - readahead % PGMMV_BLOCKSIZE) % PGMMV_BLOCKSIZE;
+    reader->block_end = reader->header.pt_len + (PGMMV_BLOCKSIZE - reader->header.pt_len % PGMMV_BLOCKSIZE) % PGMMV_BLOCKSIZE;
+    reader->buffer = (uint8_t*)malloc(PGMMV_BLOCKSIZE + reader->window_cap);
+    if (!reader->buffer) errno = ENOMEM;
+    if (!reader->buffer || pgmmv_prepare_key(&reader->cipher, key, key_len, reader->header.pt_len) < 0) {
+        pgmmv_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+uint64_t pgmmv_reader_size(const pgmmv_reader* reader) {
+    return reader->header.pt_len;
+}
+
+/* read `len` bytes of ciphertext at the block `offset`, a file shorter than when opened is malformed */
+static int _pgmmv_reader_fetch(pgmmv_reader* reader, uint8_t* dst, size_t len, uint64_t offset) {
+    ssize_t got = pgmmv_pread_full(reader->fd, dst, len, PGMMV_HEADERSIZE + offset);
+    if (got < 0) return -1;
+    if ((size_t)got < len) {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+/* decrypt the whole blocks of `len` bytes at `offset` into `dst`, chained from the ciphertext block before them */
+static int _pgmmv_reader_direct(pgmmv_reader* reader, uint8_t* dst, size_t len, uint64_t offset) {
+    uint8_t iv[PGMMV_BLOCKSIZE];
+    if (!offset) memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+    else if (_pgmmv_reader_fetch(reader, iv, PGMMV_BLOCKSIZE, offset - PGMMV_BLOCKSIZE) < 0) return -1;
+    if (_pgmmv_reader_fetch(reader, dst, len, offset) < 0) return -1;
+    return pgmmv_cbc_decrypt(&reader->cipher, iv, dst, dst, len);
+}
+
+/* move the window to the block holding `offset`, the ciphertext block before it is read along */
+static int _pgmmv_reader_fill(pgmmv_reader* reader, uint64_t offset) {
+    uint64_t start = offset - offset % PGMMV_BLOCKSIZE;
+    size_t len = (reader->block_end - start < reader->window_cap) ? (size_t)(reader->block_end - start) : reader->window_cap;
+    reader->window_len = 0;
+
+    int ret;
+    if (start) {
+        ret = _pgmmv_reader_fetch(reader, reader->buffer, PGMMV_BLOCKSIZE + len, start - PGMMV_BLOCKSIZE);
+    } else {
+        memcpy(reader->buffer, PGMMV_IV, PGMMV_BLOCKSIZE);
+        ret = _pgmmv_reader_fetch(reader, reader->buffer + PGMMV_BLOCKSIZE, len, 0);
+    }
+    uint8_t* window = reader->buffer + PGMMV_BLOCKSIZE;
+    if (ret < 0 || pgmmv_cbc_decrypt(&reader->cipher, reader->buffer, window, window, len) < 0) return -1;
+
+    reader->window_offset = start;
+    reader->window_len = (reader->header.pt_len - start < len) ? (size_t)(reader->header.pt_len - start) : len;
+    return 0;
+}
+
+int64_t pgmmv_reader_pread(pgmmv_reader* reader, void* buf, size_t len, uint64_t offset) {
+    uint64_t pt_len = reader->header.pt_len;
+    if (offset >= pt_len) return 0;
+    if (len > pt_len - offset) len = (size_t)(pt_len - offset);
+    if (!reader->header.is_encrypted) return pgmmv_pread_full(reader->fd, buf, len, offset);
+
+    uint8_t* dst = (uint8_t*)buf;
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = offset + done;
+        size_t want = len - done;
+        if (pos >= reader->window_offset && pos - reader->window_offset < reader->window_len) {
+            size_t skip = (size_t)(pos - reader->window_offset);
+            size_t part = (reader->window_len - skip < want) ? reader->window_len - skip : want;
+            memcpy(dst + done, reader->buffer + PGMMV_BLOCKSIZE + skip, part);
+            done += part;
+        } else if (pos % PGMMV_BLOCKSIZE == 0 && want >= reader->window_cap) {
+            /* reads of a window or more skip it, their whole blocks decrypted in place in `buf` */
+            size_t part = want - want % PGMMV_BLOCKSIZE;
+            if (_pgmmv_reader_direct(reader, dst + done, part, pos) < 0) return -1;
+            done += part;
+        } else if (_pgmmv_reader_fill(reader, pos) < 0) {
+            return -1;
+        }
+    }
+    return (int64_t)len;
+}
+
+void pgmmv_reader_close(pgmmv_reader* reader) {
+    if (!reader) return;
+    close(reader->fd);
+    if (reader->buffer) memset(reader->buffer, 0, PGMMV_BLOCKSIZE + reader->window_cap);
+    free(reader->buffer);
+    memset(&reader->cipher, 0, sizeof(pgmmv_cipher));
+    free(reader);
+}
+
+/* end random access */
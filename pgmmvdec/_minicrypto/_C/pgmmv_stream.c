@@ -0,0 +1,207 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+
+/* bounded stream */
+
+typedef struct _pgmmv_stream {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t* buffers[2];
+    size_t lens[2];
+    int full[2];        /* filled and waiting for the writer */
+    int closing;        /* no buffer will be filled anymore */
+    int error;          /* errno of the first failed write */
+    int threaded;       /* whether a writer thread runs, buffers are written in place otherwise */
+    int ofd;
+    int direct;         /* `ofd` opened with O_DIRECT, the buffers are aligned */
+} pgmmv_stream;
+
+static void* _pgmmv_stream_writer(void* arg) {
+    pgmmv_stream* stream = (pgmmv_stream*)arg;
+
+    /* buffers are filled and written in turns, the pending ones are still written once closing */
+    pthread_mutex_lock(&stream->lock);
+    for (int idx = 0;; idx ^= 1) {
+        while (!stream->full[idx] && !stream->closing) pthread_cond_wait(&stream->cond, &stream->lock);
+        if (!stream->full[idx]) break;
+
+        int skip = stream->error;
+        pthread_mutex_unlock(&stream->lock);
+        int err = (!skip && pgmmv_write_out(stream->ofd, stream->buffers[idx], stream->lens[idx], stream->direct) < 0) ? errno : 0;
+        pthread_mutex_lock(&stream->lock);
+
+        if (err) stream->error = err;
+        stream->full[idx] = 0;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+/* wait until buffer `idx` is written, return -1 if a write failed */
+static int _pgmmv_stream_acquire(pgmmv_stream* stream, int idx) {
+    if (!stream->threaded) return 0;
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->full[idx] && !stream->error) pthread_cond_wait(&stream->cond, &stream->lock);
+    int err = stream->error;
+    pthread_mutex_unlock(&stream->lock);
+
+    if (err) errno = err;
+    return (err) ? -1 : 0;
+}
+
+static int _pgmmv_stream_release(pgmmv_stream* stream, int idx, size_t len) {
+    if (!stream->threaded) return pgmmv_write_out(stream->ofd, stream->buffers[idx], len, stream->direct);
+
+    pthread_mutex_lock(&stream->lock);
+    stream->lens[idx] = len;
+    stream->full[idx] = 1;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+    return 0;
+}
+
+static int64_t _pgmmv_stream_chunks(pgmmv_stream* stream, int ifd, size_t buffer_size, const pgmmv_cipher* cipher, uint64_t pt_len) {
+    uint8_t iv[PGMMV_BLOCKSIZE];
+    memcpy(iv, PGMMV_IV, PGMMV_BLOCKSIZE);
+
+    /* one buffer is read and decrypted while the other is written, padding blocks are never written */
+    uint64_t remaining = pt_len;
+    for (int idx = 0; remaining; idx ^= stream->threaded) {
+        if (_pgmmv_stream_acquire(stream, idx) < 0) return -1;
+
+        uint8_t* buffer = stream->buffers[idx];
+        ssize_t len = pgmmv_read_full(ifd, buffer, buffer_size);
+        if (len < 0) return -1;
+        if (len == 0 || len % PGMMV_BLOCKSIZE) {
+            errno = EBADMSG;    /* the file shrank since its header was parsed */
+            return -1;
+        }
+
+        size_t out_len = ((uint64_t)len < remaining) ? (size_t)len : (size_t)remaining;
+        pgmmv_cbc_decrypt(cipher, iv, buffer, buffer, (size_t)len);
+        if (_pgmmv_stream_release(stream, idx, out_len) < 0) return -1;
+        remaining -= out_len;
+    }
+    return (int64_t)pt_len;
+}
+
+static int64_t _pgmmv_decrypt_stream(int ifd, int ofd, const uint8_t* key, size_t key_len, size_t buffer_size, int direct) {
+    struct stat st;
+    if (fstat(ifd, &st) < 0) return -1;
+
+    uint8_t head[PGMMV_HEADERSIZE];
+    ssize_t head_len = pgmmv_read_full(ifd, head, PGMMV_HEADERSIZE);
+    if (head_len < 0) return -1;
+
+    pgmmv_header header;
+    if (pgmmv_parse_header(&header, head, (size_t)head_len, (uint64_t)st.st_size) < 0) return -1;
+
+    /* whole blocks, and no less than the chunk an unencrypted copy goes through */
+    if (!buffer_size) buffer_size = PGMMV_STREAMSIZE;
+    buffer_size -= buffer_size % PGMMV_BLOCKSIZE;
+    if (buffer_size < PGMMV_CHUNKSIZE) buffer_size = PGMMV_CHUNKSIZE;
+    if (direct) buffer_size -= buffer_size % PGMMV_DIRECTALIGN;
+
+    /* a writer thread only pays off past one buffer of ciphertext */
+    pgmmv_stream stream = { .ofd = ofd, .direct = direct };
+    uint64_t ct_len = (uint64_t)st.st_size - PGMMV_HEADERSIZE;
+    int double_buffered = header.is_encrypted && ct_len > buffer_size;
+    uint64_t charge = (uint64_t)buffer_size * ((double_buffered) ? 2 : 1);
+    pgmmv_budget_admit(charge, 1);
+    stream.buffers[0] = pgmmv_buffer_get(buffer_size);
+    if (double_buffered) stream.buffers[1] = pgmmv_buffer_get(buffer_size);
+    if (!stream.buffers[0] || (double_buffered && !stream.buffers[1])) {
+        pgmmv_buffer_put(stream.buffers[0], buffer_size);
+        pgmmv_buffer_put(stream.buffers[1], buffer_size);
+        pgmmv_budget_leave(charge);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int64_t ret;
+    if (!header.is_encrypted) {
+        ret = pgmmv_copy_fd(ifd, ofd, stream.buffers[0], head, (size_t)head_len);
+    } else {
+        pgmmv_cipher cipher;
+        ret = pgmmv_prepare_key(&cipher, key, key_len, header.pt_len);
+
+        /* failing to spawn the writer only loses the overlap */
+        pthread_t writer;
+        pthread_mutex_init(&stream.lock, NULL);
+        pthread_cond_init(&stream.cond, NULL);
+        if (ret == 0 && double_buffered) stream.threaded = (pthread_create(&writer, NULL, _pgmmv_stream_writer, &stream) == 0);
+
+        if (ret == 0) ret = _pgmmv_stream_chunks(&stream, ifd, buffer_size, &cipher, header.pt_len);
+        int err = errno;
+
+        if (stream.threaded) {
+            pthread_mutex_lock(&stream.lock);
+            stream.closing = 1;
+            pthread_cond_broadcast(&stream.cond);
+            pthread_mutex_unlock(&stream.lock);
+            pthread_join(writer, NULL);
+            if (ret >= 0 && stream.error) {
+                err = stream.error;
+                ret = -1;
+            }
+        }
+        pthread_cond_destroy(&stream.cond);
+        pthread_mutex_destroy(&stream.lock);
+        memset(&cipher, 0, sizeof(cipher));
+        errno = err;
+    }
+
+    int err = errno;
+    pgmmv_buffer_put(stream.buffers[0], buffer_size);
+    pgmmv_buffer_put(stream.buffers[1], buffer_size);
+    pgmmv_budget_leave(charge);
+    errno = err;
+    return ret;
+}
+
+int64_t pgmmv_decrypt_stream(int ifd, int ofd, const uint8_t* key, size_t key_len, size_t buffer_size) {
+    return _pgmmv_decrypt_stream(ifd, ofd, key, key_len, buffer_size, 0);
+}
+
+int64_t pgmmv_decrypt_file_stream(const char* src, const char* dst, const uint8_t* key, size_t key_len, size_t buffer_size, int flags) {
+    int ifd;
+    pgmmv_header header;
+    uint64_t file_size;
+    if (pgmmv_open_resource(src, &ifd, &header, &file_size) < 0) return -1;
+    pgmmv_advise_input(ifd);
+
+    /* only large encrypted outputs are written with O_DIRECT, copies are left to the kernel */
+    int direct = (flags & PGMMV_DIRECT) && header.is_encrypted && header.pt_len >= PGMMV_DIRECTSIZE;
+    int ofd = pgmmv_open_output(dst, &direct);
+    if (ofd < 0) {
+        int err = errno;
+        close(ifd);
+        errno = err;
+        return -1;
+    }
+
+    int64_t ret = _pgmmv_decrypt_stream(ifd, ofd, key, key_len, buffer_size, direct);
+    if (ret >= 0 && (flags & PGMMV_IOFLAGS)) {
+        pgmmv_drop_cache(ifd, 0);
+        if (pgmmv_drop_cache(ofd, 1) < 0) ret = -1;
+    }
+    int err = errno;
+    close(ifd);
+    if (close(ofd) < 0 && ret >= 0) {
+        err = errno;
+        ret = -1;
+    }
+    errno = err;
+    return ret;
+}
+
+/* end bounded stream */
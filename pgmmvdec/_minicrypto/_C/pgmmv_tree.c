@@ -0,0 +1,508 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC   0
+#endif
+
+
+/* directory reader */
+
+#define PGMMV_DIRBUFSIZE    (1 << 16)   /* bytes of entries fetched by one getdents64() */
+
+typedef struct _pgmmv_dir {
+    int fd;
+#ifdef __linux__
+    uint8_t* buffer;
+    size_t len, pos;
+#else
+    DIR* dir;
+#endif
+} pgmmv_dir;
+
+#ifdef __linux__
+typedef struct _pgmmv_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} pgmmv_dirent64;
+#endif
+
+/* read the entries of the directory `fd`, which is closed along with the reader */
+static int _pgmmv_dir_open(pgmmv_dir* dir, int fd) {
+    dir->fd = fd;
+#ifdef __linux__
+    dir->buffer = (uint8_t*)malloc(PGMMV_DIRBUFSIZE);
+    dir->len = dir->pos = 0;
+    if (!dir->buffer) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+#else
+    dir->dir = fdopendir(fd);
+    if (!dir->dir) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * get the next entry other than "." and "..", its type is DT_UNKNOWN where the file system does not tell
+ * return 1 with an entry, 0 at the end, or -1 on failure
+ */
+static int _pgmmv_dir_next(pgmmv_dir* dir, const char** name, unsigned char* type) {
+    for (;;) {
+#ifdef __linux__
+        if (dir->pos >= dir->len) {
+            long len = syscall(SYS_getdents64, dir->fd, dir->buffer, PGMMV_DIRBUFSIZE);
+            if (len <= 0) return (len < 0) ? -1 : 0;
+            dir->len = (size_t)len;
+            dir->pos = 0;
+        }
+        pgmmv_dirent64* entry = (pgmmv_dirent64*)(dir->buffer + dir->pos);
+        dir->pos += entry->d_reclen;
+#else
+        errno = 0;
+        struct dirent* entry = readdir(dir->dir);
+        if (!entry) return (errno) ? -1 : 0;
+#endif
+        const char* entry_name = entry->d_name;
+        if (entry_name[0] == '.' && (!entry_name[1] || (entry_name[1] == '.' && !entry_name[2]))) continue;
+        *name = entry_name;
+        *type = entry->d_type;
+        return 1;
+    }
+}
+
+static void _pgmmv_dir_close(pgmmv_dir* dir) {
+#ifdef __linux__
+    close(dir->fd);
+    free(dir->buffer);
+#else
+    closedir(dir->dir);
+#endif
+}
+
+/* end directory reader */
+
+
+/* tree decryption */
+
+#define PGMMV_TREEBATCH     4096        /* most files decrypted as one batch */
+
+typedef struct _pgmmv_tree_batch {
+    pgmmv_file_task* tasks;
+    size_t count;
+    int walk_failed;            /* the walk ended on `failed` */
+    pgmmv_file_task failed;     /* the directory which could not be walked, its paths may be NULL */
+} pgmmv_tree_batch;
+
+typedef struct _pgmmv_tree_frame {
+    pgmmv_dir dir;
+    int dst_fd;                 /* -1 in place */
+    char* src;
+    char* dst;                  /* `src` in place */
+} pgmmv_tree_frame;
+
+typedef struct _pgmmv_tree {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pgmmv_tree_batch ready;     /* handed over by the walker */
+    int has_ready;
+    int walked;                 /* the walker is done */
+    int threaded;               /* the tree is walked on a helper thread, and decrypted as it goes */
+    atomic_int idle;            /* the decrypting thread waits for files */
+    atomic_int stop;            /* the decrypting thread asks the walker to stop */
+
+    const char* src;
+    const char* dst;
+    pgmmv_tree_batch filling;   /* owned by the walker */
+    pgmmv_tree_frame* frames;
+    size_t depth, frame_cap;
+
+    const uint8_t* key;
+    size_t key_len;
+    pgmmv_tune_profile* profile;
+    const pgmmv_pipeline_config* pipeline;
+    int flags;
+    int tuning;                 /* samples still go to `tuner` */
+    pgmmv_tuner tuner;
+    pgmmv_tree_callback done;
+    int scanning;               /* batches are scanned and go to `scan_done` instead */
+    pgmmv_scan_callback scan_done;
+    void* ctx;
+    int error;                  /* errno of the first failure */
+} pgmmv_tree;
+
+static void _pgmmv_tree_free(pgmmv_tree_batch* batch) {
+    for (size_t idx = 0; idx < batch->count; idx++) {
+        if (batch->tasks[idx].dst != batch->tasks[idx].src) free((char*)batch->tasks[idx].dst);
+        free((char*)batch->tasks[idx].src);
+    }
+    if (batch->failed.dst != batch->failed.src) free((char*)batch->failed.dst);
+    free((char*)batch->failed.src);
+    free(batch->tasks);
+    memset(batch, 0, sizeof(pgmmv_tree_batch));
+}
+
+/* decrypt tasks with `profile` */
+static int _pgmmv_tree_decrypt(pgmmv_tree* tree, pgmmv_file_task* tasks, size_t count, const pgmmv_tune_profile* profile) {
+    if (!tree->pipeline) return pgmmv_decrypt_files_tuned(tasks, count, tree->key, tree->key_len, profile, tree->flags);
+
+    pgmmv_pipeline_config pipeline = *tree->pipeline;
+    if (profile->threads) pipeline.decrypters = profile->threads;
+    if (profile->chunk_size) pipeline.chunk_size = profile->chunk_size;
+    return pgmmv_decrypt_files_pipeline(tasks, count, tree->key, tree->key_len, &pipeline, tree->flags);
+}
+
+/* scan and report a batch, return nonzero if the walk has to stop */
+static int _pgmmv_tree_scan(pgmmv_tree* tree, pgmmv_tree_batch* batch) {
+    int stop = 0;
+    pgmmv_scan_task* tasks = (batch->count) ? (pgmmv_scan_task*)calloc(batch->count, sizeof(pgmmv_scan_task)) : NULL;
+    if (batch->count && !tasks) {
+        tree->error = (tree->error) ? tree->error : ENOMEM;
+        stop = 1;
+    } else if (batch->count) {
+        for (size_t idx = 0; idx < batch->count; idx++) tasks[idx].path = batch->tasks[idx].src;
+        if (pgmmv_scan_files(tasks, batch->count, tree->profile->threads) < 0 && !tree->error) tree->error = errno;
+        if (tree->scan_done && tree->scan_done(tasks, batch->count, tree->ctx)) stop = 1;
+    }
+    free(tasks);
+    if (batch->walk_failed) {
+        if (!tree->error) tree->error = batch->failed.error;
+        pgmmv_scan_task failed = { .path = batch->failed.src, .result = -1, .error = batch->failed.error };
+        if (tree->scan_done && failed.path) tree->scan_done(&failed, 1, tree->ctx);
+        stop = 1;
+    }
+    if (stop && !tree->error) tree->error = ECANCELED;
+
+    _pgmmv_tree_free(batch);
+    return stop;
+}
+
+/* decrypt and report a batch, return nonzero if the walk has to stop */
+static int _pgmmv_tree_run(pgmmv_tree* tree, pgmmv_tree_batch* batch) {
+    if (tree->scanning) return _pgmmv_tree_scan(tree, batch);
+
+    int stop = 0, stopped = 0;
+    /* while tuning, the batch goes in samples, each reported once done */
+    size_t start = 0;
+    while (start < batch->count && !stop) {
+        size_t count = batch->count - start;
+        const pgmmv_tune_profile* profile = tree->profile;
+        if (tree->tuning) {
+            tree->tuning = pgmmv_tuner_next(&tree->tuner, &count);
+            profile = &tree->tuner.trial;
+            if (!tree->tuning) *tree->profile = tree->tuner.trial;
+        }
+
+        pgmmv_file_task* tasks = batch->tasks + start;
+        int ret = _pgmmv_tree_decrypt(tree, tasks, count, profile);
+        if (tree->tuning) pgmmv_tuner_report(&tree->tuner, tasks, count);
+        if (ret < 0 && !tree->error) tree->error = errno;
+        stop = (ret < 0 && (tree->flags & PGMMV_FAILFAST));
+        if (tree->done && tree->done(tasks, count, tree->ctx)) stop = stopped = 1;
+        start += count;
+    }
+    /* the files of the batch not decrypted are still reported as cancelled, unless `done` asked for no more */
+    if (start < batch->count && tree->done && !stopped) tree->done(batch->tasks + start, batch->count - start, tree->ctx);
+    if (batch->walk_failed) {
+        if (!tree->error) tree->error = batch->failed.error;
+        if (tree->done && batch->failed.src) tree->done(&batch->failed, 1, tree->ctx);
+        stop = 1;
+    }
+    if (stop && !tree->error) tree->error = ECANCELED;
+
+    _pgmmv_tree_free(batch);
+    return stop;
+}
+
+/* hand the files found so far over, return -1 if the walk has to stop */
+static int _pgmmv_tree_flush(pgmmv_tree* tree) {
+    if (!tree->threaded) return (_pgmmv_tree_run(tree, &tree->filling)) ? -1 : 0;
+
+    pthread_mutex_lock(&tree->lock);
+    while (tree->has_ready && !atomic_load(&tree->stop)) pthread_cond_wait(&tree->cond, &tree->lock);
+    int stop = atomic_load(&tree->stop);
+    if (!stop) {
+        tree->ready = tree->filling;
+        tree->has_ready = 1;
+        memset(&tree->filling, 0, sizeof(pgmmv_tree_batch));
+        pthread_cond_broadcast(&tree->cond);
+    }
+    pthread_mutex_unlock(&tree->lock);
+    return (stop) ? -1 : 0;
+}
+
+/* end the walk on a directory, which owns `src` and `dst` from now on */
+static int _pgmmv_tree_fail(pgmmv_tree* tree, char* src, char* dst, int err) {
+    tree->filling.walk_failed = 1;
+    tree->filling.failed = (pgmmv_file_task){ .src = src, .dst = dst, .result = -1, .error = err };
+    return -1;
+}
+
+/* queue a file, which owns `src` and `dst` from now on, the batch goes once full or once awaited */
+static int _pgmmv_tree_add(pgmmv_tree* tree, char* src, char* dst) {
+    pgmmv_tree_batch* batch = &tree->filling;
+    if (!batch->tasks) batch->tasks = (pgmmv_file_task*)malloc(sizeof(pgmmv_file_task) * PGMMV_TREEBATCH);
+    if (!batch->tasks) return _pgmmv_tree_fail(tree, src, dst, ENOMEM);
+
+    /* a task the scheduler never got to counts as cancelled */
+    batch->tasks[batch->count++] = (pgmmv_file_task){ .src = src, .dst = dst, .result = -1, .error = ECANCELED };
+    if (batch->count < PGMMV_TREEBATCH && !atomic_load_explicit(&tree->idle, memory_order_relaxed)) return 0;
+    return _pgmmv_tree_flush(tree);
+}
+
+static char* _pgmmv_tree_join(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    int sep = (dir_len && dir[dir_len - 1] != '/');
+    char* path = (char*)malloc(dir_len + sep + name_len + 1);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_len);
+    if (sep) path[dir_len] = '/';
+    memcpy(path + dir_len + sep, name, name_len + 1);
+    return path;
+}
+
+/* create `path` and its missing parents, an existing file is left for opening it as directory to fail on */
+static int _pgmmv_mkdirs(char* path) {
+    if (mkdir(path, 0777) == 0 || errno == EEXIST) return 0;
+    if (errno != ENOENT) return -1;
+
+    char* slash = strrchr(path, '/');
+    if (!slash || slash == path) {
+        errno = ENOENT;
+        return -1;
+    }
+    *slash = '\0';
+    int ret = _pgmmv_mkdirs(path);
+    *slash = '/';
+    if (ret < 0) return -1;
+    return (mkdir(path, 0777) == 0 || errno == EEXIST) ? 0 : -1;
+}
+
+/* enter the directory `src`, mirrored to `dst` below the output directory `dst_dir` unless in place */
+static int _pgmmv_tree_push(pgmmv_tree* tree, int src_dir, int dst_dir, const char* name, char* src, char* dst) {
+    if (tree->depth == tree->frame_cap) {
+        size_t cap = (tree->frame_cap) ? tree->frame_cap * 2 : 16;
+        pgmmv_tree_frame* frames = (pgmmv_tree_frame*)realloc(tree->frames, sizeof(pgmmv_tree_frame) * cap);
+        if (!frames) return _pgmmv_tree_fail(tree, src, dst, ENOMEM);
+        tree->frames = frames;
+        tree->frame_cap = cap;
+    }
+
+    pgmmv_tree_frame* frame = &tree->frames[tree->depth];
+    frame->src = src;
+    frame->dst = dst;
+    frame->dst_fd = -1;
+
+    int fd = openat(src_dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return _pgmmv_tree_fail(tree, src, dst, errno);
+
+    /* each output directory is created once, when its input is entered */
+    if (!(tree->flags & PGMMV_INPLACE)) {
+        int made = (dst_dir == AT_FDCWD) ? _pgmmv_mkdirs(dst) : mkdirat(dst_dir, name, 0777);
+        if (made == 0 || errno == EEXIST) frame->dst_fd = openat(dst_dir, (dst_dir == AT_FDCWD) ? dst : name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (frame->dst_fd < 0) {
+            int err = errno;
+            close(fd);
+            return _pgmmv_tree_fail(tree, src, dst, err);
+        }
+    }
+
+    if (_pgmmv_dir_open(&frame->dir, fd) < 0) {
+        int err = errno;
+        if (frame->dst_fd >= 0) close(frame->dst_fd);
+        return _pgmmv_tree_fail(tree, src, dst, err);
+    }
+    tree->depth++;
+    return 0;
+}
+
+static void _pgmmv_tree_pop(pgmmv_tree* tree) {
+    pgmmv_tree_frame* frame = &tree->frames[--tree->depth];
+    _pgmmv_dir_close(&frame->dir);
+    if (frame->dst_fd >= 0) close(frame->dst_fd);
+    if (frame->dst != frame->src) free(frame->dst);
+    free(frame->src);
+}
+
+/* visit an entry of the directory on top, return -1 if the walk has to stop */
+static int _pgmmv_tree_visit(pgmmv_tree* tree, const char* name, unsigned char type) {
+    pgmmv_tree_frame* frame = &tree->frames[tree->depth - 1];
+    int in_place = (tree->flags & PGMMV_INPLACE) != 0;
+
+    /* journals are picked up by the files they belong to, a scan lists them as they are */
+    size_t name_len = strlen(name), suffix_len = strlen(PGMMV_JOURNALSUFFIX);
+    if (in_place && !tree->scanning && name_len > suffix_len && !strcmp(name + name_len - suffix_len, PGMMV_JOURNALSUFFIX)) return 0;
+
+    /* links are followed, anything neither a file nor a directory fails to open as a directory */
+    int is_file = (type == DT_REG);
+    if (type == DT_LNK || type == DT_UNKNOWN) {
+        struct stat st;
+        is_file = (fstatat(frame->dir.fd, name, &st, 0) == 0 && S_ISREG(st.st_mode));
+    }
+
+    char* src = _pgmmv_tree_join(frame->src, name);
+    char* dst = (in_place) ? src : _pgmmv_tree_join(frame->dst, name);
+    if (!src || !dst) {
+        free(src);
+        if (dst != src) free(dst);
+        return _pgmmv_tree_fail(tree, NULL, NULL, ENOMEM);
+    }
+
+    if (is_file) return _pgmmv_tree_add(tree, src, dst);
+    return _pgmmv_tree_push(tree, frame->dir.fd, frame->dst_fd, name, src, dst);
+}
+
+/* walk the whole tree depth first, then hand the last files over */
+static void _pgmmv_tree_walk(pgmmv_tree* tree) {
+    int in_place = (tree->flags & PGMMV_INPLACE) != 0;
+    char* src = strdup(tree->src);
+    char* dst = (in_place || !src) ? src : strdup(tree->dst);
+
+    int ret;
+    struct stat st;
+    if (!src || !dst) {
+        free(src);
+        ret = _pgmmv_tree_fail(tree, NULL, NULL, ENOMEM);
+    } else if (stat(src, &st) == 0 && S_ISREG(st.st_mode)) {
+        ret = _pgmmv_tree_add(tree, src, dst);
+    } else {
+        ret = _pgmmv_tree_push(tree, AT_FDCWD, AT_FDCWD, src, src, dst);
+    }
+
+    while (ret == 0 && tree->depth && !atomic_load_explicit(&tree->stop, memory_order_relaxed)) {
+        const char* name;
+        unsigned char type;
+        pgmmv_tree_frame* frame = &tree->frames[tree->depth - 1];
+        int next = _pgmmv_dir_next(&frame->dir, &name, &type);
+        if (next < 0) {
+            int err = errno;
+            char* failed_src = strdup(frame->src);
+            char* failed_dst = (in_place || !failed_src) ? failed_src : strdup(frame->dst);
+            ret = _pgmmv_tree_fail(tree, failed_src, failed_dst, err);
+        } else if (next == 0) {
+            _pgmmv_tree_pop(tree);
+        } else {
+            ret = _pgmmv_tree_visit(tree, name, type);
+        }
+    }
+
+    while (tree->depth) _pgmmv_tree_pop(tree);
+    if (!atomic_load(&tree->stop) && (tree->filling.count || tree->filling.walk_failed)) _pgmmv_tree_flush(tree);
+}
+
+static void* _pgmmv_tree_walker(void* arg) {
+    pgmmv_tree* tree = (pgmmv_tree*)arg;
+    _pgmmv_tree_walk(tree);
+
+    pthread_mutex_lock(&tree->lock);
+    tree->walked = 1;
+    pthread_cond_broadcast(&tree->cond);
+    pthread_mutex_unlock(&tree->lock);
+    return NULL;
+}
+
+int pgmmv_decrypt_tree(const char* src, const char* dst, const uint8_t* key, size_t key_len, int threads,
+                       const pgmmv_pipeline_config* pipeline, int flags, pgmmv_tree_callback done, void* ctx) {
+    pgmmv_tune_profile profile = { .threads = (pipeline) ? pipeline->decrypters : threads };
+    return pgmmv_decrypt_tree_tuned(src, dst, key, key_len, &profile, pipeline, flags & ~PGMMV_AUTOTUNE, done, ctx);
+}
+
+/* walk `tree` and run its batches, then free it */
+static int _pgmmv_tree_process(pgmmv_tree* tree) {
+    atomic_init(&tree->idle, 0);
+    atomic_init(&tree->stop, 0);
+    pthread_mutex_init(&tree->lock, NULL);
+    pthread_cond_init(&tree->cond, NULL);
+
+    /* the calling thread runs each batch as soon as the walker hands it over, or once full without a walker */
+    pthread_t walker;
+    tree->threaded = (pthread_create(&walker, NULL, _pgmmv_tree_walker, tree) == 0);
+    if (!tree->threaded) _pgmmv_tree_walk(tree);
+
+    while (tree->threaded) {
+        pthread_mutex_lock(&tree->lock);
+        atomic_store(&tree->idle, 1);
+        while (!tree->has_ready && !tree->walked) pthread_cond_wait(&tree->cond, &tree->lock);
+        atomic_store(&tree->idle, 0);
+        if (!tree->has_ready) {
+            pthread_mutex_unlock(&tree->lock);
+            break;
+        }
+
+        pgmmv_tree_batch batch = tree->ready;
+        tree->has_ready = 0;
+        pthread_cond_broadcast(&tree->cond);
+        pthread_mutex_unlock(&tree->lock);
+
+        if (_pgmmv_tree_run(tree, &batch)) {
+            pthread_mutex_lock(&tree->lock);
+            atomic_store(&tree->stop, 1);
+            pthread_cond_broadcast(&tree->cond);
+            pthread_mutex_unlock(&tree->lock);
+            break;
+        }
+    }
+
+    if (tree->threaded) pthread_join(walker, NULL);
+    /* too few files to finish tuning still tell which profile did best */
+    if (tree->tuning) *tree->profile = tree->tuner.best;
+    if (tree->has_ready) _pgmmv_tree_free(&tree->ready);
+    _pgmmv_tree_free(&tree->filling);
+    free(tree->frames);
+    pthread_cond_destroy(&tree->cond);
+    pthread_mutex_destroy(&tree->lock);
+
+    if (tree->error) errno = tree->error;
+    return (tree->error) ? -1 : 0;
+}
+
+int pgmmv_decrypt_tree_tuned(const char* src, const char* dst, const uint8_t* key, size_t key_len,
+                             pgmmv_tune_profile* profile, const pgmmv_pipeline_config* pipeline, int flags,
+                             pgmmv_tree_callback done, void* ctx) {
+    pgmmv_tree tree = {
+        .src = src, .dst = dst, .key = key, .key_len = key_len, .profile = profile, .pipeline = pipeline,
+        .flags = flags & ~PGMMV_AUTOTUNE, .tuning = (flags & PGMMV_AUTOTUNE) != 0, .done = done, .ctx = ctx,
+    };
+    if (tree.tuning) {
+        pgmmv_tune_profile seed = *profile;
+        if (pipeline && !seed.chunk_size) seed.chunk_size = pipeline->chunk_size;
+        pgmmv_tuner_init(&tree.tuner, &seed, pipeline != NULL);
+    }
+    return _pgmmv_tree_process(&tree);
+}
+
+int pgmmv_scan_tree(const char* src, int threads, pgmmv_scan_callback done, void* ctx) {
+    /* walked as in place, so that no output tree is made */
+    pgmmv_tune_profile profile = { .threads = threads };
+    pgmmv_tree tree = {
+        .src = src, .dst = src, .profile = &profile, .flags = PGMMV_INPLACE, .scanning = 1, .scan_done = done, .ctx = ctx,
+    };
+    return _pgmmv_tree_process(&tree);
+}
+
+/* end tree decryption */
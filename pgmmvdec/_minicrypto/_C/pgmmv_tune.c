@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC   0
+#endif
+
+
+/* tune profiles */
+
+#define PGMMV_PROFILESIZE   4096        /* longest profile file read */
+
+int pgmmv_tune_load(pgmmv_tune_profile* profile, const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    char text[PGMMV_PROFILESIZE];
+    ssize_t len = pgmmv_read_full(fd, text, sizeof(text) - 1);
+    int err = errno;
+    close(fd);
+    if (len < 0) {
+        errno = err;
+        return -1;
+    }
+    text[len] = '\0';
+
+    /* "name=value" lines, names it does not know are skipped */
+    char* saved;
+    for (char* line = strtok_r(text, "\n", &saved); line; line = strtok_r(NULL, "\n", &saved)) {
+        char* value = strchr(line, '=');
+        if (!value) continue;
+        *value++ = '\0';
+
+        char* end;
+        errno = 0;
+        unsigned long long num = strtoull(value, &end, 10);
+        if (errno || end == value || (*end && *end != '\r') || !num) continue;
+        if (!strcmp(line, "threads") && num <= PGMMV_TUNEMAXTHREADS) profile->threads = (int)num;
+        else if (!strcmp(line, "chunk_size") && num <= SIZE_MAX) profile->chunk_size = (size_t)num;
+        else if (!strcmp(line, "split_size")) profile->split_size = (uint64_t)num;
+    }
+    return 0;
+}
+
+int pgmmv_tune_save(const pgmmv_tune_profile* profile, const char* path) {
+    char text[256];
+    int len = snprintf(text, sizeof(text), "threads=%d\nchunk_size=%zu\nsplit_size=%llu\n",
+                       profile->threads, profile->chunk_size, (unsigned long long)profile->split_size);
+
+    /* written aside then renamed over, so that a reader never sees half a profile */
+    size_t path_len = strlen(path);
+    char* temp = (char*)malloc(path_len + sizeof(".tmp"));
+    if (!temp) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(temp, path, path_len);
+    memcpy(temp + path_len, ".tmp", sizeof(".tmp"));
+
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    int ret = (fd < 0) ? -1 : pgmmv_write_full(fd, text, (size_t)len);
+    if (fd >= 0 && close(fd) < 0) ret = -1;
+    if (ret == 0) ret = rename(temp, path);
+    if (ret < 0 && fd >= 0) {
+        int err = errno;
+        unlink(temp);
+        errno = err;
+    }
+    free(temp);
+    return ret;
+}
+
+/* end tune profiles */
+
+
+/* auto-tuning */
+
+/*
+ * one parameter at a time, each candidate is tried on a sample of files and kept if it beat the fastest so far,
+ * samples are measured in bytes per second with each file counting for PGMMV_TUNEFILECOST more,
+ * so that samples of small and large files compare
+ */
+#define PGMMV_TUNETIME      3.0         /* most seconds spent trying profiles */
+#define PGMMV_TUNESAMPLE    0.25        /* fewest seconds a sample should last */
+#define PGMMV_TUNEFILES     32          /* fewest files of a sample */
+#define PGMMV_TUNEMAXFILES  (1 << 16)   /* most files of a sample */
+#define PGMMV_TUNEGAIN      1.05        /* speedup a candidate needs to be kept */
+#define PGMMV_TUNEFILECOST  (1 << 16)   /* bytes a file costs on top of its own, opening, creating and closing it */
+
+enum { TUNE_THREADS, TUNE_CHUNK, TUNE_SPLIT, TUNE_DONE };
+
+static const size_t PGMMV_TUNECHUNKS[] = { 1 << 16, 1 << 18, 1 << 20, 1 << 22 };
+static const uint64_t PGMMV_TUNESPLITS[] = { 1 << 22, 1 << 23, 1 << 25, 1 << 27 };
+
+#define PGMMV_COUNTOF(array)    (sizeof(array) / sizeof((array)[0]))
+
+static double _pgmmv_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+void pgmmv_tuner_init(pgmmv_tuner* tuner, const pgmmv_tune_profile* seed, int pipeline) {
+    memset(tuner, 0, sizeof(pgmmv_tuner));
+    tuner->best = *seed;
+    if (tuner->best.threads <= 0) tuner->best.threads = pgmmv_cpu_count();
+    if (!tuner->best.chunk_size) tuner->best.chunk_size = (pipeline) ? PGMMV_PIPECHUNK : PGMMV_CHUNKSIZE;
+    if (!tuner->best.split_size) tuner->best.split_size = PGMMV_SPLITSIZE;
+    tuner->trial = tuner->best;
+    tuner->pipeline = pipeline;
+    tuner->stage = TUNE_THREADS;
+    tuner->sample = PGMMV_TUNEFILES;
+    tuner->started = _pgmmv_now();
+}
+
+/* set the `step`th candidate of the current stage as trial, return 0 past the last one */
+static int _pgmmv_tuner_candidate(pgmmv_tuner* tuner, int step) {
+    tuner->trial = tuner->best;
+    switch (tuner->stage) {
+    case TUNE_THREADS: {
+        /* around the threads tuning started from, more for waiting on slow storage, fewer for a seeking disk */
+        static const int scales[][2] = { { 2, 1 }, { 1, 2 }, { 4, 1 } };
+        if (step >= (int)PGMMV_COUNTOF(scales)) return 0;
+        int threads = tuner->base_threads * scales[step][0] / scales[step][1];
+        tuner->trial.threads = (threads < 1) ? 1 : (threads > PGMMV_TUNEMAXTHREADS) ? PGMMV_TUNEMAXTHREADS : threads;
+        return 1;
+    }
+    case TUNE_CHUNK:
+        if (step >= (int)PGMMV_COUNTOF(PGMMV_TUNECHUNKS)) return 0;
+        tuner->trial.chunk_size = PGMMV_TUNECHUNKS[step];
+        return 1;
+    case TUNE_SPLIT:
+        if (step >= (int)PGMMV_COUNTOF(PGMMV_TUNESPLITS)) return 0;
+        tuner->trial.split_size = PGMMV_TUNESPLITS[step];
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* whether the current stage can make a difference to the files seen so far */
+static int _pgmmv_tuner_applies(const pgmmv_tuner* tuner) {
+    switch (tuner->stage) {
+    case TUNE_THREADS: return 1;
+    /* only the parts of split files are read by chunks outside of a pipeline */
+    case TUNE_CHUNK: return tuner->pipeline || (tuner->best.threads > 1 && tuner->largest >= tuner->best.split_size);
+    case TUNE_SPLIT: return !tuner->pipeline && tuner->best.threads > 1 && tuner->largest >= PGMMV_TUNESPLITS[0];
+    default: return 0;
+    }
+}
+
+int pgmmv_tuner_next(pgmmv_tuner* tuner, size_t* count) {
+    /* the profile tuning starts from is measured first */
+    if (!tuner->measured) {
+        tuner->base_threads = tuner->best.threads;
+    } else {
+        if (_pgmmv_now() - tuner->started > PGMMV_TUNETIME) tuner->stage = TUNE_DONE;
+        for (;;) {
+            if (tuner->stage == TUNE_DONE) {
+                tuner->trial = tuner->best;
+                return 0;
+            }
+            if (_pgmmv_tuner_applies(tuner) && _pgmmv_tuner_candidate(tuner, tuner->step)) {
+                tuner->step++;
+                if (memcmp(&tuner->trial, &tuner->best, sizeof(pgmmv_tune_profile))) break;
+                continue;
+            }
+            tuner->stage++;
+            tuner->step = 0;
+        }
+    }
+
+    /* enough files for every thread to take a few */
+    size_t sample = tuner->sample;
+    if (sample < 4 * (size_t)tuner->trial.threads) sample = 4 * (size_t)tuner->trial.threads;
+    if (sample < *count) *count = sample;
+    tuner->sample_started = _pgmmv_now();
+    return 1;
+}
+
+void pgmmv_tuner_report(pgmmv_tuner* tuner, const pgmmv_file_task* tasks, size_t count) {
+    double seconds = _pgmmv_now() - tuner->sample_started;
+    double work = 0;
+    for (size_t idx = 0; idx < count; idx++) {
+        if (tasks[idx].result < 0) continue;
+        work += (double)tasks[idx].result + PGMMV_TUNEFILECOST;
+        if ((uint64_t)tasks[idx].result > tuner->largest) tuner->largest = (uint64_t)tasks[idx].result;
+    }
+    double rate = work / ((seconds > 1e-6) ? seconds : 1e-6);
+
+    if (!tuner->measured) {
+        tuner->best_rate = rate;
+        tuner->measured = 1;
+    } else if (rate > tuner->best_rate * PGMMV_TUNEGAIN) {
+        tuner->best = tuner->trial;
+        tuner->best_rate = rate;
+    }
+
+    /* the next samples last long enough to be measured */
+    if (seconds < PGMMV_TUNESAMPLE && count >= tuner->sample) {
+        double scale = (seconds > PGMMV_TUNESAMPLE / 16) ? PGMMV_TUNESAMPLE / seconds : 16;
+        tuner->sample = (size_t)((double)tuner->sample * scale);
+        if (tuner->sample > PGMMV_TUNEMAXFILES) tuner->sample = PGMMV_TUNEMAXFILES;
+    }
+}
+
+/* end auto-tuning */
@@ -0,0 +1,410 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pgmmv.h"
+#include "pgmmv_internal.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PGMMV_HAVE_URING
+#endif
+#endif
+
+
+#ifdef PGMMV_HAVE_URING
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC   0
+#endif
+
+
+/* raw io_uring, without liburing */
+
+typedef struct _pgmmv_ring {
+    int fd;
+    void* sq_ptr, * cq_ptr;
+    size_t sq_map_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    unsigned* sq_head, * sq_tail, * sq_mask, * sq_array;
+    unsigned* cq_head, * cq_tail, * cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned sq_local_tail;         /* SQEs filled but not yet published */
+    unsigned to_submit;
+} pgmmv_ring;
+
+static int _pgmmv_ring_init(pgmmv_ring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return -1;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* one mapping holds both rings */
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_len > ring->sq_map_len) ring->sq_map_len = cq_len;
+    ring->sq_ptr = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) goto error;
+    ring->cq_ptr = ring->sq_ptr;
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_map_len);
+        goto error;
+    }
+
+    uint8_t* sq = (uint8_t*)ring->sq_ptr, * cq = (uint8_t*)ring->cq_ptr;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+    return 0;
+
+error:;
+    int err = errno;
+    close(ring->fd);
+    errno = err;
+    return -1;
+}
+
+static void _pgmmv_ring_exit(pgmmv_ring* ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->sq_ptr, ring->sq_map_len);
+    close(ring->fd);
+}
+
+static struct io_uring_sqe* _pgmmv_ring_get_sqe(pgmmv_ring* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head > *ring->sq_mask) return NULL;
+
+    unsigned idx = ring->sq_local_tail++ & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->to_submit++;
+    return sqe;
+}
+
+/* publish the filled SQEs, then wait for at least `wait_nr` completions */
+static int _pgmmv_ring_enter(pgmmv_ring* ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_nr, (wait_nr) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        ring->to_submit -= (unsigned)ret;
+        if (!ring->to_submit || !wait_nr) return 0;
+    }
+}
+
+static int _pgmmv_ring_register(pgmmv_ring* ring, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, ring->fd, opcode, arg, nr_args);
+}
+
+/* whether every operation the engine needs is supported */
+static int _pgmmv_ring_probe(pgmmv_ring* ring) {
+    static const uint8_t needed[] = { IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE };
+
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, len);
+    if (!probe) return 0;
+
+    int supported = (_pgmmv_ring_register(ring, IORING_REGISTER_PROBE, probe, 256) == 0);
+    for (size_t idx = 0; supported && idx < sizeof(needed); idx++) {
+        supported = (needed[idx] <= probe->last_op && (probe->ops[needed[idx]].flags & IO_URING_OP_SUPPORTED));
+    }
+    free(probe);
+    return supported;
+}
+
+/* end raw io_uring, without liburing */
+
+
+/* io_uring engine */
+
+/*
+ * every file goes through a slot owning one buffer:
+ * open input and output together, read the input whole into the buffer,
+ * decrypt it in place once the read completes, then close the input while writing the output
+ */
+
+enum { OP_OPEN_IN, OP_OPEN_OUT, OP_READ, OP_WRITE, OP_CLOSE_IN, OP_CLOSE_OUT };
+
+typedef struct _pgmmv_slot {
+    pgmmv_file_task* task;
+    uint64_t planned;               /* size seen when planning */
+    int ifd, ofd;
+    unsigned inflight;              /* operations not completed yet */
+    int closing;                    /* no more operations but closes */
+    uint32_t done_len;              /* read or written so far */
+    uint32_t out_len;
+    int64_t result;
+    int error;
+} pgmmv_slot;
+
+struct _pgmmv_uring {
+    pgmmv_ring ring;
+    uint8_t* arena;                 /* PGMMV_URINGDEPTH buffers of PGMMV_SMALLSIZE bytes */
+    int fixed;                      /* the arena is registered */
+    pgmmv_slot slots[PGMMV_URINGDEPTH];
+};
+
+static uint8_t* _pgmmv_slot_buffer(pgmmv_uring* engine, unsigned slot) {
+    return engine->arena + (size_t)slot * PGMMV_SMALLSIZE;
+}
+
+static void _pgmmv_slot_submit(pgmmv_uring* engine, unsigned slot, int op, int fd, uint32_t offset, uint32_t len) {
+    /* the ring has two SQEs per slot and a slot never has more pending */
+    struct io_uring_sqe* sqe = _pgmmv_ring_get_sqe(&engine->ring);
+    pgmmv_slot* state = &engine->slots[slot];
+    state->inflight++;
+    sqe->user_data = ((uint64_t)slot << 8) | (uint64_t)op;
+
+    switch (op) {
+    case OP_OPEN_IN:
+    case OP_OPEN_OUT:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)((op == OP_OPEN_IN) ? state->task->src : state->task->dst);
+        sqe->open_flags = (op == OP_OPEN_IN) ? (O_RDONLY | O_CLOEXEC) : (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+        sqe->len = (op == OP_OPEN_IN) ? 0 : 0666;
+        break;
+    case OP_READ:
+    case OP_WRITE:
+        sqe->opcode = (op == OP_READ) ? ((engine->fixed) ? IORING_OP_READ_FIXED : IORING_OP_READ)
+                                      : ((engine->fixed) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)(_pgmmv_slot_buffer(engine, slot) + offset);
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->buf_index = 0;
+        break;
+    default:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fd;
+        break;
+    }
+}
+
+static void _pgmmv_slot_fail(pgmmv_slot* state, int err) {
+    if (!state->error) state->error = err;
+    state->result = -1;
+}
+
+/* stop the file, closing whatever is open */
+static void _pgmmv_slot_close(pgmmv_uring* engine, unsigned slot) {
+    pgmmv_slot* state = &engine->slots[slot];
+    state->closing = 1;
+    if (state->ifd >= 0) _pgmmv_slot_submit(engine, slot, OP_CLOSE_IN, state->ifd, 0, 0);
+    if (state->ofd >= 0) _pgmmv_slot_submit(engine, slot, OP_CLOSE_OUT, state->ofd, 0, 0);
+    state->ifd = state->ofd = -1;
+}
+
+static void _pgmmv_slot_start(pgmmv_uring* engine, unsigned slot, pgmmv_file_task* task, uint64_t planned) {
+    engine->slots[slot] = (pgmmv_slot){ .task = task, .planned = planned, .ifd = -1, .ofd = -1 };
+    _pgmmv_slot_submit(engine, slot, OP_OPEN_IN, -1, 0, 0);
+    _pgmmv_slot_submit(engine, slot, OP_OPEN_OUT, -1, 0, 0);
+}
+
+static void _pgmmv_slot_read_done(pgmmv_uring* engine, unsigned slot, pgmmv_small_source* source) {
+    pgmmv_slot* state = &engine->slots[slot];
+    uint8_t* buffer = _pgmmv_slot_buffer(engine, slot);
+
+    /* a full buffer means the file grew, it goes the long way */
+    if (state->done_len == PGMMV_SMALLSIZE) {
+        close(state->ifd);
+        close(state->ofd);
+        state->ifd = state->ofd = -1;
+        state->result = pgmmv_decrypt_file(state->task->src, state->task->dst, source->key, source->key_len);
+        if (state->result < 0) state->error = errno;
+        state->closing = 1;
+        return;
+    }
+
+    int64_t pt_len = pgmmv_decrypt_resource(buffer, buffer, state->done_len, source->key, source->key_len);
+    if (pt_len < 0) {
+        _pgmmv_slot_fail(state, errno);
+        _pgmmv_slot_close(engine, slot);
+        return;
+    }
+
+    state->result = pt_len;
+    state->out_len = (uint32_t)pt_len;
+    state->done_len = 0;
+    _pgmmv_slot_submit(engine, slot, OP_CLOSE_IN, state->ifd, 0, 0);
+    state->ifd = -1;
+    if (state->out_len) _pgmmv_slot_submit(engine, slot, OP_WRITE, state->ofd, 0, state->out_len);
+    else _pgmmv_slot_close(engine, slot);
+}
+
+static void _pgmmv_slot_complete(pgmmv_uring* engine, unsigned slot, int op, int res, pgmmv_small_source* source) {
+    pgmmv_slot* state = &engine->slots[slot];
+    state->inflight--;
+
+    switch (op) {
+    case OP_OPEN_IN:
+    case OP_OPEN_OUT:
+        if (res < 0) _pgmmv_slot_fail(state, -res);
+        else if (op == OP_OPEN_IN) state->ifd = res;
+        else state->ofd = res;
+
+        if (state->inflight) break;
+        if (state->error) _pgmmv_slot_close(engine, slot);
+        else _pgmmv_slot_submit(engine, slot, OP_READ, state->ifd, 0, PGMMV_SMALLSIZE);
+        break;
+    case OP_READ:
+        if (res < 0) {
+            _pgmmv_slot_fail(state, -res);
+            _pgmmv_slot_close(engine, slot);
+            break;
+        }
+        /* short of the planned size and not at the end of file, read the rest */
+        state->done_len += (uint32_t)res;
+        if (res > 0 && state->done_len < state->planned && state->done_len < PGMMV_SMALLSIZE) {
+            _pgmmv_slot_submit(engine, slot, OP_READ, state->ifd, state->done_len, PGMMV_SMALLSIZE - state->done_len);
+        } else {
+            _pgmmv_slot_read_done(engine, slot, source);
+        }
+        break;
+    case OP_WRITE:
+        if (res <= 0) {
+            _pgmmv_slot_fail(state, (res < 0) ? -res : EIO);
+            _pgmmv_slot_close(engine, slot);
+            break;
+        }
+        state->done_len += (uint32_t)res;
+        if (state->done_len < state->out_len) {
+            _pgmmv_slot_submit(engine, slot, OP_WRITE, state->ofd, state->done_len, state->out_len - state->done_len);
+        } else {
+            _pgmmv_slot_close(engine, slot);
+        }
+        break;
+    case OP_CLOSE_OUT:
+        if (res < 0) _pgmmv_slot_fail(state, -res);
+        break;
+    default:
+        break;
+    }
+}
+
+pgmmv_uring* pgmmv_uring_create() {
+    pgmmv_uring* engine = (pgmmv_uring*)calloc(1, sizeof(pgmmv_uring));
+    if (!engine) return NULL;
+    if (_pgmmv_ring_init(&engine->ring, PGMMV_URINGDEPTH * 2) < 0) {
+        free(engine);
+        return NULL;
+    }
+    if (!_pgmmv_ring_probe(&engine->ring)) goto error;
+
+    size_t arena_len = (size_t)PGMMV_URINGDEPTH * PGMMV_SMALLSIZE;
+    engine->arena = (uint8_t*)mmap(NULL, arena_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (engine->arena == MAP_FAILED) goto error;
+
+    /* registered buffers skip the page pinning of every transfer, a low memlock limit only loses that */
+    struct iovec iov = { .iov_base = engine->arena, .iov_len = arena_len };
+    engine->fixed = (_pgmmv_ring_register(&engine->ring, IORING_REGISTER_BUFFERS, &iov, 1) == 0);
+    return engine;
+
+error:
+    _pgmmv_ring_exit(&engine->ring);
+    free(engine);
+    return NULL;
+}
+
+void pgmmv_uring_run(pgmmv_uring* engine, pgmmv_small_source* source) {
+    unsigned active = 0;
+    int exhausted = 0;
+    uint8_t busy[PGMMV_URINGDEPTH] = { 0 };
+
+    for (;;) {
+        /* keep every slot busy while files are left */
+        for (unsigned slot = 0; !exhausted && slot < PGMMV_URINGDEPTH; slot++) {
+            if (busy[slot]) continue;
+            pgmmv_file_task* task;
+            uint64_t planned;
+            if (!source->next(source, &task, &planned)) {
+                exhausted = 1;
+                break;
+            }
+            _pgmmv_slot_start(engine, slot, task, planned);
+            busy[slot] = 1;
+            active++;
+        }
+        if (!active) return;
+
+        if (_pgmmv_ring_enter(&engine->ring, 1) < 0) {
+            /* the ring broke, the files in flight fail with it */
+            int err = errno;
+            for (unsigned slot = 0; slot < PGMMV_URINGDEPTH; slot++) {
+                if (busy[slot]) source->done(source, engine->slots[slot].task, -1, err);
+            }
+            return;
+        }
+
+        unsigned head = *engine->ring.cq_head;
+        unsigned tail = __atomic_load_n(engine->ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe* cqe = &engine->ring.cqes[head & *engine->ring.cq_mask];
+            unsigned slot = (unsigned)(cqe->user_data >> 8);
+            _pgmmv_slot_complete(engine, slot, (int)(cqe->user_data & 0xFF), cqe->res, source);
+
+            pgmmv_slot* state = &engine->slots[slot];
+            if (state->closing && !state->inflight) {
+                source->done(source, state->task, state->result, state->error);
+                busy[slot] = 0;
+                active--;
+            }
+        }
+        __atomic_store_n(engine->ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void pgmmv_uring_destroy(pgmmv_uring* engine) {
+    munmap(engine->arena, (size_t)PGMMV_URINGDEPTH * PGMMV_SMALLSIZE);
+    _pgmmv_ring_exit(&engine->ring);
+    free(engine);
+}
+
+/* end io_uring engine */
+
+#else
+
+/* io_uring engine */
+
+pgmmv_uring* pgmmv_uring_create() {
+    errno = ENOSYS;
+    return NULL;
+}
+
+void pgmmv_uring_run(pgmmv_uring* engine, pgmmv_small_source* source) {
+    (void)engine; (void)source;
+}
+
+void pgmmv_uring_destroy(pgmmv_uring* engine) {
+    (void)engine;
+}
+
+/* end io_uring engine */
+
+#endif
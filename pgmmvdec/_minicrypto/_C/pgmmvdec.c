@@ -0,0 +1,724 @@
+/*
+ * pgmmvdec, native command line decrypter built on libpgmmv
+ * accepts the same arguments as the Python `pgmmvdec` script
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pgmmv.h"
+
+
+#define PROGNAME    "pgmmvdec"
+#define USAGE       "usage: " PROGNAME " [-h] [-o OUTPUT] [-q] [--scan] [-j N] [-l] [-i [--journal]] [-p] [--drop-cache] [--direct] [--disk-order] [--auto-tune] [--tune-profile FILE] [--huge-pages] [--mem-limit SIZE] [-k KEY | -x KEY] input\n"
+
+static const char* const PGMMV_INFO_PATHS[] = {
+    "info.json",
+    "data/info.json",
+    NULL
+};
+#define PGMMV_KEY_DICTKEY   "key"
+
+
+/* error reporting */
+
+static void _fail(const char* fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+static void _fail(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fputs(PROGNAME ": error: ", stderr);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(1);
+}
+
+static void* _xmalloc(size_t size) {
+    void* ptr = malloc(size);
+    if (!ptr) _fail("out of memory");
+    return ptr;
+}
+
+/* end error reporting */
+
+
+/* path helpers */
+
+static char* _path_join(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    int sep = (dir_len && dir[dir_len - 1] != '/');
+    char* path = (char*)_xmalloc(dir_len + sep + name_len + 1);
+    memcpy(path, dir, dir_len);
+    if (sep) path[dir_len] = '/';
+    memcpy(path + dir_len + sep, name, name_len + 1);
+    return path;
+}
+
+static int _path_exists(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static int _path_is_dir(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* lexically normalize an absolute path in place, like os.path.normpath */
+static void _path_normalize(char* path) {
+    char* out = path;
+    const char* in = path;
+    while (*in) {
+        while (*in == '/') in++;
+        const char* end = strchrnul(in, '/');
+        size_t len = (size_t)(end - in);
+        if (len == 0 || (len == 1 && in[0] == '.')) {
+            /* skip */
+        } else if (len == 2 && in[0] == '.' && in[1] == '.') {
+            while (out > path && *--out != '/');
+        } else {
+            *out++ = '/';
+            memmove(out, in, len);
+            out += len;
+        }
+        in = end;
+    }
+    if (out == path) *out++ = '/';
+    *out = '\0';
+}
+
+/* resolve like pathlib.Path.resolve(strict=False) */
+static char* _path_resolve(const char* path) {
+    char* resolved = realpath(path, NULL);
+    if (resolved) return resolved;
+
+    char* absolute;
+    if (path[0] == '/') {
+        absolute = strdup(path);
+    } else {
+        char* cwd = getcwd(NULL, 0);
+        if (!cwd) _fail("cannot get the working directory: %s", strerror(errno));
+        absolute = _path_join(cwd, path);
+        free(cwd);
+    }
+    if (!absolute) _fail("out of memory");
+    _path_normalize(absolute);
+
+    /* resolve the longest existing parent */
+    char* slash = strrchr(absolute, '/');
+    if (slash && slash != absolute) {
+        *slash = '\0';
+        char* parent = _path_resolve(absolute);
+        char* joined = _path_join(parent, slash + 1);
+        free(parent);
+        free(absolute);
+        return joined;
+    }
+    return absolute;
+}
+
+/* whether `path` equals `base` or lies below it */
+static int _path_is_relative_to(const char* path, const char* base) {
+    size_t base_len = strlen(base);
+    if (strncmp(path, base, base_len)) return 0;
+    return path[base_len] == '\0' || path[base_len] == '/' || (base_len && base[base_len - 1] == '/');
+}
+
+/* append "-dec" to the stem, like pathlib.Path.with_stem(stem + '-dec') */
+static char* _path_default_out(const char* input) {
+    const char* name = strrchr(input, '/');
+    name = (name) ? name + 1 : input;
+    const char* dot = strrchr(name, '.');
+    size_t stem_end = (dot && dot > name && dot[1]) ? (size_t)(dot - input) : strlen(input);
+
+    char* out = (char*)_xmalloc(strlen(input) + 5);
+    memcpy(out, input, stem_end);
+    strcpy(out + stem_end, "-dec");
+    strcat(out, input + stem_end);
+    return out;
+}
+
+/* end path helpers */
+
+
+/* key discovery */
+
+static const char* _json_skip_ws(const char* ptr) {
+    while (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r') ptr++;
+    return ptr;
+}
+
+/* parse a JSON string, `*out` gets the unescaped ASCII content, NULL if not wanted */
+static const char* _json_parse_string(const char* ptr, char** out) {
+    if (*ptr++ != '"') return NULL;
+
+    const char* start = ptr;
+    while (*ptr && *ptr != '"') ptr += (*ptr == '\\' && ptr[1]) ? 2 : 1;
+    if (*ptr != '"') return NULL;
+
+    if (out) {
+        char* str = (char*)_xmalloc((size_t)(ptr - start) + 1), * dst = str;
+        for (const char* src = start; src < ptr; src++) {
+            if (*src == '\\') {
+                src++;
+                switch (*src) {
+                case 'n': *dst++ = '\n'; break;
+                case 't': *dst++ = '\t'; break;
+                case 'r': *dst++ = '\r'; break;
+                case 'b': *dst++ = '\b'; break;
+                case 'f': *dst++ = '\f'; break;
+                case 'u': src += (src[1] && src[2] && src[3] && src[4]) ? 4 : 0; *dst++ = '?'; break;
+                default: *dst++ = *src; break;
+                }
+            } else {
+                *dst++ = *src;
+            }
+        }
+        *dst = '\0';
+        *out = str;
+    }
+    return ptr + 1;
+}
+
+static const char* _json_skip_value(const char* ptr) {
+    ptr = _json_skip_ws(ptr);
+    if (*ptr == '"') return _json_parse_string(ptr, NULL);
+    if (*ptr != '{' && *ptr != '[') {
+        while (*ptr && !strchr(",}] \t\r\n", *ptr)) ptr++;
+        return ptr;
+    }
+
+    int depth = 0;
+    while (*ptr) {
+        if (*ptr == '"') {
+            ptr = _json_parse_string(ptr, NULL);
+            if (!ptr) return NULL;
+            continue;
+        }
+        if (*ptr == '{' || *ptr == '[') depth++;
+        if (*ptr == '}' || *ptr == ']') depth--;
+        ptr++;
+        if (!depth) return ptr;
+    }
+    return NULL;
+}
+
+/* get a top-level string member of a JSON object */
+static char* _json_get_string(const char* json, const char* member) {
+    char* value = NULL;
+    const char* ptr = _json_skip_ws(json);
+    if (*ptr++ != '{') return NULL;
+
+    for (;;) {
+        char* name;
+        ptr = _json_skip_ws(ptr);
+        if (*ptr == '}' || !(ptr = _json_parse_string(ptr, &name))) break;
+        ptr = _json_skip_ws(ptr);
+        if (*ptr++ != ':') {
+            free(name);
+            break;
+        }
+
+        ptr = _json_skip_ws(ptr);
+        if (!strcmp(name, member) && *ptr == '"') {
+            free(value);
+            ptr = _json_parse_string(ptr, &value);
+        } else {
+            ptr = _json_skip_value(ptr);
+        }
+        free(name);
+        if (!ptr) break;
+
+        ptr = _json_skip_ws(ptr);
+        if (*ptr++ != ',') break;
+    }
+    return value;
+}
+
+/* decode base64, skipping characters outside of the alphabet like base64.b64decode */
+static uint8_t* _base64_decode(const char* str, size_t* len) {
+    uint8_t* data = (uint8_t*)_xmalloc(strlen(str) / 4 * 3 + 3);
+    uint32_t acc = 0;
+    int bits = 0;
+    *len = 0;
+
+    for (; *str && *str != '='; str++) {
+        const char* pos = strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/", *str);
+        if (!pos) continue;
+        acc = (acc << 6) | (uint32_t)(pos - "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            data[(*len)++] = (uint8_t)(acc >> bits);
+        }
+    }
+    return data;
+}
+
+static char* _read_text(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) _fail("cannot open %s: %s", path, strerror(errno));
+
+    size_t cap = 4096, len = 0;
+    char* text = (char*)_xmalloc(cap);
+    for (;;) {
+        len += fread(text + len, 1, cap - len - 1, fp);
+        if (len < cap - 1) break;
+        cap *= 2;
+        text = (char*)realloc(text, cap);
+        if (!text) _fail("out of memory");
+    }
+    if (ferror(fp)) _fail("cannot read %s: %s", path, strerror(errno));
+    fclose(fp);
+    text[len] = '\0';
+    return text;
+}
+
+/* search info.json upwards from `cwd`, return the decrypted key or NULL */
+static uint8_t* _find_key(const char* cwd, size_t* key_len) {
+    char* dir = strdup(cwd);
+    if (!dir) _fail("out of memory");
+
+    while (strcmp(dir, "/")) {
+        for (size_t idx = 0; PGMMV_INFO_PATHS[idx]; idx++) {
+            char* info = _path_join(dir, PGMMV_INFO_PATHS[idx]);
+            if (!_path_exists(info)) {
+                free(info);
+                continue;
+            }
+
+            char* text = _read_text(info);
+            char* enckey = _json_get_string(text, PGMMV_KEY_DICTKEY);
+            if (!enckey) _fail("no '%s' string in %s", PGMMV_KEY_DICTKEY, info);
+
+            uint8_t* key = _base64_decode(enckey, key_len);
+            if (pgmmv_decrypt_key(key, key, *key_len) < 0) {
+                _fail("Length of data must be divisible by %d", PGMMV_BLOCKSIZE);
+            }
+            free(enckey);
+            free(text);
+            free(info);
+            free(dir);
+            return key;
+        }
+
+        char* slash = strrchr(dir, '/');
+        slash[(slash == dir) ? 1 : 0] = '\0';
+    }
+    free(dir);
+    return NULL;
+}
+
+static uint8_t* _parse_hex(const char* hex, size_t* len) {
+    uint8_t* data = (uint8_t*)_xmalloc(strlen(hex) / 2 + 1);
+    *len = 0;
+
+    while (*hex) {
+        if (*hex == ' ' || *hex == '\t' || *hex == '\n' || *hex == '\r' || *hex == '\f' || *hex == '\v') {
+            hex++;
+            continue;
+        }
+        unsigned int byte;
+        if (!hex[1] || sscanf(hex, "%2x", &byte) != 1 || !strchr("0123456789abcdefABCDEF", hex[1])) {
+            _fail("non-hexadecimal number found in fromhex() arg");
+        }
+        data[(*len)++] = (uint8_t)byte;
+        hex += 2;
+    }
+    return data;
+}
+
+/* print like bytes.decode('utf-8', 'backslashreplace') */
+static void _print_key(const uint8_t* key, size_t key_len) {
+    printf("Resource key: ");
+    for (size_t idx = 0; idx < key_len; idx++) printf("%02x", key[idx]);
+    printf(" \"");
+
+    for (size_t idx = 0; idx < key_len;) {
+        uint8_t lead = key[idx];
+        size_t seq = (lead < 0x80) ? 1 : (lead >> 5 == 0x6) ? 2 : (lead >> 4 == 0xE) ? 3 : (lead >> 3 == 0x1E) ? 4 : 0;
+        int valid = seq && idx + seq <= key_len && !(seq == 2 && lead < 0xC2) && !(seq == 4 && lead > 0xF4);
+        for (size_t off = 1; valid && off < seq; off++) valid = (key[idx + off] >> 6 == 0x2);
+        if (valid && seq == 3) {
+            valid = !(lead == 0xE0 && key[idx + 1] < 0xA0) && !(lead == 0xED && key[idx + 1] >= 0xA0);
+        }
+        if (valid && seq == 4) {
+            valid = !(lead == 0xF0 && key[idx + 1] < 0x90) && !(lead == 0xF4 && key[idx + 1] >= 0x90);
+        }
+
+        if (valid) {
+            fwrite(key + idx, 1, seq, stdout);
+            idx += seq;
+        } else {
+            printf("\\x%02x", lead);
+            idx++;
+        }
+    }
+    printf("\"\n");
+}
+
+/* the key given as str or hex, or else found for `input`, without its trailing zeros, NULL if none is found */
+static uint8_t* _get_key(const char* key_arg, const char* hex_arg, const char* input, int input_is_dir, size_t* key_len) {
+    uint8_t* key;
+    if (key_arg) {
+        *key_len = strlen(key_arg);
+        key = (uint8_t*)_xmalloc(*key_len + 1);
+        memcpy(key, key_arg, *key_len);
+    } else if (hex_arg) {
+        key = _parse_hex(hex_arg, key_len);
+    } else {
+        char* cwd = strdup(input);
+        if (!cwd) _fail("out of memory");
+        if (!input_is_dir) *strrchr(cwd, '/') = '\0';
+        key = _find_key((cwd[0]) ? cwd : "/", key_len);
+        free(cwd);
+        if (!key) return NULL;
+    }
+    while (*key_len && !key[*key_len - 1]) (*key_len)--;
+    return key;
+}
+
+/* end key discovery */
+
+
+/* traversal */
+
+/* report the failures of each batch as the tree is walked */
+static int _report(const pgmmv_file_task* tasks, size_t count, void* ctx) {
+    size_t* cancelled = (size_t*)ctx;
+    for (size_t idx = 0; idx < count; idx++) {
+        const pgmmv_file_task* task = &tasks[idx];
+        if (task->result < 0 && task->error == ECANCELED) {
+            (*cancelled)++;
+        } else if (task->result < 0) {
+            const char* reason = (task->error == EBADMSG) ? "Illegal resource format" : strerror(task->error);
+            fprintf(stderr, PROGNAME ": error: %s: %s\n", task->src, reason);
+        }
+    }
+    return 0;
+}
+
+/*
+ * decrypt with `jobs` threads, or those of the profile saved in `tune_path` without, no file is started after the first failure
+ * with PGMMV_AUTOTUNE, the profile chosen is saved to `tune_path`
+ */
+static int _decrypt_path(const char* src, const char* dst, const uint8_t* key, size_t key_len, int jobs, int flags, int pipeline,
+                         const char* tune_path) {
+    pgmmv_tune_profile profile = { .threads = jobs };
+    if (tune_path && pgmmv_tune_load(&profile, tune_path) < 0 && errno != ENOENT) {
+        fprintf(stderr, PROGNAME ": error: %s: %s\n", tune_path, strerror(errno));
+        return -1;
+    }
+    if (jobs) profile.threads = jobs;
+
+    size_t cancelled = 0;
+    pgmmv_pipeline_config config = { .decrypters = jobs };
+    int ret = pgmmv_decrypt_tree_tuned(src, dst, key, key_len, &profile, (pipeline) ? &config : NULL, PGMMV_FAILFAST | flags,
+                                       _report, &cancelled);
+    if (cancelled) fprintf(stderr, PROGNAME ": error: aborted, %zu files not decrypted\n", cancelled);
+
+    if (tune_path && (flags & PGMMV_AUTOTUNE) && pgmmv_tune_save(&profile, tune_path) < 0) {
+        fprintf(stderr, PROGNAME ": error: %s: %s\n", tune_path, strerror(errno));
+        ret = -1;
+    }
+    return ret;
+}
+
+/* end traversal */
+
+
+/* scanning */
+
+typedef struct _scan_totals {
+    size_t prefix_len;          /* bytes of each path before the part printed */
+    int subkey_len;             /* 0 without a key */
+    size_t files, encrypted, unencrypted, failed;
+    uint64_t size, plain_size;
+} scan_totals;
+
+/* print `str` as a JSON string, bytes which are not ASCII go as they are */
+static void _json_print_string(const char* str) {
+    putchar('"');
+    for (const unsigned char* ptr = (const unsigned char*)str; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\') printf("\\%c", *ptr);
+        else if (*ptr < 0x20) printf("\\u%04x", *ptr);
+        else putchar(*ptr);
+    }
+    putchar('"');
+}
+
+static void _print_subkey(int subkey_len) {
+    if (!subkey_len) {
+        printf("\"subkey_len\": null, \"key_class\": null");
+        return;
+    }
+    printf("\"subkey_len\": %d, \"key_class\": \"%s\"", subkey_len, (subkey_len <= PGMMV_WEAKKEYLEN) ? "weak" : "strong");
+}
+
+/* print each batch as the tree is walked, as the Python script prints its entries */
+static int _scan_report(const pgmmv_scan_task* tasks, size_t count, void* ctx) {
+    scan_totals* totals = (scan_totals*)ctx;
+    for (size_t idx = 0; idx < count; idx++) {
+        const pgmmv_scan_task* task = &tasks[idx];
+        totals->files++;
+        printf("{\"path\": ");
+        _json_print_string((strlen(task->path) > totals->prefix_len) ? task->path + totals->prefix_len : ".");
+        if (task->result < 0) {
+            printf(", \"error\": ");
+            _json_print_string((task->error == EBADMSG) ? "Illegal resource format" : strerror(task->error));
+            printf("}\n");
+            totals->failed++;
+            continue;
+        }
+
+        int encrypted = task->header.is_encrypted;
+        printf(", \"size\": %llu, \"encrypted\": %s, \"pad\": %u, \"plain_size\": %llu, ", (unsigned long long)task->file_size,
+               (encrypted) ? "true" : "false", (unsigned int)task->header.pad, (unsigned long long)task->header.pt_len);
+        _print_subkey((encrypted) ? totals->subkey_len : 0);
+        printf("}\n");
+        if (encrypted) totals->encrypted++;
+        else totals->unencrypted++;
+        totals->size += task->file_size;
+        totals->plain_size += task->header.pt_len;
+    }
+    return 0;
+}
+
+/* print the header of every file below `src` and their totals as JSON lines, `key` may be NULL */
+static int _scan_path(const char* src, int is_dir, const uint8_t* key, size_t key_len, int jobs) {
+    scan_totals totals = { 0 };
+    totals.prefix_len = (is_dir) ? strlen(src) + 1 : (size_t)(strrchr(src, '/') - src) + 1;
+    if (key) {
+        uint8_t subkey[PGMMV_MAXKEYLEN];
+        totals.subkey_len = pgmmv_derive_subkey(subkey, key, key_len, 0);
+        memset(subkey, 0, sizeof(subkey));
+        if (totals.subkey_len < 0) _fail("Illegal key length");
+    }
+
+    int ret = pgmmv_scan_tree(src, jobs, _scan_report, &totals);
+    if (ret < 0 && !totals.failed) _fail("%s: %s", src, strerror(errno));
+    printf("{\"totals\": {\"files\": %zu, \"encrypted\": %zu, \"unencrypted\": %zu, \"failed\": %zu, "
+           "\"size\": %llu, \"plain_size\": %llu, ", totals.files, totals.encrypted, totals.unencrypted, totals.failed,
+           (unsigned long long)totals.size, (unsigned long long)totals.plain_size);
+    _print_subkey(totals.subkey_len);
+    printf("}}\n");
+    return (totals.failed) ? -1 : 0;
+}
+
+/* end scanning */
+
+
+/* memory */
+
+/* a byte count with an optional K, M, G or T suffix, 0 if invalid */
+static uint64_t _parse_size(const char* arg) {
+    static const char units[] = "KMGT";
+    char* end;
+    errno = 0;
+    unsigned long long num = strtoull(arg, &end, 10);
+    if (errno || end == arg || !isdigit((unsigned char)arg[0])) return 0;
+
+    int shift = 0;
+    const char* unit = (*end) ? strchr(units, toupper((unsigned char)*end)) : NULL;
+    if (unit) {
+        shift = 10 * (int)(unit - units + 1);
+        end++;
+    }
+    if (*end || num > (UINT64_MAX >> shift)) return 0;
+    return (uint64_t)num << shift;
+}
+
+static void _report_peak() {
+    /* ru_maxrss is in KiB on Linux */
+    struct rusage usage;
+    double resident = (getrusage(RUSAGE_SELF, &usage) == 0) ? (double)usage.ru_maxrss / 1024 : 0;
+    printf("Peak memory: %.1f MiB in flight, %.1f MiB resident\n", (double)pgmmv_peak_inflight(0) / (1 << 20), resident);
+}
+
+/* end memory */
+
+
+static void _usage(FILE* fp) {
+    fputs(USAGE, fp);
+}
+
+static void _help() {
+    _usage(stdout);
+    fputs(
+        "\n"
+        "Pixel Game Maker MV Decrypter\n"
+        "\n"
+        "positional arguments:\n"
+        "  input                 PGMMV resource file or directory\n"
+        "\n"
+        "options:\n"
+        "  -h, --help            show this help message and exit\n"
+        "  -o OUTPUT, --out OUTPUT\n"
+        "                        specify the output file or directory\n"
+        "  -q, --query           query the key and exit without decryption\n"
+        "  --scan                print the header of each input file and their totals as JSON lines,\n"
+        "                        without decryption\n"
+        "  -j N, --jobs N        decrypt with N threads, default to the number of CPUs\n"
+        "  -l, --link            hardlink unencrypted files instead of copying them\n"
+        "  -i, --in-place        decrypt the input files over themselves, without output\n"
+        "  --journal             journal --in-place decryption, so that an interrupted one is resumed\n"
+        "  -p, --pipeline        read, decrypt and write in separate thread stages, N being the decryption threads\n"
+        "  --drop-cache          drop inputs and outputs from the page cache once decrypted\n"
+        "  --direct              write large outputs with O_DIRECT around the page cache, implies --drop-cache\n"
+        "  --disk-order          read the files in the order they lie on disk, for spinning disks\n"
+        "  --auto-tune           try other thread counts and chunk sizes on the first files of a directory\n"
+        "                        and keep the fastest\n"
+        "  --tune-profile FILE   start from the tuning profile saved in FILE, and save the one --auto-tune\n"
+        "                        chooses to it\n"
+        "  --huge-pages          back large I/O buffers with transparent huge pages\n"
+        "  --mem-limit SIZE      keep at most SIZE bytes (K, M, G suffixes) of file data in flight,\n"
+        "                        and report the peak memory use\n"
+        "  -k KEY, --key KEY     specify the key in str type\n"
+        "  -x KEY, --hex KEY     specify the key in hex type\n",
+        stdout);
+}
+
+static void _usage_error(const char* fmt, const char* arg) {
+    _usage(stderr);
+    fprintf(stderr, PROGNAME ": error: ");
+    fprintf(stderr, fmt, arg);
+    fputc('\n', stderr);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    static const struct option longopts[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "out", required_argument, NULL, 'o' },
+        { "query", no_argument, NULL, 'q' },
+        { "scan", no_argument, NULL, 'S' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "link", no_argument, NULL, 'l' },
+        { "in-place", no_argument, NULL, 'i' },
+        { "journal", no_argument, NULL, 'J' },
+        { "pipeline", no_argument, NULL, 'p' },
+        { "drop-cache", no_argument, NULL, 'C' },
+        { "direct", no_argument, NULL, 'D' },
+        { "disk-order", no_argument, NULL, 'O' },
+        { "auto-tune", no_argument, NULL, 'A' },
+        { "tune-profile", required_argument, NULL, 'P' },
+        { "huge-pages", no_argument, NULL, 'H' },
+        { "mem-limit", required_argument, NULL, 'M' },
+        { "key", required_argument, NULL, 'k' },
+        { "hex", required_argument, NULL, 'x' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    const char* out_arg = NULL, * key_arg = NULL, * hex_arg = NULL, * tune_arg = NULL;
+    int query = 0, scan = 0, jobs = 0, flags = 0, pipeline = 0, opt;
+    uint64_t mem_limit = 0;
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, ":ho:qj:liJpk:x:", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'h': _help(); return 0;
+        case 'o': out_arg = optarg; break;
+        case 'q': query = 1; break;
+        case 'S': scan = 1; break;
+        case 'j': {
+            char* end;
+            errno = 0;
+            long num = strtol(optarg, &end, 10);
+            if (errno || end == optarg || *end || num < 1 || num > INT_MAX) {
+                _usage_error("argument -j/--jobs: invalid positive int value: '%s'", optarg);
+            }
+            jobs = (int)num;
+            break;
+        }
+        case 'l': flags |= PGMMV_LINKPLAIN; break;
+        case 'i': flags |= PGMMV_INPLACE; break;
+        case 'J': flags |= PGMMV_JOURNAL; break;
+        case 'p': pipeline = 1; break;
+        case 'C': flags |= PGMMV_DROPCACHE; break;
+        case 'D': flags |= PGMMV_DIRECT; break;
+        case 'O': flags |= PGMMV_DISKORDER; break;
+        case 'A': flags |= PGMMV_AUTOTUNE; break;
+        case 'P': tune_arg = optarg; break;
+        case 'H': pgmmv_set_hugepages(1); break;
+        case 'M':
+            mem_limit = _parse_size(optarg);
+            if (!mem_limit) _usage_error("argument --mem-limit: invalid size value: '%s'", optarg);
+            break;
+        case 'k':
+            if (hex_arg) _usage_error("argument -k/--key: not allowed with argument -x/--hex%s", "");
+            key_arg = optarg;
+            break;
+        case 'x':
+            if (key_arg) _usage_error("argument -x/--hex: not allowed with argument -k/--key%s", "");
+            hex_arg = optarg;
+            break;
+        case ':': _usage_error("argument %s: expected one argument", argv[optind - 1]);
+        default: _usage_error("unrecognized arguments: %s", argv[optind - 1]);
+        }
+    }
+    if (optind >= argc) _usage_error("the following arguments are required: input%s", "");
+    if (optind + 1 < argc) _usage_error("unrecognized arguments: %s", argv[optind + 1]);
+    if ((flags & PGMMV_INPLACE) && out_arg) _usage_error("argument -o/--out: not allowed with argument -i/--in-place%s", "");
+    if ((flags & PGMMV_JOURNAL) && !(flags & PGMMV_INPLACE)) _usage_error("argument --journal: only allowed with argument -i/--in-place%s", "");
+
+    char* input = _path_resolve(argv[optind]);
+    if (!_path_exists(input)) _fail("path not found: %s", input);
+    if (!strcmp(input, "/")) _fail("cannot use the root directory as input: %s", input);
+
+    int input_is_dir = _path_is_dir(input);
+    if (scan) {
+        /* a key only tells the subkeys, none is needed */
+        pgmmv_initialise();
+        size_t key_len = 0;
+        uint8_t* key = _get_key(key_arg, hex_arg, input, input_is_dir, &key_len);
+
+        int ret = _scan_path(input, input_is_dir, key, key_len, jobs);
+        free(key);
+        free(input);
+        return (ret < 0) ? 1 : 0;
+    }
+
+    /* decrypted in place, the input is its own output */
+    int in_place = (flags & PGMMV_INPLACE) != 0;
+    char* out = (in_place) ? strdup(input) : (out_arg) ? _path_resolve(out_arg) : _path_default_out(input);
+    if (!out) _fail("out of memory");
+    if (!in_place && !input_is_dir && !strcmp(out, input)) {
+        _fail("output cannot be the same as input: %s", out);
+    } else if (!in_place && input_is_dir && (_path_is_relative_to(out, input) || _path_is_relative_to(input, out))) {
+        _fail("output and input directories overlap: %s, %s", out, input);
+    }
+
+    pgmmv_initialise();
+
+    size_t key_len;
+    uint8_t* key = _get_key(key_arg, hex_arg, input, input_is_dir, &key_len);
+    if (!key) _fail("cannot find PGMMV key");
+
+    _print_key(key, key_len);
+    int ret = 0;
+    if (!query) {
+        if (key_len > PGMMV_MAXKEYLEN) _fail("Illegal key length");
+        printf("Processing...\n");
+        fflush(stdout);
+        pgmmv_set_max_inflight(mem_limit);
+        ret = _decrypt_path(input, out, key, key_len, jobs, flags, pipeline, tune_arg);
+        if (mem_limit) _report_peak();
+        if (ret == 0) printf("Done\n");
+    }
+
+    free(key);
+    free(out);
+    free(input);
+    return (ret < 0) ? 1 : 0;
+}
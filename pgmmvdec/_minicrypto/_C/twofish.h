@@ -1,3 +1,5 @@
+#pragma once
+
 /*
  * Fast, portable, and easy-to-use Twofish implementation,
  * Version 0.3.
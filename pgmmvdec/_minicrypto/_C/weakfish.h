@@ -1,3 +1,5 @@
+#pragma once
+
 /*
  * Implementation of PGMMV special key schedule algorithm,
  * Version 0.1.
@@ -2,6 +2,7 @@
 #include "cipher.h"
 #include "_C/twofish.h"
 #include "_C/weakfish.h"
+#include "_C/pgmmv.h"
 
 
 #define TWOFISH_MINKEYLEN   0
@@ -10,19 +11,24 @@
 
 /* initialization functions */
 
-int cipher_type_ready() {
-    PyTwofishType.tp_base = &PyCipherType;
-    PyWeakfishType.tp_base = &PyCipherType;
+static PyType_Spec PyCipherType_spec, PyTwofishType_spec, PyWeakfishType_spec;
 
-    if (PyType_Ready(&PyCipherType) < 0) return -1;
-    if (PyType_Ready(&PyTwofishType) < 0) return -1;
-    if (PyType_Ready(&PyWeakfishType) < 0) return -1;
+int cipher_add_types(PyObject* module) {
+    minicrypto_state* state = minicrypto_get_state(module);
+
+    if (minicrypto_add_type(module, &PyCipherType_spec, NULL, &state->CipherType) < 0) return -1;
+    if (minicrypto_add_type(module, &PyTwofishType_spec, state->CipherType, &state->TwofishType) < 0) return -1;
+    if (minicrypto_add_type(module, &PyWeakfishType_spec, state->CipherType, &state->WeakfishType) < 0) return -1;
     return 0;
 }
 
+static void _cipher_fatal(const char* msg) {
+    Py_FatalError(msg);
+}
+
 void cipher_initialize() {
-    Twofish_initialise();
-    Weakfish_selftest();
+    pgmmv_set_fatal_handler(_cipher_fatal);
+    pgmmv_initialise();
 }
 
 /* end initialization functions */
@@ -87,15 +93,18 @@ static PyMethodDef PyCipher_methods[] = {
 };
 
 
-PyTypeObject PyCipherType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CIPHER),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyCipherObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyCipher_new,
-    .tp_methods = PyCipher_methods,
+static PyType_Slot PyCipherType_slots[] = {
+    { Py_tp_new, PyCipher_new },
+    { Py_tp_methods, PyCipher_methods },
+    { 0, NULL }
+};
+
+static PyType_Spec PyCipherType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CIPHER),
+    .basicsize = sizeof(PyCipherObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = PyCipherType_slots,
 };
 
 /* end abstract base class Cipher */
@@ -176,16 +185,19 @@ static PyMethodDef PyTwofish_methods[] = {
 };
 
 
-PyTypeObject PyTwofishType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_TWOFISH),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyTwofishObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyTwofish_new,
-    .tp_init = (initproc)PyTwofish_init,
-    .tp_methods = PyTwofish_methods,
+static PyType_Slot PyTwofishType_slots[] = {
+    { Py_tp_new, PyTwofish_new },
+    { Py_tp_init, PyTwofish_init },
+    { Py_tp_methods, PyTwofish_methods },
+    { 0, NULL }
+};
+
+static PyType_Spec PyTwofishType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_TWOFISH),
+    .basicsize = sizeof(PyTwofishObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = PyTwofishType_slots,
 };
 
 /* end class Twofish */
@@ -240,16 +252,19 @@ static PyMethodDef PyWeakfish_methods[] = {
 };
 
 
-PyTypeObject PyWeakfishType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_WEAKFISH),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyWeakfishObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyWeakfish_new,
-    .tp_init = (initproc)PyWeakfish_init,
-    .tp_methods = PyWeakfish_methods,
+static PyType_Slot PyWeakfishType_slots[] = {
+    { Py_tp_new, PyWeakfish_new },
+    { Py_tp_init, PyWeakfish_init },
+    { Py_tp_methods, PyWeakfish_methods },
+    { 0, NULL }
+};
+
+static PyType_Spec PyWeakfishType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_WEAKFISH),
+    .basicsize = sizeof(PyWeakfishObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = PyWeakfishType_slots,
 };
 
 /* end class Weakfish */
@@ -10,14 +10,15 @@
 /* initialization funcrions */
 
 /*
- * cipher type preparation
- * MUST be called before adding types to module
+ * cipher type creation
+ * MUST be called during the module execution process
  */
-int cipher_type_ready();
+int cipher_add_types(PyObject* module);
 
 /*
  * cipher initialization function
- * MUST be called during the module initialization process
+ * MUST be called during the module execution process
+ * it is safe to be called more than once, even concurrently
  */
 void cipher_initialize();
 
@@ -35,8 +36,6 @@ struct _PyCipherObject {
     cipherproc decrypt;
 };
 
-extern PyTypeObject PyCipherType;
-
 
 /* available ciphers */
 
@@ -44,7 +43,5 @@ extern PyTypeObject PyCipherType;
 #define CLASSNAME_WEAKFISH  "Weakfish"
 
 typedef struct _PyTwofishObject PyTwofishObject;
-extern PyTypeObject PyTwofishType;
 
 typedef struct _PyWeakfishObject PyWeakfishObject;
-extern PyTypeObject PyWeakfishType;
@@ -4,11 +4,13 @@
 
 /* initialization functions */
 
-int cipher_iter_type_ready() {
-    PyCBCIterType.tp_base = &PyCipherIterType;
+static PyType_Spec PyCipherIterType_spec, PyCBCIterType_spec;
 
-    if (PyType_Ready(&PyCipherIterType) < 0) return -1;
-    if (PyType_Ready(&PyCBCIterType) < 0) return -1;
+int cipher_iter_add_types(PyObject* module) {
+    minicrypto_state* state = minicrypto_get_state(module);
+
+    if (minicrypto_add_type(module, &PyCipherIterType_spec, NULL, &state->CipherIterType) < 0) return -1;
+    if (minicrypto_add_type(module, &PyCBCIterType_spec, state->CipherIterType, &state->CBCIterType) < 0) return -1;
     return 0;
 }
 
@@ -29,6 +31,11 @@ static int _CipherIter_init(PyCipherIterObject* self, PyObject* input_iterable)
     return 0;
 }
 
+static int _CipherIter_traverse(PyCipherIterObject* self, visitproc visit, void* arg) {
+    Py_VISIT(self->input_iter);
+    return 0;
+}
+
 static void _CipherIter_clear(PyCipherIterObject* self) {
     Py_CLEAR(self->input_iter);
 }
@@ -84,16 +91,19 @@ static PyObject* PyCipherIter_iternext(PyCipherIterObject* Py_UNUSED(self)) {
 }
 
 
-PyTypeObject PyCipherIterType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CIPHERITER),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyCipherIterObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyCipherIter_new,
-    .tp_iter = (getiterfunc)PyCipherIter_iter,
-    .tp_iternext = (iternextfunc)PyCipherIter_iternext,
+static PyType_Slot PyCipherIterType_slots[] = {
+    { Py_tp_new, PyCipherIter_new },
+    { Py_tp_iter, PyCipherIter_iter },
+    { Py_tp_iternext, PyCipherIter_iternext },
+    { 0, NULL }
+};
+
+static PyType_Spec PyCipherIterType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CIPHERITER),
+    .basicsize = sizeof(PyCipherIterObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = PyCipherIterType_slots,
 };
 
 /* end abstract base class CipherIter */
@@ -140,10 +150,24 @@ static PyObject* PyCBCIter_new(PyTypeObject* type, PyObject* args, PyObject* kwd
     return (PyObject*)self;
 }
 
-static void PyCBCIter_dealloc(PyCBCIterObject* self) {
+static int PyCBCIter_traverse(PyCBCIterObject* self, visitproc visit, void* arg) {
+    Py_VISIT(Py_TYPE(self));
+    Py_VISIT(self->cipher);
+    return _CipherIter_traverse((PyCipherIterObject*)self, visit, arg);
+}
+
+static int PyCBCIter_clear(PyCBCIterObject* self) {
     _CipherIter_clear((PyCipherIterObject*)self);
     Py_CLEAR(self->cipher);
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    return 0;
+}
+
+static void PyCBCIter_dealloc(PyCBCIterObject* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    PyObject_GC_UnTrack(self);
+    PyCBCIter_clear(self);
+    type->tp_free((PyObject*)self);
+    Py_DECREF(type);
 }
 
 static int PyCBCIter_init(PyCBCIterObject* self, PyObject* args, PyObject* kwds, int is_decrypt) {
@@ -154,7 +178,13 @@ static int PyCBCIter_init(PyCBCIterObject* self, PyObject* args, PyObject* kwds,
     if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*O$O", kwlist, &cipher, &iv, &input_iterable, &_ignored)) {
         return -1;
     }
-    if (!PyObject_TypeCheck(cipher, &PyCipherType)) {
+    minicrypto_state* state = minicrypto_get_state_by_type(Py_TYPE(self));
+    if (!state) {
+        PyBuffer_Release(&iv);
+        return -1;
+    }
+    if (!PyObject_TypeCheck(cipher, state->CipherType)) {
+        PyErr_Format(PyExc_TypeError, "Argument 'cipher' must be a '%s'", CLASSNAME_CIPHER);
         PyBuffer_Release(&iv);
         return -1;
     }
@@ -183,17 +213,22 @@ static PyObject* PyCBCIter_iternext(PyCBCIterObject* self) {
 }
 
 
-PyTypeObject PyCBCIterType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CBCITER),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyCBCIterObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyCBCIter_new,
-    .tp_dealloc = (destructor)PyCBCIter_dealloc,
-    .tp_init = (initproc)PyCBCIter_init,
-    .tp_iternext = (iternextfunc)PyCBCIter_iternext,
+static PyType_Slot PyCBCIterType_slots[] = {
+    { Py_tp_new, PyCBCIter_new },
+    { Py_tp_dealloc, PyCBCIter_dealloc },
+    { Py_tp_traverse, PyCBCIter_traverse },
+    { Py_tp_clear, PyCBCIter_clear },
+    { Py_tp_init, PyCBCIter_init },
+    { Py_tp_iternext, PyCBCIter_iternext },
+    { 0, NULL }
+};
+
+static PyType_Spec PyCBCIterType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CBCITER),
+    .basicsize = sizeof(PyCBCIterObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC,
+    .slots = PyCBCIterType_slots,
 };
 
 /* end class CBCIter */
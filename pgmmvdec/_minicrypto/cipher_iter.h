@@ -9,10 +9,10 @@
 /* initialization funcrions */
 
 /*
- * cipher_iter type preparation
- * MUST be called before adding types to module
+ * cipher_iter type creation
+ * MUST be called during the module execution process
  */
-int cipher_iter_type_ready();
+int cipher_iter_add_types(PyObject* module);
 
 
 /* abstract base class CipherIter */
@@ -28,12 +28,9 @@ struct _PyCipherIterObject {
     PyObject* input_iter;
 };
 
-extern PyTypeObject PyCipherIterType;
-
 
 /* available iters of block cipher modes of operation */
 
 #define CLASSNAME_CBCITER   "CBCIter"
 
 typedef struct _PyCBCIterObject PyCBCIterObject;
-extern PyTypeObject PyCBCIterType;
@@ -4,11 +4,13 @@
 
 /* initialization functions */
 
-int cipher_mode_type_ready() {
-    PyCBCType.tp_base = &PyCipherModeType;
+static PyType_Spec PyCipherModeType_spec, PyCBCType_spec;
 
-    if (PyType_Ready(&PyCipherModeType) < 0) return -1;
-    if (PyType_Ready(&PyCBCType) < 0) return -1;
+int cipher_mode_add_types(PyObject* module) {
+    minicrypto_state* state = minicrypto_get_state(module);
+
+    if (minicrypto_add_type(module, &PyCipherModeType_spec, NULL, &state->CipherModeType) < 0) return -1;
+    if (minicrypto_add_type(module, &PyCBCType_spec, state->CipherModeType, &state->CBCType) < 0) return -1;
     return 0;
 }
 
@@ -30,7 +32,13 @@ static PyObject* _PyCipherMode_cryptoproc(PyCipherModeObject* self, PyObject* ar
     if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*", kwlist, &cipher, &data)) {
         return NULL;
     }
-    if (!PyObject_TypeCheck(cipher, &PyCipherType)) {
+    minicrypto_state* state = minicrypto_get_state_by_type(Py_TYPE(self));
+    if (!state) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    if (!PyObject_TypeCheck(cipher, state->CipherType)) {
+        PyErr_Format(PyExc_TypeError, "Argument 'cipher' must be a '%s'", CLASSNAME_CIPHER);
         PyBuffer_Release(&data);
         return NULL;
     }
@@ -40,24 +48,13 @@ static PyObject* _PyCipherMode_cryptoproc(PyCipherModeObject* self, PyObject* ar
         return NULL;
     }
 
-    size_t len = data.len;
-    uint8_t* buffer = (uint8_t*)malloc(len * 2);
-    if (!buffer) {
-        PyBuffer_Release(&data);
-        return PyErr_NoMemory();
-    }
-    if (PyBuffer_ToContiguous(buffer, &data, len, 'C') < 0) {
-        PyBuffer_Release(&data);
-        free(buffer);
-        return NULL;
+    /* `data` is contiguous, it is processed straight into the result */
+    PyObject* result = PyBytes_FromStringAndSize(NULL, data.len);
+    if (result) {
+        ciphermodeproc proc = (is_decrypt) ? self->decrypt : self->encrypt;
+        proc(self, (PyCipherObject*)cipher, (uint8_t*)PyBytes_AS_STRING(result), (uint8_t*)data.buf, (size_t)data.len);
     }
     PyBuffer_Release(&data);
-
-    ciphermodeproc proc = (is_decrypt) ? self->decrypt : self->encrypt;
-    proc(self, (PyCipherObject*)cipher, buffer + len, buffer, len);
-
-    PyObject* result = PyBytes_FromStringAndSize(buffer + len, len);
-    free(buffer);
     return result;
 }
 
@@ -88,15 +85,18 @@ static PyMethodDef PyCipherMode_methods[] = {
 };
 
 
-PyTypeObject PyCipherModeType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CIPHERMODE),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyCipherModeObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyCipherMode_new,
-    .tp_methods = PyCipherMode_methods,
+static PyType_Slot PyCipherModeType_slots[] = {
+    { Py_tp_new, PyCipherMode_new },
+    { Py_tp_methods, PyCipherMode_methods },
+    { 0, NULL }
+};
+
+static PyType_Spec PyCipherModeType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CIPHERMODE),
+    .basicsize = sizeof(PyCipherModeObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = PyCipherModeType_slots,
 };
 
 /* end abstract base class CipherMode */
@@ -181,16 +181,19 @@ static PyMethodDef PyCBC_methods[] = {
 };
 
 
-PyTypeObject PyCBCType = {
-    .ob_base = PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CBC),
-    .tp_doc = NULL,
-    .tp_basicsize = sizeof(PyCBCObject),
-    .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    .tp_new = PyCBC_new,
-    .tp_init = (initproc)PyCBC_init,
-    .tp_methods = PyCBC_methods,
+static PyType_Slot PyCBCType_slots[] = {
+    { Py_tp_new, PyCBC_new },
+    { Py_tp_init, PyCBC_init },
+    { Py_tp_methods, PyCBC_methods },
+    { 0, NULL }
+};
+
+static PyType_Spec PyCBCType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_CBC),
+    .basicsize = sizeof(PyCBCObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .slots = PyCBCType_slots,
 };
 
 /* end class CBC */
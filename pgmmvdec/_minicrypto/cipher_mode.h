@@ -9,10 +9,10 @@
 /* initialization funcrions */
 
 /*
- * cipher_mode type preparation
- * MUST be called before adding types to module
+ * cipher_mode type creation
+ * MUST be called during the module execution process
  */
-int cipher_mode_type_ready();
+int cipher_mode_add_types(PyObject* module);
 
 
 /* abstract base class CipherMode */
@@ -28,12 +28,9 @@ struct _PyCipherModeObject {
     ciphermodeproc decrypt;
 };
 
-extern PyTypeObject PyCipherModeType;
-
 
 /* available block cipher modes of operation */
 
 #define CLASSNAME_CBC   "CBC"
 
 typedef struct _PyCBCObject PyCBCObject;
-extern PyTypeObject PyCBCType;
@@ -1,10 +1,11 @@
-#define PY_SSIZE_T_CLEAN
-#include <Python.h>
-
 #include "minicrypto.h"
 #include "cipher.h"
 #include "cipher_iter.h"
 #include "cipher_mode.h"
+#include "resource.h"
+#include "resource_async.h"
+#include "resource_file.h"
+#include "minicrypto_capi.h"
 
 
 /* general functions */
@@ -74,49 +75,124 @@ static PyMethodDef Py_minicrypto_methods[] = {
     { NULL }
 };
 
+/* end module _minicrypto */
 
-static PyModuleDef Py_minicrypto_module = {
-    .m_base = PyModuleDef_HEAD_INIT,
-    .m_name = MODULENAME__MINICRYPTO,
-    .m_doc = NULL,
-    .m_size = -1,
-    .m_methods = Py_minicrypto_methods,
+
+/* module state */
+
+minicrypto_state* minicrypto_get_state(PyObject* module) {
+    return (minicrypto_state*)PyModule_GetState(module);
+}
+
+minicrypto_state* minicrypto_get_state_by_type(PyTypeObject* type) {
+    PyObject* mod = PyType_GetModuleByDef(type, &Py_minicrypto_module);
+    return (mod) ? minicrypto_get_state(mod) : NULL;
+}
+
+int minicrypto_add_type(PyObject* module, PyType_Spec* spec, PyTypeObject* base, PyTypeObject** ptype) {
+    PyTypeObject* type = (PyTypeObject*)PyType_FromModuleAndSpec(module, spec, (PyObject*)base);
+    if (!type) return -1;
+    *ptype = type;
+    return PyModule_AddType(module, type);
+}
+
+static int Py_minicrypto_traverse(PyObject* module, visitproc visit, void* arg) {
+    minicrypto_state* state = minicrypto_get_state(module);
+    Py_VISIT(state->CipherType);
+    Py_VISIT(state->TwofishType);
+    Py_VISIT(state->WeakfishType);
+    Py_VISIT(state->CipherIterType);
+    Py_VISIT(state->CBCIterType);
+    Py_VISIT(state->CipherModeType);
+    Py_VISIT(state->CBCType);
+    Py_VISIT(state->AsyncQueueType);
+    Py_VISIT(state->DecryptedFileType);
+    return 0;
+}
+
+static int Py_minicrypto_clear(PyObject* module) {
+    minicrypto_state* state = minicrypto_get_state(module);
+    Py_CLEAR(state->CipherType);
+    Py_CLEAR(state->TwofishType);
+    Py_CLEAR(state->WeakfishType);
+    Py_CLEAR(state->CipherIterType);
+    Py_CLEAR(state->CBCIterType);
+    Py_CLEAR(state->CipherModeType);
+    Py_CLEAR(state->CBCType);
+    Py_CLEAR(state->AsyncQueueType);
+    Py_CLEAR(state->DecryptedFileType);
+    return 0;
+}
+
+static void Py_minicrypto_free(void* module) {
+    Py_minicrypto_clear((PyObject*)module);
+}
+
+/* end module state */
+
+
+/* C API */
+
+static const minicrypto_CAPI Py_minicrypto_capi = {
+    .version = MINICRYPTO_CAPI_VERSION,
+    .size = sizeof(minicrypto_CAPI),
+    .decrypt_key = pgmmv_decrypt_key,
+    .derive_subkey = pgmmv_derive_subkey,
+    .prepare_key = pgmmv_prepare_key,
+    .cbc_decrypt = pgmmv_cbc_decrypt,
+    .parse_header = pgmmv_parse_header,
+    .decrypt_resource = pgmmv_decrypt_resource,
+    .decrypt_prefix = pgmmv_decrypt_prefix,
 };
 
-/* end module _minicrypto */
+static int minicrypto_add_capi(PyObject* module) {
+    PyObject* capsule = PyCapsule_New((void*)&Py_minicrypto_capi, MINICRYPTO_CAPI_CAPSULENAME, NULL);
+    if (!capsule) return -1;
+    int ret = PyModule_AddObjectRef(module, "_C_API", capsule);
+    Py_DECREF(capsule);
+    return ret;
+}
 
+/* end C API */
 
-typedef struct _PyTypeList {
-    const char* name;
-    PyTypeObject* type;
-} PyTypeList;
 
+/* module initialization */
 
-static PyTypeList typelist[] = {
-    { CLASSNAME_CIPHER, &PyCipherType },
-    { CLASSNAME_TWOFISH, &PyTwofishType },
-    { CLASSNAME_WEAKFISH, &PyWeakfishType },
-    { CLASSNAME_CIPHERITER, &PyCipherIterType },
-    { CLASSNAME_CBCITER, &PyCBCIterType },
-    { CLASSNAME_CIPHERMODE, &PyCipherModeType },
-    { CLASSNAME_CBC, &PyCBCType },
-    { NULL }
+static int Py_minicrypto_exec(PyObject* module) {
+    if (cipher_add_types(module) < 0) return -1;
+    if (cipher_iter_add_types(module) < 0) return -1;
+    if (cipher_mode_add_types(module) < 0) return -1;
+    if (resource_add_functions(module) < 0) return -1;
+    if (resource_async_add_types(module) < 0) return -1;
+    if (resource_file_add_types(module) < 0) return -1;
+    if (minicrypto_add_capi(module) < 0) return -1;
+    cipher_initialize();
+    return 0;
+}
+
+static PyModuleDef_Slot Py_minicrypto_slots[] = {
+    { Py_mod_exec, Py_minicrypto_exec },
+#ifdef Py_mod_multiple_interpreters
+    { Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+    { 0, NULL }
 };
 
+PyModuleDef Py_minicrypto_module = {
+    .m_base = PyModuleDef_HEAD_INIT,
+    .m_name = MODULENAME__MINICRYPTO,
+    .m_doc = NULL,
+    .m_size = sizeof(minicrypto_state),
+    .m_methods = Py_minicrypto_methods,
+    .m_slots = Py_minicrypto_slots,
+    .m_traverse = Py_minicrypto_traverse,
+    .m_clear = Py_minicrypto_clear,
+    .m_free = Py_minicrypto_free,
+};
+
+/* end module initialization */
+
+
 PyMODINIT_FUNC PyInit__minicrypto() {
-    cipher_type_ready();
-    cipher_iter_type_ready();
-    cipher_mode_type_ready();
-
-    PyObject* mod = PyModule_Create(&Py_minicrypto_module);
-    if (mod) {
-        for (size_t idx = 0; typelist[idx].name; idx++) {
-            if (PyModule_AddObjectRef(mod, typelist[idx].name, (PyObject*)typelist[idx].type) < 0) {
-                Py_DECREF(mod);
-                return NULL;
-            }
-        }
-        cipher_initialize();
-    }
-    return mod;
+    return PyModuleDef_Init(&Py_minicrypto_module);
 }
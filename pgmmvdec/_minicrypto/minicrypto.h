@@ -1,5 +1,8 @@
 #pragma once
 
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
 #include <stdint.h>
 #include <stddef.h>
 
@@ -11,3 +14,37 @@
 /* general functions */
 
 void minicrypto_xor_bytes(uint8_t* ret, uint8_t* ba, uint8_t* bb, size_t len);
+
+
+/* module state */
+
+typedef struct _minicrypto_state {
+    PyTypeObject* CipherType;
+    PyTypeObject* TwofishType;
+    PyTypeObject* WeakfishType;
+    PyTypeObject* CipherIterType;
+    PyTypeObject* CBCIterType;
+    PyTypeObject* CipherModeType;
+    PyTypeObject* CBCType;
+    PyTypeObject* AsyncQueueType;
+    PyTypeObject* DecryptedFileType;
+} minicrypto_state;
+
+extern PyModuleDef Py_minicrypto_module;
+
+/*
+ * get the state of a _minicrypto module object
+ */
+minicrypto_state* minicrypto_get_state(PyObject* module);
+
+/*
+ * get the state of the _minicrypto module which defines `type` or one of its bases
+ * return NULL and set an exception on failure
+ */
+minicrypto_state* minicrypto_get_state_by_type(PyTypeObject* type);
+
+/*
+ * create a heap type from `spec` with an optional `base`,
+ * store it into `*ptype` and add it to `module`
+ */
+int minicrypto_add_type(PyObject* module, PyType_Spec* spec, PyTypeObject* base, PyTypeObject** ptype);
@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * C API of _minicrypto for other extension modules
+ *
+ * the function table is exported as the capsule `pgmmvdec._minicrypto._C_API`,
+ * import it once with `minicrypto_capi_import()` while holding the GIL,
+ * every function in it is pure C and may be called without the GIL from any thread
+ *
+ * new functions are only ever appended, check `version` before using them
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "_C/pgmmv.h"
+
+
+#define MINICRYPTO_CAPI_CAPSULENAME     "pgmmvdec._minicrypto._C_API"
+#define MINICRYPTO_CAPI_VERSION         2
+
+
+typedef struct _minicrypto_CAPI {
+    unsigned int version;
+    size_t size;        /* sizeof(minicrypto_CAPI) of the exporting module */
+
+    /* version 1 */
+    int (*decrypt_key)(uint8_t* dst, const uint8_t* src, size_t len);
+    int (*derive_subkey)(uint8_t subkey[PGMMV_MAXKEYLEN], const uint8_t* key, size_t key_len, uint64_t pt_len);
+    int (*prepare_key)(pgmmv_cipher* cipher, const uint8_t* key, size_t key_len, uint64_t pt_len);
+    int (*cbc_decrypt)(const pgmmv_cipher* cipher, uint8_t iv[PGMMV_BLOCKSIZE], uint8_t* dst, const uint8_t* src, size_t len);
+    int (*parse_header)(pgmmv_header* header, const uint8_t* head, size_t head_len, uint64_t file_size);
+    int64_t (*decrypt_resource)(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* key, size_t key_len);
+
+    /* version 2 */
+    int64_t (*decrypt_prefix)(uint8_t* dst, size_t n, const uint8_t* src, size_t len, const uint8_t* key, size_t key_len);
+} minicrypto_CAPI;
+
+
+/*
+ * import the C API table, which stays valid as long as _minicrypto is loaded
+ * return NULL and set an exception on failure
+ */
+static inline const minicrypto_CAPI* minicrypto_capi_import() {
+    const minicrypto_CAPI* capi = (const minicrypto_CAPI*)PyCapsule_Import(MINICRYPTO_CAPI_CAPSULENAME, 0);
+    if (capi && capi->version < MINICRYPTO_CAPI_VERSION) {
+        PyErr_Format(PyExc_ImportError, "_minicrypto C API version %u is older than %u", capi->version, MINICRYPTO_CAPI_VERSION);
+        return NULL;
+    }
+    return capi;
+}
@@ -0,0 +1,683 @@
+#include "minicrypto.h"
+#include "resource.h"
+#include "_C/pgmmv.h"
+
+
+/* shared operations of resource functions */
+
+int resource_check_key(Py_buffer* key) {
+    if (key->len > PGMMV_MAXKEYLEN) {
+        PyErr_SetString(PyExc_ValueError, "Illegal key length");
+        return -1;
+    }
+    return 0;
+}
+
+/* None means one thread per CPU, which the library spells as 0 */
+int resource_parse_threads(PyObject* threads_obj, const char* name) {
+    if (threads_obj == Py_None) return 0;
+
+    int overflow;
+    long threads = PyLong_AsLongAndOverflow(threads_obj, &overflow);
+    if (threads == -1 && PyErr_Occurred()) return -1;
+    if (overflow || threads < 1 || threads > INT_MAX) {
+        PyErr_Format(PyExc_ValueError, "Argument '%s' must be a positive integer or None", name);
+        return -1;
+    }
+    return (int)threads;
+}
+
+Py_ssize_t resource_parse_size(PyObject* size_obj, const char* name) {
+    if (size_obj == Py_None) return 0;
+
+    Py_ssize_t size = PyNumber_AsSsize_t(size_obj, NULL);
+    if (size == -1 && PyErr_Occurred()) return -1;
+    if (size < 1) {
+        PyErr_Format(PyExc_ValueError, "Argument '%s' must be a positive integer or None", name);
+        return -1;
+    }
+    return size;
+}
+
+void resource_set_error(int err, const char* file, const char* out) {
+    PyObject* fileobj = (file) ? PyUnicode_DecodeFSDefault(file) : NULL;
+    if (file && !fileobj) return;
+
+    /* a malformed resource names its file, as the native command line does */
+    if (err == EBADMSG) {
+        if (fileobj) PyErr_Format(PyExc_ValueError, "%U: Illegal resource format", fileobj);
+        else PyErr_SetString(PyExc_ValueError, "Illegal resource format");
+        Py_XDECREF(fileobj);
+        return;
+    }
+
+    PyObject* outobj = (out) ? PyUnicode_DecodeFSDefault(out) : NULL;
+    errno = err;
+    PyErr_SetFromErrnoWithFilenameObjects(PyExc_OSError, fileobj, outobj);
+    Py_XDECREF(fileobj);
+    Py_XDECREF(outobj);
+}
+
+/* note the files cancelled after a failure on the exception raised for it */
+static void _resource_note_cancelled(size_t cancelled) {
+    if (!cancelled) return;
+#if PY_VERSION_HEX >= 0x030C0000
+    PyObject* value = PyErr_GetRaisedException();
+#else
+    PyObject* type, * value, * traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (traceback) PyException_SetTraceback(value, traceback);
+    Py_XDECREF(type);
+    Py_XDECREF(traceback);
+#endif
+    /* the failure itself is raised even if its note cannot be added */
+    PyObject* note = PyUnicode_FromFormat("aborted, %zu files not decrypted", cancelled);
+    PyObject* ret = (note) ? PyObject_CallMethod(value, "add_note", "O", note) : NULL;
+    if (!ret) PyErr_Clear();
+    Py_XDECREF(ret);
+    Py_XDECREF(note);
+#if PY_VERSION_HEX >= 0x030C0000
+    PyErr_SetRaisedException(value);
+#else
+    PyErr_Restore(Py_NewRef(Py_TYPE(value)), value, PyException_GetTraceback(value));
+#endif
+}
+
+/* end shared operations of resource functions */
+
+
+/* resource functions */
+
+static PyObject* Py_resource_decrypt_key(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "encrypted_key", NULL };
+
+    Py_buffer enckey;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*", kwlist, &enckey)) {
+        return NULL;
+    }
+    if (enckey.len % PGMMV_BLOCKSIZE) {
+        PyErr_Format(PyExc_ValueError, "Length of data must be divisible by %d", PGMMV_BLOCKSIZE);
+        PyBuffer_Release(&enckey);
+        return NULL;
+    }
+
+    PyObject* result = PyBytes_FromStringAndSize(NULL, enckey.len);
+    if (result) {
+        pgmmv_decrypt_key((uint8_t*)PyBytes_AS_STRING(result), enckey.buf, enckey.len);
+    }
+    PyBuffer_Release(&enckey);
+    return result;
+}
+
+static PyObject* Py_resource_derive_subkey(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "key", "plaintext_len", NULL };
+
+    Py_buffer key;
+    PyObject* pt_len_obj;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*O!", kwlist, &key, &PyLong_Type, &pt_len_obj)) {
+        return NULL;
+    }
+    unsigned long long pt_len = PyLong_AsUnsignedLongLong(pt_len_obj);
+    if (PyErr_Occurred() || resource_check_key(&key) < 0) {
+        PyBuffer_Release(&key);
+        return NULL;
+    }
+
+    uint8_t subkey[PGMMV_MAXKEYLEN];
+    int subkey_len = pgmmv_derive_subkey(subkey, key.buf, key.len, pt_len);
+    PyBuffer_Release(&key);
+    return PyBytes_FromStringAndSize((const char*)subkey, subkey_len);
+}
+
+static PyObject* Py_resource_decrypt_resource_bytes(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file_bytes", "key", NULL };
+
+    Py_buffer data, key;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*y*", kwlist, &data, &key)) {
+        return NULL;
+    }
+
+    pgmmv_header header;
+    PyObject* result = NULL;
+    if (resource_check_key(&key) < 0) goto finally;
+    if (pgmmv_parse_header(&header, data.buf, data.len, data.len) < 0) {
+        resource_set_error(errno, NULL, NULL);
+        goto finally;
+    }
+
+    result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)header.pt_len);
+    if (!result) goto finally;
+
+    Py_BEGIN_ALLOW_THREADS
+    pgmmv_decrypt_resource((uint8_t*)PyBytes_AS_STRING(result), data.buf, data.len, key.buf, key.len);
+    Py_END_ALLOW_THREADS
+
+finally:
+    PyBuffer_Release(&data);
+    PyBuffer_Release(&key);
+    return result;
+}
+
+/* the whole resource in memory, decrypted up to `n` bytes */
+static PyObject* _resource_decrypt_bytes_prefix(Py_buffer* data, Py_buffer* key, Py_ssize_t n) {
+    pgmmv_header header;
+    if (pgmmv_parse_header(&header, data->buf, data->len, data->len) < 0) {
+        resource_set_error(errno, NULL, NULL);
+        return NULL;
+    }
+
+    PyObject* result = PyBytes_FromStringAndSize(NULL, ((uint64_t)n < header.pt_len) ? n : (Py_ssize_t)header.pt_len);
+    if (!result) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    pgmmv_decrypt_prefix((uint8_t*)PyBytes_AS_STRING(result), (size_t)n, data->buf, data->len, key->buf, key->len);
+    Py_END_ALLOW_THREADS
+    return result;
+}
+
+/* a resource file, of which only the header and the blocks up to `n` bytes are read */
+static PyObject* _resource_decrypt_file_prefix(PyObject* path, Py_buffer* key, Py_ssize_t n) {
+    pgmmv_reader* reader;
+    Py_BEGIN_ALLOW_THREADS
+    reader = pgmmv_reader_open(PyBytes_AS_STRING(path), key->buf, key->len, PGMMV_BLOCKSIZE);
+    Py_END_ALLOW_THREADS
+    if (!reader) {
+        resource_set_error(errno, PyBytes_AS_STRING(path), NULL);
+        return NULL;
+    }
+
+    uint64_t pt_len = pgmmv_reader_size(reader);
+    PyObject* result = PyBytes_FromStringAndSize(NULL, ((uint64_t)n < pt_len) ? n : (Py_ssize_t)pt_len);
+    int64_t got = -1;
+    if (result) {
+        Py_BEGIN_ALLOW_THREADS
+        got = pgmmv_reader_pread(reader, PyBytes_AS_STRING(result), (size_t)PyBytes_GET_SIZE(result), 0);
+        Py_END_ALLOW_THREADS
+        if (got < 0) {
+            resource_set_error(errno, PyBytes_AS_STRING(path), NULL);
+            Py_CLEAR(result);
+        }
+    }
+    pgmmv_reader_close(reader);
+    return result;
+}
+
+static PyObject* Py_resource_decrypt_resource_prefix(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file", "key", "n", NULL };
+
+    PyObject* file;
+    Py_buffer key;
+    Py_ssize_t n;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*n", kwlist, &file, &key, &n)) {
+        return NULL;
+    }
+
+    /* bytes-like objects hold the resource, anything else names its file */
+    PyObject* result = NULL;
+    if (n < 0) {
+        PyErr_SetString(PyExc_ValueError, "Argument 'n' must not be negative");
+    } else if (resource_check_key(&key) == 0 && PyObject_CheckBuffer(file)) {
+        Py_buffer data;
+        if (PyObject_GetBuffer(file, &data, PyBUF_SIMPLE) == 0) {
+            result = _resource_decrypt_bytes_prefix(&data, &key, n);
+            PyBuffer_Release(&data);
+        }
+    } else if (!PyErr_Occurred()) {
+        PyObject* path;
+        if (PyUnicode_FSConverter(file, &path)) {
+            result = _resource_decrypt_file_prefix(path, &key, n);
+            Py_DECREF(path);
+        }
+    }
+    PyBuffer_Release(&key);
+    return result;
+}
+
+static PyObject* Py_resource_decrypt_resource_file(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file", "out", "key", "buffer_size", "drop_cache", "direct", NULL };
+
+    PyObject* file, * out, * buffer_size_obj = Py_None;
+    Py_buffer key;
+    int drop_cache = 0, direct = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&y*|$Opp", kwlist, PyUnicode_FSConverter, &file, PyUnicode_FSConverter, &out,
+                                     &key, &buffer_size_obj, &drop_cache, &direct)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    Py_ssize_t buffer_size = resource_parse_size(buffer_size_obj, "buffer_size");
+    if (buffer_size < 0 || resource_check_key(&key) < 0) goto finally;
+
+    /* a buffer size asks for bounded memory, mappings of large files are left to the kernel otherwise */
+    int64_t pt_len;
+    int flags = ((drop_cache) ? PGMMV_DROPCACHE : 0) | ((direct) ? PGMMV_DIRECT : 0);
+    Py_BEGIN_ALLOW_THREADS
+    if (buffer_size_obj != Py_None) {
+        pt_len = pgmmv_decrypt_file_stream(PyBytes_AS_STRING(file), PyBytes_AS_STRING(out), key.buf, key.len, (size_t)buffer_size, flags);
+    } else {
+        pt_len = pgmmv_decrypt_file_ex(PyBytes_AS_STRING(file), PyBytes_AS_STRING(out), key.buf, key.len, flags);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (pt_len < 0) resource_set_error(errno, PyBytes_AS_STRING(file), PyBytes_AS_STRING(out));
+    else result = PyLong_FromLongLong(pt_len);
+
+finally:
+    Py_DECREF(file);
+    Py_DECREF(out);
+    PyBuffer_Release(&key);
+    return result;
+}
+
+static PyObject* Py_resource_decrypt_resource_file_inplace(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "path", "key", "journal", "drop_cache", NULL };
+
+    PyObject* path;
+    Py_buffer key;
+    int journal = 0, drop_cache = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&y*|$pp", kwlist, PyUnicode_FSConverter, &path, &key, &journal, &drop_cache)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    if (resource_check_key(&key) < 0) goto finally;
+
+    int64_t pt_len;
+    int flags = ((journal) ? PGMMV_JOURNAL : 0) | ((drop_cache) ? PGMMV_DROPCACHE : 0);
+    Py_BEGIN_ALLOW_THREADS
+    pt_len = pgmmv_decrypt_file_inplace(PyBytes_AS_STRING(path), key.buf, key.len, flags);
+    Py_END_ALLOW_THREADS
+
+    if (pt_len < 0) resource_set_error(errno, PyBytes_AS_STRING(path), NULL);
+    else result = PyLong_FromLongLong(pt_len);
+
+finally:
+    Py_DECREF(path);
+    PyBuffer_Release(&key);
+    return result;
+}
+
+static PyObject* Py_resource_decrypt_resource_batch(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "buffers", "key", "threads", NULL };
+
+    PyObject* buffers, * threads_obj = Py_None;
+    Py_buffer key;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*|$O", kwlist, &buffers, &key, &threads_obj)) {
+        return NULL;
+    }
+
+    int threads = resource_parse_threads(threads_obj, "threads");
+    PyObject* seq = PySequence_Fast(buffers, "Argument 'buffers' must be a sequence");
+    if (threads < 0 || !seq || resource_check_key(&key) < 0) {
+        Py_XDECREF(seq);
+        PyBuffer_Release(&key);
+        return NULL;
+    }
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq), acquired = 0;
+    Py_buffer* views = PyMem_Calloc(count ? count : 1, sizeof(Py_buffer));
+    pgmmv_buffer_task* tasks = PyMem_Calloc(count ? count : 1, sizeof(pgmmv_buffer_task));
+    PyObject* result = PyList_New(count);
+    if (!views || !tasks) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    if (!result) goto error;
+
+    /* size every output up front, the workers only fill them */
+    for (; acquired < count; acquired++) {
+        Py_buffer* view = &views[acquired];
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, acquired), view, PyBUF_SIMPLE) < 0) goto error;
+
+        pgmmv_header header;
+        if (pgmmv_parse_header(&header, view->buf, view->len, view->len) < 0) {
+            PyErr_Format(PyExc_ValueError, "Illegal resource format at index %zd", acquired);
+            acquired++;
+            goto error;
+        }
+
+        PyObject* out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)header.pt_len);
+        if (!out) {
+            acquired++;
+            goto error;
+        }
+        PyList_SET_ITEM(result, acquired, out);
+        tasks[acquired] = (pgmmv_buffer_task){ .src = view->buf, .src_len = view->len, .dst = (uint8_t*)PyBytes_AS_STRING(out) };
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    pgmmv_decrypt_buffers(tasks, count, key.buf, key.len, threads);
+    Py_END_ALLOW_THREADS
+    goto finally;
+
+error:
+    Py_CLEAR(result);
+finally:
+    for (Py_ssize_t idx = 0; idx < acquired; idx++) PyBuffer_Release(&views[idx]);
+    PyMem_Free(views);
+    PyMem_Free(tasks);
+    Py_DECREF(seq);
+    PyBuffer_Release(&key);
+    return result;
+}
+
+static PyObject* Py_resource_decrypt_many(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {
+        "pairs", "key", "threads", "link_plain", "in_place", "journal", "pipeline", "readers", "writers", "drop_cache", "direct",
+        "disk_order", "fail_fast", NULL
+    };
+
+    PyObject* pairs, * threads_obj = Py_None, * readers_obj = Py_None, * writers_obj = Py_None;
+    Py_buffer key;
+    int link_plain = 0, in_place = 0, journal = 0, pipeline = 0, drop_cache = 0, direct = 0, disk_order = 0, fail_fast = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oy*|$OppppOOpppp", kwlist, &pairs, &key, &threads_obj, &link_plain, &in_place, &journal,
+                                     &pipeline, &readers_obj, &writers_obj, &drop_cache, &direct, &disk_order, &fail_fast)) {
+        return NULL;
+    }
+
+    /* with a pipeline, `threads` sizes the decryption stage */
+    pgmmv_pipeline_config config = { 0 };
+    config.decrypters = resource_parse_threads(threads_obj, "threads");
+    config.readers = (config.decrypters < 0) ? -1 : resource_parse_threads(readers_obj, "readers");
+    config.writers = (config.readers < 0) ? -1 : resource_parse_threads(writers_obj, "writers");
+    PyObject* seq = (config.writers < 0) ? NULL : PySequence_Fast(pairs, "Argument 'pairs' must be a sequence");
+    if (!seq || resource_check_key(&key) < 0) {
+        Py_XDECREF(seq);
+        PyBuffer_Release(&key);
+        return NULL;
+    }
+
+    /* paths are converted up front, two per pair */
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq), converted = 0;
+    PyObject** paths = PyMem_Calloc(count ? count * 2 : 1, sizeof(PyObject*));
+    pgmmv_file_task* tasks = PyMem_Calloc(count ? count : 1, sizeof(pgmmv_file_task));
+    PyObject* result = NULL;
+    if (!paths || !tasks) {
+        PyErr_NoMemory();
+        goto finally;
+    }
+
+    for (; converted < count; converted++) {
+        PyObject* pair = PySequence_Fast_GET_ITEM(seq, converted);
+        PyObject** path = &paths[converted * 2];
+        if (!PyTuple_Check(pair) || PyTuple_GET_SIZE(pair) != 2) {
+            PyErr_Format(PyExc_TypeError, "Item %zd of 'pairs' must be a (file, out) tuple", converted);
+            goto finally;
+        }
+        if (!PyUnicode_FSConverter(PyTuple_GET_ITEM(pair, 0), &path[0])) goto finally;
+        if (!PyUnicode_FSConverter(PyTuple_GET_ITEM(pair, 1), &path[1])) goto finally;
+        tasks[converted] = (pgmmv_file_task){ .src = PyBytes_AS_STRING(path[0]), .dst = PyBytes_AS_STRING(path[1]) };
+    }
+
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    int flags = ((link_plain) ? PGMMV_LINKPLAIN : 0) | ((in_place) ? PGMMV_INPLACE : 0) | ((journal) ? PGMMV_JOURNAL : 0)
+                | ((drop_cache) ? PGMMV_DROPCACHE : 0) | ((direct) ? PGMMV_DIRECT : 0) | ((disk_order) ? PGMMV_DISKORDER : 0)
+                | ((fail_fast) ? PGMMV_FAILFAST : 0);
+    if (pipeline) ret = pgmmv_decrypt_files_pipeline(tasks, count, key.buf, key.len, &config, flags);
+    else ret = pgmmv_decrypt_files_ex(tasks, count, key.buf, key.len, config.decrypters, flags);
+    Py_END_ALLOW_THREADS
+
+    /* every file has been tried, or cancelled with fail_fast, report the first failure in input order */
+    if (ret < 0) {
+        const pgmmv_file_task* failed = NULL;
+        size_t cancelled = 0;
+        for (Py_ssize_t idx = 0; idx < count; idx++) {
+            if (tasks[idx].result >= 0) continue;
+            if (tasks[idx].error == ECANCELED) cancelled++;
+            else if (!failed) failed = &tasks[idx];
+        }
+        if (failed) resource_set_error(failed->error, failed->src, failed->dst);
+        else resource_set_error(errno, NULL, NULL);
+        _resource_note_cancelled(cancelled);
+        goto finally;
+    }
+
+    result = PyList_New(count);
+    for (Py_ssize_t idx = 0; result && idx < count; idx++) {
+        PyObject* pt_len = PyLong_FromLongLong(tasks[idx].result);
+        if (!pt_len) Py_CLEAR(result);
+        else PyList_SET_ITEM(result, idx, pt_len);
+    }
+
+finally:
+    for (Py_ssize_t idx = 0; paths && idx < count * 2; idx++) Py_XDECREF(paths[idx]);
+    PyMem_Free(paths);
+    PyMem_Free(tasks);
+    Py_DECREF(seq);
+    PyBuffer_Release(&key);
+    return result;
+}
+
+/*
+ * first failure met while walking, its paths are copied as the batch is freed afterwards
+ * with fail_fast, the files cancelled after it are counted
+ */
+typedef struct _resource_tree_result {
+    size_t count;
+    size_t cancelled;
+    int fail_fast;
+    int error;
+    char* src;
+    char* dst;
+} resource_tree_result;
+
+static int _resource_tree_done(const pgmmv_file_task* tasks, size_t count, void* ctx) {
+    resource_tree_result* result = (resource_tree_result*)ctx;
+    for (size_t idx = 0; idx < count; idx++) {
+        if (tasks[idx].result >= 0) {
+            result->count++;
+            continue;
+        }
+        if (result->fail_fast && tasks[idx].error == ECANCELED) {
+            result->cancelled++;
+            continue;
+        }
+        if (result->error) continue;
+        result->error = tasks[idx].error;
+        result->src = (tasks[idx].src) ? strdup(tasks[idx].src) : NULL;
+        result->dst = (tasks[idx].dst) ? strdup(tasks[idx].dst) : NULL;
+        /* without fail_fast the walk is stopped here, with it libpgmmv stops and reports the rest as cancelled */
+        if (!result->fail_fast) return 1;
+    }
+    return 0;
+}
+
+static PyObject* Py_resource_decrypt_tree(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {
+        "src", "dst", "key", "threads", "link_plain", "in_place", "journal", "pipeline", "readers", "writers", "drop_cache", "direct",
+        "disk_order", "auto_tune", "tune_profile", "fail_fast", NULL
+    };
+
+    PyObject* src, * dst, * threads_obj = Py_None, * readers_obj = Py_None, * writers_obj = Py_None, * profile_obj = Py_None;
+    Py_buffer key;
+    int link_plain = 0, in_place = 0, journal = 0, pipeline = 0, drop_cache = 0, direct = 0, disk_order = 0, auto_tune = 0;
+    int fail_fast = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&y*|$OppppOOppppOp", kwlist, PyUnicode_FSConverter, &src, PyUnicode_FSConverter,
+                                     &dst, &key, &threads_obj, &link_plain, &in_place, &journal, &pipeline, &readers_obj, &writers_obj,
+                                     &drop_cache, &direct, &disk_order, &auto_tune, &profile_obj, &fail_fast)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL, * profile_path = NULL;
+    pgmmv_pipeline_config config = { 0 };
+    config.decrypters = resource_parse_threads(threads_obj, "threads");
+    config.readers = (config.decrypters < 0) ? -1 : resource_parse_threads(readers_obj, "readers");
+    config.writers = (config.readers < 0) ? -1 : resource_parse_threads(writers_obj, "writers");
+    if (config.writers < 0 || resource_check_key(&key) < 0) goto finally;
+    if (profile_obj != Py_None && !PyUnicode_FSConverter(profile_obj, &profile_path)) goto finally;
+
+    /* a profile saved for the host goes first, explicit threads override it */
+    pgmmv_tune_profile profile = { .threads = config.decrypters };
+    if (profile_path && pgmmv_tune_load(&profile, PyBytes_AS_STRING(profile_path)) < 0 && errno != ENOENT) {
+        resource_set_error(errno, PyBytes_AS_STRING(profile_path), NULL);
+        goto finally;
+    }
+    if (config.decrypters) profile.threads = config.decrypters;
+
+    /* every file of a batch is tried, the walk stops after the first batch with a failure, with fail_fast no file is started after it */
+    int ret, saved = 0;
+    resource_tree_result tree = { .fail_fast = fail_fast };
+    Py_BEGIN_ALLOW_THREADS
+    int flags = ((link_plain) ? PGMMV_LINKPLAIN : 0) | ((in_place) ? PGMMV_INPLACE : 0) | ((journal) ? PGMMV_JOURNAL : 0)
+                | ((drop_cache) ? PGMMV_DROPCACHE : 0) | ((direct) ? PGMMV_DIRECT : 0) | ((disk_order) ? PGMMV_DISKORDER : 0)
+                | ((auto_tune) ? PGMMV_AUTOTUNE : 0) | ((fail_fast) ? PGMMV_FAILFAST : 0);
+    ret = pgmmv_decrypt_tree_tuned(PyBytes_AS_STRING(src), PyBytes_AS_STRING(dst), key.buf, key.len, &profile,
+                                   (pipeline) ? &config : NULL, flags, _resource_tree_done, &tree);
+    if (auto_tune && profile_path) saved = pgmmv_tune_save(&profile, PyBytes_AS_STRING(profile_path));
+    Py_END_ALLOW_THREADS
+
+    if (tree.error) {
+        resource_set_error(tree.error, tree.src, tree.dst);
+        _resource_note_cancelled(tree.cancelled);
+    } else if (ret < 0) resource_set_error(errno, NULL, NULL);
+    else if (saved < 0) resource_set_error(errno, PyBytes_AS_STRING(profile_path), NULL);
+    else result = PyLong_FromSize_t(tree.count);
+    free(tree.src);
+    free(tree.dst);
+
+finally:
+    Py_XDECREF(profile_path);
+    Py_DECREF(src);
+    Py_DECREF(dst);
+    PyBuffer_Release(&key);
+    return result;
+}
+
+/* every file scanned, its path copied as the batch is freed afterwards */
+typedef struct _resource_scan_result {
+    pgmmv_scan_task* tasks;
+    size_t count, cap;
+    int error;                  /* errno of running out of memory */
+} resource_scan_result;
+
+static int _resource_scan_done(const pgmmv_scan_task* tasks, size_t count, void* ctx) {
+    resource_scan_result* result = (resource_scan_result*)ctx;
+    if (result->count + count > result->cap) {
+        size_t cap = (result->cap) ? result->cap : 1024;
+        while (cap < result->count + count) cap *= 2;
+        pgmmv_scan_task* grown = (pgmmv_scan_task*)realloc(result->tasks, sizeof(pgmmv_scan_task) * cap);
+        if (!grown) {
+            result->error = ENOMEM;
+            return 1;
+        }
+        result->tasks = grown;
+        result->cap = cap;
+    }
+
+    for (size_t idx = 0; idx < count; idx++) {
+        pgmmv_scan_task* task = &result->tasks[result->count];
+        *task = tasks[idx];
+        if (!(task->path = strdup(tasks[idx].path))) {
+            result->error = ENOMEM;
+            return 1;
+        }
+        result->count++;
+    }
+    return 0;
+}
+
+static PyObject* Py_resource_scan_tree(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "src", "threads", NULL };
+
+    PyObject* src, * threads_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|$O", kwlist, PyUnicode_FSConverter, &src, &threads_obj)) {
+        return NULL;
+    }
+
+    PyObject* result = NULL;
+    int threads = resource_parse_threads(threads_obj, "threads");
+    if (threads < 0) goto finally;
+
+    /* files which cannot be scanned are listed with their errno, only the scan itself failing raises */
+    int ret, err;
+    resource_scan_result scan = { 0 };
+    Py_BEGIN_ALLOW_THREADS
+    ret = pgmmv_scan_tree(PyBytes_AS_STRING(src), threads, _resource_scan_done, &scan);
+    err = errno;
+    Py_END_ALLOW_THREADS
+
+    size_t failed = 0;
+    for (size_t idx = 0; idx < scan.count; idx++) failed += (scan.tasks[idx].result < 0);
+    if (scan.error) resource_set_error(scan.error, NULL, NULL);
+    else if (ret < 0 && !failed) resource_set_error(err, PyBytes_AS_STRING(src), NULL);
+    else result = PyList_New((Py_ssize_t)scan.count);
+
+    for (size_t idx = 0; result && idx < scan.count; idx++) {
+        const pgmmv_scan_task* task = &scan.tasks[idx];
+        PyObject* entry = Py_BuildValue("(O&KNiKi)", PyUnicode_DecodeFSDefault, task->path, task->file_size,
+                                        PyBool_FromLong(task->result == 0 && task->header.is_encrypted),
+                                        (task->result == 0) ? task->header.pad : 0,
+                                        (task->result == 0) ? task->header.pt_len : 0, task->error);
+        if (!entry) Py_CLEAR(result);
+        else PyList_SET_ITEM(result, (Py_ssize_t)idx, entry);
+    }
+    for (size_t idx = 0; idx < scan.count; idx++) free((char*)scan.tasks[idx].path);
+    free(scan.tasks);
+
+finally:
+    Py_DECREF(src);
+    return result;
+}
+
+static PyObject* Py_resource_set_huge_pages(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "enable", NULL };
+
+    int enable;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "p", kwlist, &enable)) {
+        return NULL;
+    }
+    pgmmv_set_hugepages(enable);
+    Py_RETURN_NONE;
+}
+
+static PyObject* Py_resource_set_max_inflight_bytes(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "limit", NULL };
+
+    PyObject* limit_obj;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &limit_obj)) {
+        return NULL;
+    }
+    Py_ssize_t limit = resource_parse_size(limit_obj, "limit");
+    if (limit < 0) return NULL;
+    pgmmv_set_max_inflight((uint64_t)limit);
+    Py_RETURN_NONE;
+}
+
+static PyObject* Py_resource_peak_inflight_bytes(PyObject* Py_UNUSED(self), PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "reset", NULL };
+
+    int reset = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$p", kwlist, &reset)) {
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(pgmmv_peak_inflight(reset));
+}
+
+static PyMethodDef Py_resource_methods[] = {
+    { "decrypt_key", (PyCFunction)Py_resource_decrypt_key, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "derive_subkey", (PyCFunction)Py_resource_derive_subkey, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_resource_bytes", (PyCFunction)Py_resource_decrypt_resource_bytes, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_resource_prefix", (PyCFunction)Py_resource_decrypt_resource_prefix, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_resource_file", (PyCFunction)Py_resource_decrypt_resource_file, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_resource_file_inplace", (PyCFunction)Py_resource_decrypt_resource_file_inplace, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_resource_batch", (PyCFunction)Py_resource_decrypt_resource_batch, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_many", (PyCFunction)Py_resource_decrypt_many, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "decrypt_tree", (PyCFunction)Py_resource_decrypt_tree, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "scan_tree", (PyCFunction)Py_resource_scan_tree, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "set_huge_pages", (PyCFunction)Py_resource_set_huge_pages, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "set_max_inflight_bytes", (PyCFunction)Py_resource_set_max_inflight_bytes, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "peak_inflight_bytes", (PyCFunction)Py_resource_peak_inflight_bytes, METH_VARARGS | METH_KEYWORDS, NULL },
+    { NULL }
+};
+
+/* end resource functions */
+
+
+/* initialization functions */
+
+int resource_add_functions(PyObject* module) {
+    return PyModule_AddFunctions(module, Py_resource_methods);
+}
+
+/* end initialization functions */
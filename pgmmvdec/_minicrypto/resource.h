@@ -0,0 +1,39 @@
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+
+/* initialization functions */
+
+/*
+ * resource function registration
+ * MUST be called during the module execution process
+ */
+int resource_add_functions(PyObject* module);
+
+
+/* shared operations of resource functions */
+
+/*
+ * raise ValueError for a key longer than PGMMV_MAXKEYLEN
+ */
+int resource_check_key(Py_buffer* key);
+
+/*
+ * parse a thread count argument named `name`, None means 0, which libpgmmv takes as its default
+ * return -1 and set an exception on failure
+ */
+int resource_parse_threads(PyObject* threads_obj, const char* name);
+
+/*
+ * parse a byte size argument named `name`, None means 0, which libpgmmv takes as its default
+ * return -1 and set an exception on failure
+ */
+Py_ssize_t resource_parse_size(PyObject* size_obj, const char* name);
+
+/*
+ * raise the exception of a libpgmmv errno, `file` and `out` are optional filenames,
+ * EBADMSG raises ValueError naming `file`
+ */
+void resource_set_error(int err, const char* file, const char* out);
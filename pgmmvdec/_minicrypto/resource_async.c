@@ -0,0 +1,418 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "minicrypto.h"
+#include "resource.h"
+#include "resource_async.h"
+#include "_C/pgmmv.h"
+
+
+/* initialization functions */
+
+static PyType_Spec PyAsyncQueueType_spec;
+
+int resource_async_add_types(PyObject* module) {
+    minicrypto_state* state = minicrypto_get_state(module);
+    return minicrypto_add_type(module, &PyAsyncQueueType_spec, NULL, &state->AsyncQueueType);
+}
+
+/* end initialization functions */
+
+
+/* internal operations of class AsyncQueue */
+
+typedef struct _PyAsyncQueueObject PyAsyncQueueObject;
+
+enum { ASYNC_JOB_FILE, ASYNC_JOB_BYTES, ASYNC_JOB_READ };
+
+typedef struct _async_job {
+    pgmmv_pool_job base;
+    PyAsyncQueueObject* queue;
+    struct _async_job* next;        /* in the completion list */
+    unsigned long long token;
+    int kind;                       /* ASYNC_JOB_* */
+
+    PyObject* file, * out;          /* ASYNC_JOB_FILE, encoded paths, ASYNC_JOB_READ, `file` only */
+    Py_buffer data;                 /* ASYNC_JOB_BYTES, input */
+    pgmmv_reader* reader;           /* ASYNC_JOB_READ, input opened up front */
+    PyObject* output;               /* ASYNC_JOB_BYTES and ASYNC_JOB_READ, bytes sized up front */
+
+    uint8_t key[PGMMV_MAXKEYLEN];
+    size_t key_len;
+    int64_t result;
+    int error;
+} async_job;
+
+struct _PyAsyncQueueObject {
+    PyObject_HEAD
+    pgmmv_pool* pool;
+    int read_fd, write_fd;          /* the same eventfd on Linux, a pipe elsewhere */
+    pthread_mutex_t lock;
+    async_job* done_head, * done_tail;
+    unsigned long long next_token;
+    Py_ssize_t pending;             /* submitted and not drained yet */
+};
+
+
+static int _AsyncQueue_open_fds(PyAsyncQueueObject* self) {
+#ifdef __linux__
+    self->read_fd = self->write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return (self->read_fd < 0) ? -1 : 0;
+#else
+    int fds[2];
+    if (pipe(fds) < 0) return -1;
+    for (int idx = 0; idx < 2; idx++) {
+        fcntl(fds[idx], F_SETFL, fcntl(fds[idx], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[idx], F_SETFD, FD_CLOEXEC);
+    }
+    self->read_fd = fds[0];
+    self->write_fd = fds[1];
+    return 0;
+#endif
+}
+
+static void _AsyncQueue_close_fds(PyAsyncQueueObject* self) {
+    if (self->write_fd >= 0 && self->write_fd != self->read_fd) close(self->write_fd);
+    if (self->read_fd >= 0) close(self->read_fd);
+    self->read_fd = self->write_fd = -1;
+}
+
+static void _AsyncQueue_notify(PyAsyncQueueObject* self) {
+    /* a full pipe already wakes the reader, nothing to do on failure */
+#ifdef __linux__
+    uint64_t one = 1;
+    ssize_t ret = write(self->write_fd, &one, sizeof(one));
+#else
+    uint8_t one = 1;
+    ssize_t ret = write(self->write_fd, &one, sizeof(one));
+#endif
+    (void)ret;
+}
+
+static void _AsyncQueue_consume_notifications(PyAsyncQueueObject* self) {
+    uint64_t buffer[8];
+    while (read(self->read_fd, buffer, sizeof(buffer)) > 0);
+}
+
+/* runs on a pool thread without the GIL */
+static void _AsyncQueue_run_job(pgmmv_pool_job* base) {
+    async_job* job = (async_job*)base;
+    if (job->kind == ASYNC_JOB_FILE) {
+        job->result = pgmmv_decrypt_file(PyBytes_AS_STRING(job->file), PyBytes_AS_STRING(job->out), job->key, job->key_len);
+    } else if (job->kind == ASYNC_JOB_READ) {
+        job->result = pgmmv_reader_pread(job->reader, PyBytes_AS_STRING(job->output), (size_t)PyBytes_GET_SIZE(job->output), 0);
+        pgmmv_reader_close(job->reader);
+        job->reader = NULL;
+    } else {
+        job->result = pgmmv_decrypt_resource((uint8_t*)PyBytes_AS_STRING(job->output), job->data.buf, job->data.len, job->key, job->key_len);
+    }
+    job->error = (job->result < 0) ? errno : 0;
+    memset(job->key, 0, sizeof(job->key));
+
+    /* only the first completion of a batch needs to wake the reader */
+    PyAsyncQueueObject* queue = job->queue;
+    job->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    int was_empty = !queue->done_head;
+    if (queue->done_tail) queue->done_tail->next = job;
+    else queue->done_head = job;
+    queue->done_tail = job;
+    pthread_mutex_unlock(&queue->lock);
+    if (was_empty) _AsyncQueue_notify(queue);
+}
+
+static void _AsyncQueue_free_job(async_job* job) {
+    Py_XDECREF(job->file);
+    Py_XDECREF(job->out);
+    if (job->data.obj) PyBuffer_Release(&job->data);
+    pgmmv_reader_close(job->reader);
+    Py_XDECREF(job->output);
+    PyMem_Free(job);
+}
+
+static async_job* _AsyncQueue_take_done(PyAsyncQueueObject* self) {
+    pthread_mutex_lock(&self->lock);
+    async_job* head = self->done_head;
+    self->done_head = self->done_tail = NULL;
+    pthread_mutex_unlock(&self->lock);
+    return head;
+}
+
+static PyObject* _AsyncQueue_fetch_error() {
+#if PY_VERSION_HEX >= 0x030C0000
+    return PyErr_GetRaisedException();
+#else
+    PyObject* type, * value, * traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (traceback) PyException_SetTraceback(value, traceback);
+    Py_XDECREF(type);
+    Py_XDECREF(traceback);
+    return value;
+#endif
+}
+
+/* (token, result, exception) of a completed job */
+static PyObject* _AsyncQueue_job_result(async_job* job) {
+    PyObject* result = NULL, * exception = NULL;
+    if (job->result < 0) {
+        if (job->kind == ASYNC_JOB_FILE) resource_set_error(job->error, PyBytes_AS_STRING(job->file), PyBytes_AS_STRING(job->out));
+        else if (job->kind == ASYNC_JOB_READ) resource_set_error(job->error, PyBytes_AS_STRING(job->file), NULL);
+        else resource_set_error(job->error, NULL, NULL);
+        exception = _AsyncQueue_fetch_error();
+        if (!exception) return NULL;
+        result = Py_NewRef(Py_None);
+    } else if (job->kind == ASYNC_JOB_FILE) {
+        result = PyLong_FromLongLong(job->result);
+        if (!result) return NULL;
+        exception = Py_NewRef(Py_None);
+    } else {
+        result = Py_NewRef(job->output);
+        exception = Py_NewRef(Py_None);
+    }
+    return Py_BuildValue("(KNN)", job->token, result, exception);
+}
+
+static async_job* _AsyncQueue_new_job(PyAsyncQueueObject* self, int kind, Py_buffer* key) {
+    if (!self->pool) {
+        PyErr_SetString(PyExc_ValueError, "AsyncQueue is closed");
+        return NULL;
+    }
+    if (resource_check_key(key) < 0) return NULL;
+
+    async_job* job = (async_job*)PyMem_Calloc(1, sizeof(async_job));
+    if (!job) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    job->base.run = _AsyncQueue_run_job;
+    job->queue = self;
+    job->kind = kind;
+    memcpy(job->key, key->buf, key->len);
+    job->key_len = key->len;
+    return job;
+}
+
+static PyObject* _AsyncQueue_submit(PyAsyncQueueObject* self, async_job* job) {
+    job->token = self->next_token++;
+    self->pending++;
+    pgmmv_pool_submit(self->pool, &job->base);
+    return PyLong_FromUnsignedLongLong(job->token);
+}
+
+static void _AsyncQueue_shutdown(PyAsyncQueueObject* self) {
+    /* queued jobs still run, their results are dropped */
+    pgmmv_pool* pool = self->pool;
+    self->pool = NULL;
+    if (pool) {
+        Py_BEGIN_ALLOW_THREADS
+        pgmmv_pool_destroy(pool);
+        Py_END_ALLOW_THREADS
+    }
+    for (async_job* job = _AsyncQueue_take_done(self), * next; job; job = next) {
+        next = job->next;
+        _AsyncQueue_free_job(job);
+    }
+    self->pending = 0;
+    _AsyncQueue_close_fds(self);
+}
+
+/* end internal operations of class AsyncQueue */
+
+
+/* class AsyncQueue */
+
+static PyObject* PyAsyncQueue_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "threads", NULL };
+
+    PyObject* threads_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$O", kwlist, &threads_obj)) {
+        return NULL;
+    }
+    int threads = resource_parse_threads(threads_obj, "threads");
+    if (threads < 0) return NULL;
+
+    PyAsyncQueueObject* self = (PyAsyncQueueObject*)type->tp_alloc(type, 0);
+    if (!self) return NULL;
+    self->read_fd = self->write_fd = -1;
+    pthread_mutex_init(&self->lock, NULL);
+
+    if (_AsyncQueue_open_fds(self) < 0 || !(self->pool = pgmmv_pool_create(threads))) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject*)self;
+}
+
+static void PyAsyncQueue_dealloc(PyAsyncQueueObject* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    _AsyncQueue_shutdown(self);
+    pthread_mutex_destroy(&self->lock);
+    type->tp_free((PyObject*)self);
+    Py_DECREF(type);
+}
+
+static PyObject* PyAsyncQueue_fileno(PyAsyncQueueObject* self, PyObject* Py_UNUSED(args)) {
+    if (self->read_fd < 0) {
+        PyErr_SetString(PyExc_ValueError, "AsyncQueue is closed");
+        return NULL;
+    }
+    return PyLong_FromLong(self->read_fd);
+}
+
+static PyObject* PyAsyncQueue_submit_file(PyAsyncQueueObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file", "out", "key", NULL };
+
+    PyObject* file, * out;
+    Py_buffer key;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&y*", kwlist, PyUnicode_FSConverter, &file, PyUnicode_FSConverter, &out, &key)) {
+        return NULL;
+    }
+
+    async_job* job = _AsyncQueue_new_job(self, ASYNC_JOB_FILE, &key);
+    PyBuffer_Release(&key);
+    if (!job) {
+        Py_DECREF(file);
+        Py_DECREF(out);
+        return NULL;
+    }
+    job->file = file;
+    job->out = out;
+    return _AsyncQueue_submit(self, job);
+}
+
+static PyObject* PyAsyncQueue_submit_bytes(PyAsyncQueueObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file_bytes", "key", NULL };
+
+    Py_buffer data, key;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*y*", kwlist, &data, &key)) {
+        return NULL;
+    }
+
+    /* the input stays held and the output is sized here, the pool only fills it */
+    async_job* job = _AsyncQueue_new_job(self, ASYNC_JOB_BYTES, &key);
+    PyBuffer_Release(&key);
+    if (!job) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    job->data = data;
+
+    pgmmv_header header;
+    if (pgmmv_parse_header(&header, data.buf, data.len, data.len) < 0) {
+        resource_set_error(errno, NULL, NULL);
+        _AsyncQueue_free_job(job);
+        return NULL;
+    }
+    job->output = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)header.pt_len);
+    if (!job->output) {
+        _AsyncQueue_free_job(job);
+        return NULL;
+    }
+    return _AsyncQueue_submit(self, job);
+}
+
+static PyObject* PyAsyncQueue_submit_read(PyAsyncQueueObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file", "key", NULL };
+
+    PyObject* file;
+    Py_buffer key;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&y*", kwlist, PyUnicode_FSConverter, &file, &key)) {
+        return NULL;
+    }
+
+    /* the file is opened and the output sized here, the pool reads the file whole into it and decrypts it in place */
+    async_job* job = _AsyncQueue_new_job(self, ASYNC_JOB_READ, &key);
+    if (!job) {
+        Py_DECREF(file);
+        PyBuffer_Release(&key);
+        return NULL;
+    }
+    job->file = file;
+
+    Py_BEGIN_ALLOW_THREADS
+    job->reader = pgmmv_reader_open(PyBytes_AS_STRING(file), key.buf, key.len, PGMMV_BLOCKSIZE);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&key);
+    if (!job->reader) {
+        resource_set_error(errno, PyBytes_AS_STRING(file), NULL);
+        _AsyncQueue_free_job(job);
+        return NULL;
+    }
+    job->output = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)pgmmv_reader_size(job->reader));
+    if (!job->output) {
+        _AsyncQueue_free_job(job);
+        return NULL;
+    }
+    return _AsyncQueue_submit(self, job);
+}
+
+static PyObject* PyAsyncQueue_drain(PyAsyncQueueObject* self, PyObject* Py_UNUSED(args)) {
+    if (self->read_fd < 0) return PyList_New(0);
+
+    /* consume the notifications first, a job completing meanwhile notifies again */
+    _AsyncQueue_consume_notifications(self);
+    async_job* job = _AsyncQueue_take_done(self);
+
+    PyObject* results = PyList_New(0);
+    for (async_job* next; job; job = next) {
+        next = job->next;
+        self->pending--;
+
+        PyObject* item = (results) ? _AsyncQueue_job_result(job) : NULL;
+        if (!item || PyList_Append(results, item) < 0) Py_CLEAR(results);
+        Py_XDECREF(item);
+        _AsyncQueue_free_job(job);
+    }
+    return results;
+}
+
+static PyObject* PyAsyncQueue_close(PyAsyncQueueObject* self, PyObject* Py_UNUSED(args)) {
+    _AsyncQueue_shutdown(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject* PyAsyncQueue_get_pending(PyAsyncQueueObject* self, void* Py_UNUSED(closure)) {
+    return PyLong_FromSsize_t(self->pending);
+}
+
+
+static PyMethodDef PyAsyncQueue_methods[] = {
+    { "fileno", (PyCFunction)PyAsyncQueue_fileno, METH_NOARGS, NULL },
+    { "submit_file", (PyCFunction)PyAsyncQueue_submit_file, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "submit_bytes", (PyCFunction)PyAsyncQueue_submit_bytes, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "submit_read", (PyCFunction)PyAsyncQueue_submit_read, METH_VARARGS | METH_KEYWORDS, NULL },
+    { "drain", (PyCFunction)PyAsyncQueue_drain, METH_NOARGS, NULL },
+    { "close", (PyCFunction)PyAsyncQueue_close, METH_NOARGS, NULL },
+    { NULL }
+};
+
+static PyGetSetDef PyAsyncQueue_getset[] = {
+    { "pending", (getter)PyAsyncQueue_get_pending, NULL, NULL, NULL },
+    { NULL }
+};
+
+static PyType_Slot PyAsyncQueueType_slots[] = {
+    { Py_tp_new, PyAsyncQueue_new },
+    { Py_tp_dealloc, PyAsyncQueue_dealloc },
+    { Py_tp_methods, PyAsyncQueue_methods },
+    { Py_tp_getset, PyAsyncQueue_getset },
+    { 0, NULL }
+};
+
+static PyType_Spec PyAsyncQueueType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_ASYNCQUEUE),
+    .basicsize = sizeof(PyAsyncQueueObject),
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = PyAsyncQueueType_slots,
+};
+
+/* end class AsyncQueue */
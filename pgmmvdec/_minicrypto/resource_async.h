@@ -0,0 +1,23 @@
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+
+/* initialization functions */
+
+/*
+ * resource_async type creation
+ * MUST be called during the module execution process
+ */
+int resource_async_add_types(PyObject* module);
+
+
+/* class AsyncQueue */
+
+/*
+ * decrypts resources on a private pool of native threads without the GIL,
+ * completions are signalled through a file descriptor for an event loop to watch
+ */
+
+#define CLASSNAME_ASYNCQUEUE    "AsyncQueue"
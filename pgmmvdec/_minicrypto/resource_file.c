@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "minicrypto.h"
+#include "resource.h"
+#include "resource_file.h"
+#include "_C/pgmmv.h"
+
+
+/* initialization functions */
+
+static PyType_Spec PyDecryptedFileType_spec;
+
+typedef struct _decrypted_file {
+    pthread_mutex_t lock;       /* taken without the GIL around reads, which run without it */
+    pgmmv_reader* reader;       /* NULL once closed */
+    uint64_t pos;
+    PyObject* name;
+} decrypted_file;
+
+/*
+ * the fields of DecryptedFile follow those of _io._RawIOBase, whose size is only known at run time,
+ * and is read from the base itself rather than kept, the module may be executed by several interpreters at once
+ */
+static Py_ssize_t _DecryptedFile_offset(PyTypeObject* base) {
+    Py_ssize_t align = _Alignof(decrypted_file);
+    return (base->tp_basicsize + align - 1) / align * align;
+}
+
+int resource_file_add_types(PyObject* module) {
+    minicrypto_state* state = minicrypto_get_state(module);
+    PyObject* io = PyImport_ImportModule("io");
+    PyObject* abc = (io) ? PyObject_GetAttrString(io, "RawIOBase") : NULL;
+    PyObject* native_io = (abc) ? PyImport_ImportModule("_io") : NULL;
+    PyObject* base = (native_io) ? PyObject_GetAttrString(native_io, "_RawIOBase") : NULL;
+    Py_XDECREF(native_io);
+    Py_XDECREF(io);
+    if (base && !PyType_Check(base)) {
+        PyErr_SetString(PyExc_TypeError, "_io._RawIOBase is not a type");
+        Py_CLEAR(base);
+    }
+
+    /* built on the native base class, then registered as the abstract one */
+    int ret = -1;
+    if (base) {
+        PyType_Spec spec = PyDecryptedFileType_spec;
+        spec.basicsize = (int)(_DecryptedFile_offset((PyTypeObject*)base) + sizeof(decrypted_file));
+        ret = minicrypto_add_type(module, &spec, (PyTypeObject*)base, &state->DecryptedFileType);
+    }
+    if (ret == 0) {
+        PyObject* registered = PyObject_CallMethod(abc, "register", "O", (PyObject*)state->DecryptedFileType);
+        ret = (registered) ? 0 : -1;
+        Py_XDECREF(registered);
+    }
+    Py_XDECREF(base);
+    Py_XDECREF(abc);
+    return ret;
+}
+
+/* end initialization functions */
+
+
+/* internal operations of class DecryptedFile */
+
+/* DecryptedFile cannot be subclassed, its base is that of every instance */
+static decrypted_file* _DecryptedFile_fields(PyObject* self) {
+    return (decrypted_file*)((char*)self + _DecryptedFile_offset(Py_TYPE(self)->tp_base));
+}
+
+static int _DecryptedFile_check_open(decrypted_file* file) {
+    if (!file->reader) {
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+        return -1;
+    }
+    return 0;
+}
+
+/* read at the current position, without the GIL, return the bytes read or -1 with errno */
+static int64_t _DecryptedFile_read(decrypted_file* file, void* buf, size_t len) {
+    int64_t got;
+    pthread_mutex_lock(&file->lock);
+    if (!file->reader) {
+        got = -1;
+        errno = EBADF;
+    } else {
+        got = pgmmv_reader_pread(file->reader, buf, len, file->pos);
+        if (got > 0) file->pos += (uint64_t)got;
+    }
+    int err = errno;
+    pthread_mutex_unlock(&file->lock);
+    errno = err;
+    return got;
+}
+
+static PyObject* _DecryptedFile_read_error(decrypted_file* file, int err) {
+    if (err == EBADF) return PyErr_Format(PyExc_ValueError, "I/O operation on closed file");
+    resource_set_error(err, PyBytes_AS_STRING(file->name), NULL);
+    return NULL;
+}
+
+/* end internal operations of class DecryptedFile */
+
+
+/* class DecryptedFile */
+
+static PyObject* PyDecryptedFile_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "file", "key", "readahead", NULL };
+
+    PyObject* path, * readahead_obj = Py_None;
+    Py_buffer key;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&y*|$O", kwlist, PyUnicode_FSConverter, &path, &key, &readahead_obj)) {
+        return NULL;
+    }
+    Py_ssize_t readahead = resource_parse_size(readahead_obj, "readahead");
+    if (readahead < 0 || resource_check_key(&key) < 0) {
+        Py_DECREF(path);
+        PyBuffer_Release(&key);
+        return NULL;
+    }
+
+    pgmmv_reader* reader;
+    Py_BEGIN_ALLOW_THREADS
+    reader = pgmmv_reader_open(PyBytes_AS_STRING(path), key.buf, key.len, (size_t)readahead);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&key);
+    if (!reader) {
+        resource_set_error(errno, PyBytes_AS_STRING(path), NULL);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    PyObject* self = type->tp_alloc(type, 0);
+    if (!self) {
+        pgmmv_reader_close(reader);
+        Py_DECREF(path);
+        return NULL;
+    }
+    decrypted_file* file = _DecryptedFile_fields(self);
+    pthread_mutex_init(&file->lock, NULL);
+    file->reader = reader;
+    file->name = path;
+    return self;
+}
+
+static void PyDecryptedFile_dealloc(PyObject* self) {
+    /* closed through close() first, as io objects are */
+    PyTypeObject* type = Py_TYPE(self);
+    if (PyObject_CallFinalizerFromDealloc(self) < 0) return;
+
+    /*
+     * freed here rather than by the base's tp_dealloc, which is subtype_dealloc from 3.12 on and would call back
+     * into this one; the dict and weak references of _io._RawIOBase lie at the offsets its type tells
+     */
+    PyObject_GC_UnTrack(self);
+    if (type->tp_weaklistoffset) PyObject_ClearWeakRefs(self);
+    if (type->tp_dictoffset > 0) Py_CLEAR(*(PyObject**)((char*)self + type->tp_dictoffset));
+
+    decrypted_file* file = _DecryptedFile_fields(self);
+    pgmmv_reader_close(file->reader);
+    pthread_mutex_destroy(&file->lock);
+    Py_CLEAR(file->name);
+    type->tp_free(self);
+    Py_DECREF(type);
+}
+
+static PyObject* PyDecryptedFile_readinto(PyObject* self, PyObject* args) {
+    Py_buffer buffer;
+    if (!PyArg_ParseTuple(args, "w*", &buffer)) {
+        return NULL;
+    }
+
+    decrypted_file* file = _DecryptedFile_fields(self);
+    int64_t got;
+    Py_BEGIN_ALLOW_THREADS
+    got = _DecryptedFile_read(file, buffer.buf, (size_t)buffer.len);
+    Py_END_ALLOW_THREADS
+    int err = errno;
+    PyBuffer_Release(&buffer);
+    return (got < 0) ? _DecryptedFile_read_error(file, err) : PyLong_FromLongLong(got);
+}
+
+static PyObject* PyDecryptedFile_readall(PyObject* self, PyObject* Py_UNUSED(args)) {
+    decrypted_file* file = _DecryptedFile_fields(self);
+    pthread_mutex_lock(&file->lock);
+    int closed = !file->reader;
+    uint64_t size = (closed) ? 0 : pgmmv_reader_size(file->reader);
+    uint64_t left = (file->pos < size) ? size - file->pos : 0;
+    pthread_mutex_unlock(&file->lock);
+    if (closed) return _DecryptedFile_read_error(file, EBADF);
+    if (left > PY_SSIZE_T_MAX) return PyErr_NoMemory();
+
+    /* the rest of the resource at once, sized up front */
+    PyObject* result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)left);
+    if (!result) return NULL;
+    int64_t got;
+    Py_BEGIN_ALLOW_THREADS
+    got = _DecryptedFile_read(file, PyBytes_AS_STRING(result), (size_t)left);
+    Py_END_ALLOW_THREADS
+    if (got < 0) {
+        Py_DECREF(result);
+        return _DecryptedFile_read_error(file, errno);
+    }
+    if ((uint64_t)got < left) _PyBytes_Resize(&result, (Py_ssize_t)got);
+    return result;
+}
+
+static PyObject* PyDecryptedFile_seek(PyObject* self, PyObject* args) {
+    long long offset;
+    int whence = SEEK_SET;
+    if (!PyArg_ParseTuple(args, "L|i", &offset, &whence)) {
+        return NULL;
+    }
+    if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) {
+        return PyErr_Format(PyExc_ValueError, "invalid whence (%d, should be %d, %d or %d)", whence, SEEK_SET, SEEK_CUR, SEEK_END);
+    }
+
+    decrypted_file* file = _DecryptedFile_fields(self);
+    pthread_mutex_lock(&file->lock);
+    int closed = !file->reader;
+    long long base = (closed || whence == SEEK_SET) ? 0
+                   : (whence == SEEK_CUR) ? (long long)file->pos : (long long)pgmmv_reader_size(file->reader);
+    int negative = (offset < 0 && base < -offset);
+    if (!closed && !negative) file->pos = (uint64_t)(base + offset);
+    uint64_t pos = file->pos;
+    pthread_mutex_unlock(&file->lock);
+
+    if (closed) return _DecryptedFile_read_error(file, EBADF);
+    if (negative) return PyErr_Format(PyExc_ValueError, "negative seek position %lld", base + offset);
+    return PyLong_FromUnsignedLongLong(pos);
+}
+
+static PyObject* PyDecryptedFile_tell(PyObject* self, PyObject* Py_UNUSED(args)) {
+    decrypted_file* file = _DecryptedFile_fields(self);
+    pthread_mutex_lock(&file->lock);
+    int closed = !file->reader;
+    uint64_t pos = file->pos;
+    pthread_mutex_unlock(&file->lock);
+    return (closed) ? _DecryptedFile_read_error(file, EBADF) : PyLong_FromUnsignedLongLong(pos);
+}
+
+static PyObject* PyDecryptedFile_true_if_open(PyObject* self, PyObject* Py_UNUSED(args)) {
+    if (_DecryptedFile_check_open(_DecryptedFile_fields(self)) < 0) return NULL;
+    Py_RETURN_TRUE;
+}
+
+static PyObject* PyDecryptedFile_close(PyObject* self, PyObject* Py_UNUSED(args)) {
+    decrypted_file* file = _DecryptedFile_fields(self);
+    pthread_mutex_lock(&file->lock);
+    pgmmv_reader* reader = file->reader;
+    file->reader = NULL;
+    pthread_mutex_unlock(&file->lock);
+    pgmmv_reader_close(reader);
+
+    /* marks the object closed */
+    return PyObject_CallMethod((PyObject*)Py_TYPE(self)->tp_base, "close", "O", self);
+}
+
+static PyObject* PyDecryptedFile_get_name(PyObject* self, void* Py_UNUSED(closure)) {
+    return PyUnicode_DecodeFSDefault(PyBytes_AS_STRING(_DecryptedFile_fields(self)->name));
+}
+
+static PyObject* PyDecryptedFile_get_size(PyObject* self, void* Py_UNUSED(closure)) {
+    decrypted_file* file = _DecryptedFile_fields(self);
+    if (_DecryptedFile_check_open(file) < 0) return NULL;
+    return PyLong_FromUnsignedLongLong(pgmmv_reader_size(file->reader));
+}
+
+
+static PyMethodDef PyDecryptedFile_methods[] = {
+    { "readinto", (PyCFunction)PyDecryptedFile_readinto, METH_VARARGS, NULL },
+    { "readall", (PyCFunction)PyDecryptedFile_readall, METH_NOARGS, NULL },
+    { "seek", (PyCFunction)PyDecryptedFile_seek, METH_VARARGS, NULL },
+    { "tell", (PyCFunction)PyDecryptedFile_tell, METH_NOARGS, NULL },
+    { "readable", (PyCFunction)PyDecryptedFile_true_if_open, METH_NOARGS, NULL },
+    { "seekable", (PyCFunction)PyDecryptedFile_true_if_open, METH_NOARGS, NULL },
+    { "close", (PyCFunction)PyDecryptedFile_close, METH_NOARGS, NULL },
+    { NULL }
+};
+
+static PyGetSetDef PyDecryptedFile_getset[] = {
+    { "name", (getter)PyDecryptedFile_get_name, NULL, NULL, NULL },
+    { "size", (getter)PyDecryptedFile_get_size, NULL, NULL, NULL },
+    { NULL }
+};
+
+static PyType_Slot PyDecryptedFileType_slots[] = {
+    { Py_tp_new, PyDecryptedFile_new },
+    { Py_tp_dealloc, PyDecryptedFile_dealloc },
+    { Py_tp_methods, PyDecryptedFile_methods },
+    { Py_tp_getset, PyDecryptedFile_getset },
+    { 0, NULL }
+};
+
+/* a copy with `basicsize` set is used once the size of the base class is known */
+static PyType_Spec PyDecryptedFileType_spec = {
+    .name = PYNAME_CONCAT(MODULENAME__MINICRYPTO, CLASSNAME_DECRYPTEDFILE),
+    .basicsize = 0,
+    .itemsize = 0,
+    .flags = Py_TPFLAGS_DEFAULT,
+    .slots = PyDecryptedFileType_slots,
+};
+
+/* end class DecryptedFile */
@@ -0,0 +1,22 @@
+#pragma once
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+
+/* initialization functions */
+
+/*
+ * resource_file type creation
+ * MUST be called during the module execution process
+ */
+int resource_file_add_types(PyObject* module);
+
+
+/* class DecryptedFile */
+
+/*
+ * seekable io.RawIOBase over the plaintext of a resource file, decrypted block by block as it is read
+ */
+
+#define CLASSNAME_DECRYPTEDFILE "DecryptedFile"
@@ -1,44 +1,333 @@
-from ._minicrypto import CBC, CBCIter, Twofish, Weakfish
-from .decrypt import derive_subkey, make_iter
+from asyncio import AbstractEventLoop, Future, get_running_loop
+from collections import OrderedDict
+from collections.abc import Iterator, Mapping, Sequence
+from concurrent.futures import Future as ThreadFuture, ThreadPoolExecutor
+from errno import EBADMSG
+from os import PathLike, scandir, strerror, walk
+from pathlib import Path
+from select import select
+from threading import Lock
+from weakref import WeakKeyDictionary
 
-PGMMV_IV = bytes.fromhex("A047E93D230A4C62A744B1A4EE857FBA")
+from . import _minicrypto
 
-
-def _is_weak(key: bytes | bytearray) -> bool:
-    return len(key) <= 8
+PGMMV_JOURNAL_SUFFIX = '.pgmmv-journal'
+PGMMV_INFO_PATHS = (
+    Path('info.json'),
+    Path('data', 'info.json'),
+)
+PGMMV_KEY_DICTKEY = 'key'
+PGMMV_WEAKKEYLEN = 8
 
 
 def decrypt_key(encrypted_key: bytes | bytearray) -> bytes:
     # The key for encrypted_key is "key". However, since it's too short (3 bytes),
-    # we decrypt it using weakfish.
-    return CBC(PGMMV_IV).decrypt(Weakfish(), encrypted_key)
+    # it is decrypted using weakfish.
+    return _minicrypto.decrypt_key(encrypted_key)
+
+
+def find_key(cwd: Path) -> bytes | None:
+    from base64 import b64decode
+    from json import loads
+
+    while not cwd.samefile(cwd.parent):
+        pths = tuple(cwd/pth for pth in PGMMV_INFO_PATHS if (cwd/pth).exists())
+        if pths:
+            enckey = b64decode(loads(pths[0].read_text('utf-8'))[PGMMV_KEY_DICTKEY])
+            return decrypt_key(enckey)
+        cwd /= '..'
+    return None
 
 
 def decrypt_resource_bytes(file_bytes: bytes | bytearray, key: bytes | bytearray) -> bytes:
-    if file_bytes[:3] != b'enc':    # resource file is not encrypted
-        return file_bytes
+    return _minicrypto.decrypt_resource_bytes(file_bytes, key)
+
+
+def decrypt_resource_prefix(file: str | PathLike | bytes | bytearray | memoryview, key: bytes | bytearray, n: int) -> bytes:
+    return _minicrypto.decrypt_resource_prefix(file, key, n)
+
+
+def decrypt_resource_file(file: str | PathLike, out: str | PathLike, key: bytes | bytearray, *, buffer_size: int | None = None,
+                          drop_cache: bool = False, direct: bool = False) -> int:
+    return _minicrypto.decrypt_resource_file(file, out, key, buffer_size=buffer_size, drop_cache=drop_cache, direct=direct)
+
+
+def decrypt_resource_file_inplace(path: str | PathLike, key: bytes | bytearray, *, journal: bool = False, drop_cache: bool = False) -> int:
+    return _minicrypto.decrypt_resource_file_inplace(path, key, journal=journal, drop_cache=drop_cache)
+
+
+def open(file: str | PathLike, key: bytes | bytearray, *, readahead: int | None = None) -> _minicrypto.DecryptedFile:
+    return _minicrypto.DecryptedFile(file, key, readahead=readahead)
+
+
+def decrypt_resource_batch(buffers: Sequence[bytes | bytearray], key: bytes | bytearray, *, threads: int | None = None) -> list[bytes]:
+    return _minicrypto.decrypt_resource_batch(buffers, key, threads=threads)
+
+
+def decrypt_many(pairs: Sequence[tuple[str | PathLike, str | PathLike]], key: bytes | bytearray, *, threads: int | None = None,
+                 link_plain: bool = False, in_place: bool = False, journal: bool = False,
+                 pipeline: bool = False, readers: int | None = None, writers: int | None = None,
+                 drop_cache: bool = False, direct: bool = False, disk_order: bool = False,
+                 fail_fast: bool = False) -> list[int]:
+    return _minicrypto.decrypt_many(pairs, key, threads=threads, link_plain=link_plain, in_place=in_place, journal=journal,
+                                    pipeline=pipeline, readers=readers, writers=writers, drop_cache=drop_cache, direct=direct,
+                                    disk_order=disk_order, fail_fast=fail_fast)
+
+
+def decrypt_tree(src: str | PathLike, dst: str | PathLike, key: bytes | bytearray, *, threads: int | None = None,
+                 link_plain: bool = False, in_place: bool = False, journal: bool = False,
+                 pipeline: bool = False, readers: int | None = None, writers: int | None = None,
+                 drop_cache: bool = False, direct: bool = False, disk_order: bool = False,
+                 auto_tune: bool = False, tune_profile: str | PathLike | None = None, fail_fast: bool = False) -> int:
+    return _minicrypto.decrypt_tree(src, dst, key, threads=threads, link_plain=link_plain, in_place=in_place, journal=journal,
+                                    pipeline=pipeline, readers=readers, writers=writers, drop_cache=drop_cache, direct=direct,
+                                    disk_order=disk_order, auto_tune=auto_tune, tune_profile=tune_profile, fail_fast=fail_fast)
+
+
+def scan_tree(root: str | PathLike, key: bytes | bytearray | None = None, *,
+              threads: int | None = None) -> tuple[list[dict], dict]:
+    '''
+    Inventory the files below `root`, or the file `root`, from their headers alone, without decrypting any.
+    Each entry tells the path relative to `root`, the file size, whether the file is encrypted, its pad byte,
+    its plaintext size and, given `key`, the length and class of its subkey, or the error met scanning it.
+    The totals add the entries up.
+    '''
+    root = Path(root)
+    if not root.exists():
+        raise FileNotFoundError(f'path not found: {root}')
+
+    # the subkey length depends on the key alone, keys of up to 8 bytes use Weakfish
+    subkey_len = len(_minicrypto.derive_subkey(key, 0)) if key is not None else None
+    key_class = None if subkey_len is None else 'weak' if subkey_len <= PGMMV_WEAKKEYLEN else 'strong'
+    base = root if root.is_dir() else root.parent
+
+    entries: list[dict] = []
+    totals = {'files': 0, 'encrypted': 0, 'unencrypted': 0, 'failed': 0, 'size': 0, 'plain_size': 0,
+              'subkey_len': subkey_len, 'key_class': key_class}
+    for path, size, encrypted, pad, plain_size, error in _minicrypto.scan_tree(root, threads=threads):
+        name = Path(path).relative_to(base).as_posix()
+        totals['files'] += 1
+        if error:
+            entries.append({'path': name, 'error': 'Illegal resource format' if error == EBADMSG else strerror(error)})
+            totals['failed'] += 1
+            continue
+
+        entries.append({'path': name, 'size': size, 'encrypted': encrypted, 'pad': pad, 'plain_size': plain_size,
+                        'subkey_len': subkey_len if encrypted else None, 'key_class': key_class if encrypted else None})
+        totals['encrypted' if encrypted else 'unencrypted'] += 1
+        totals['size'] += size
+        totals['plain_size'] += plain_size
+    return entries, totals
+
+
+def set_huge_pages(enable: bool) -> None:
+    _minicrypto.set_huge_pages(enable)
+
+
+def set_max_inflight_bytes(limit: int | None) -> None:
+    _minicrypto.set_max_inflight_bytes(limit)
+
+
+def peak_inflight_bytes(*, reset: bool = False) -> int:
+    return _minicrypto.peak_inflight_bytes(reset=reset)
+
+
+class ResourceStore(Mapping[str, bytes]):
+    '''Decrypt the files below `root` as they are asked for, keeping the most recent ones in memory.'''
+
+    def __init__(self, root: str | PathLike, key: bytes | bytearray | None = None, *, cache_size: int = 256 << 20,
+                 prefetch: int = 0, threads: int | None = None) -> None:
+        self.root = Path(root).resolve()
+        if not self.root.is_dir():
+            raise NotADirectoryError(f'not a directory: {self.root}')
+        if key is None and (key := find_key(self.root)) is None:
+            raise RuntimeError('cannot find PGMMV key')
+        self.key = bytes(key).rstrip(b'\0')
+        self.cache_size = cache_size
+        self.prefetch = prefetch
+
+        # the cache is also filled by prefetching threads, decryption itself runs without the GIL
+        self._lock = Lock()
+        self._cache: OrderedDict[str, bytes] = OrderedDict()
+        self._cached_bytes = 0
+        self._pending: dict[str, ThreadFuture] = {}
+        self._listings: dict[Path, list[str]] = {}
+        self._executor = ThreadPoolExecutor(threads, 'ResourceStore') if prefetch > 0 else None
+
+    def _path(self, relpath: str | PathLike) -> tuple[str, Path]:
+        path = (self.root / relpath).resolve()
+        if not path.is_relative_to(self.root) or path == self.root:
+            raise KeyError(relpath)
+        return path.relative_to(self.root).as_posix(), path
+
+    def _decrypt(self, path: Path) -> bytes:
+        # only the file is read, once, and decrypted in place
+        with _minicrypto.DecryptedFile(path, self.key) as file:
+            return file.readall()
+
+    def _store(self, name: str, data: bytes) -> None:
+        if len(data) > self.cache_size:
+            return
+        with self._lock:
+            if name in self._cache:
+                return
+            self._cache[name] = data
+            self._cached_bytes += len(data)
+            while self._cached_bytes > self.cache_size:
+                self._cached_bytes -= len(self._cache.popitem(last=False)[1])
+
+    def _prefetched(self, name: str, future: ThreadFuture) -> None:
+        with self._lock:
+            self._pending.pop(name, None)
+        if not future.cancelled() and future.exception() is None:
+            self._store(name, future.result())
+
+    def _prefetch_siblings(self, name: str, path: Path) -> None:
+        # the files following `path` in its directory, in name order
+        if (listing := self._listings.get(path.parent)) is None:
+            with scandir(path.parent) as entries:
+                listing = self._listings[path.parent] = sorted(entry.name for entry in entries if entry.is_file())
+        try:
+            following = listing[listing.index(path.name) + 1:]
+        except ValueError:
+            return
+
+        prefix = name[:-len(path.name)]
+        for sibling in following[:self.prefetch]:
+            sibling_name = prefix + sibling
+            with self._lock:
+                if sibling_name in self._cache or sibling_name in self._pending:
+                    continue
+                future = self._pending[sibling_name] = self._executor.submit(self._decrypt, path.parent / sibling)
+            future.add_done_callback(lambda future, sibling_name=sibling_name: self._prefetched(sibling_name, future))
+
+    def __getitem__(self, relpath: str | PathLike) -> bytes:
+        name, path = self._path(relpath)
+        with self._lock:
+            if (data := self._cache.get(name)) is not None:
+                self._cache.move_to_end(name)
+                return data
+            future = self._pending.get(name)
+
+        try:
+            data = future.result() if future is not None else self._decrypt(path)
+        except (FileNotFoundError, IsADirectoryError, NotADirectoryError):
+            raise KeyError(relpath) from None
+        self._store(name, data)
+        if self._executor is not None and future is None:
+            self._prefetch_siblings(name, path)
+        return data
+
+    def __contains__(self, relpath: object) -> bool:
+        try:
+            return self._path(relpath)[1].is_file()
+        except (KeyError, TypeError):
+            return False
+
+    def __iter__(self) -> Iterator[str]:
+        for dirpath, _, filenames in walk(self.root):
+            reldir = Path(dirpath).relative_to(self.root)
+            for filename in sorted(filenames):
+                yield (reldir / filename).as_posix()
+
+    def __len__(self) -> int:
+        return sum(len(filenames) for _, _, filenames in walk(self.root))
+
+    @property
+    def cached_bytes(self) -> int:
+        return self._cached_bytes
+
+    def clear_cache(self) -> None:
+        with self._lock:
+            self._cache.clear()
+            self._cached_bytes = 0
+
+    def close(self) -> None:
+        if self._executor is not None:
+            self._executor.shutdown(cancel_futures=True)
+            self._executor = None
+        self.clear_cache()
+
+    def __enter__(self) -> 'ResourceStore':
+        return self
+
+    def __exit__(self, *exc_info) -> None:
+        self.close()
+
+
+def iter_decrypted(root: str | PathLike, key: bytes | bytearray, *, prefetch: int = 16,
+                   threads: int | None = None) -> Iterator[tuple[str, memoryview]]:
+    '''
+    Decrypt the files below `root` into memory on native threads, yielding `(relative_path, plaintext)` as they finish,
+    with at most `prefetch` files read or decrypted ahead of the consumer.
+    '''
+    if prefetch < 1:
+        raise ValueError('prefetch must be positive')
+    root = Path(root)
+    files = ((Path(dirpath, filename), (Path(dirpath).relative_to(root) / filename).as_posix())
+             for dirpath, _, filenames in walk(root) for filename in filenames)
+
+    queue = _minicrypto.AsyncQueue(threads=threads)
+    names: dict[int, str] = {}
+    try:
+        while True:
+            # files still queued, decrypting or drained but not yet yielded, all count toward `prefetch`
+            while len(names) < prefetch and (entry := next(files, None)) is not None:
+                names[queue.submit_read(entry[0], key)] = entry[1]
+            if not names:
+                return
+            if not (completed := queue.drain()):
+                select([queue], [], [])
+                continue
+            for token, result, exception in completed:
+                name = names.pop(token)
+                if exception is not None:
+                    raise exception
+                yield name, memoryview(result)
+    finally:
+        queue.close()
+
+
+class _AsyncDispatcher:
+    '''Resolve the futures of one event loop from the completions of an `AsyncQueue`.'''
+
+    def __init__(self, loop: AbstractEventLoop) -> None:
+        self.queue = _minicrypto.AsyncQueue()
+        self.futures: dict[int, Future] = {}
+        loop.add_reader(self.queue.fileno(), self._complete)
+
+    def _complete(self) -> None:
+        for token, result, exception in self.queue.drain():
+            future = self.futures.pop(token, None)
+            if future is None or future.done():
+                continue
+            if exception is not None:
+                future.set_exception(exception)
+            else:
+                future.set_result(result)
+
+    def wait(self, loop: AbstractEventLoop, token: int) -> Future:
+        self.futures[token] = loop.create_future()
+        return self.futures[token]
+
+
+# one dispatcher per event loop, the loop owns its queue's reader
+_async_dispatchers: WeakKeyDictionary[AbstractEventLoop, _AsyncDispatcher] = WeakKeyDictionary()
 
-    pt_len = len(file_bytes) - 4 - file_bytes[3]
-    cipher = Weakfish() if _is_weak(key) else Twofish(derive_subkey(key, pt_len))
-    pt_iter = CBCIter(cipher, PGMMV_IV, make_iter(file_bytes[4:]), is_decrypt=True)
 
-    return (b''.join(pt_iter))[:pt_len]
+def _get_async_dispatcher() -> tuple[AbstractEventLoop, _AsyncDispatcher]:
+    loop = get_running_loop()
+    dispatcher = _async_dispatchers.get(loop)
+    if dispatcher is None:
+        dispatcher = _async_dispatchers[loop] = _AsyncDispatcher(loop)
+    return loop, dispatcher
 
 
-def decrypt_resource_file(file: str, out: str, key: bytes | bytearray) -> int:
-    from os import SEEK_END, SEEK_SET
-    with open(file, 'rb') as ifp, open(out, 'wb') as ofp:
-        # `peek` is not guaranteed to return the requested size of bytes,
-        # but requesting only 4 bytes should be ok
-        meta = ifp.peek(4)
+async def decrypt_resource_file_async(file: str | PathLike, out: str | PathLike, key: bytes | bytearray) -> int:
+    loop, dispatcher = _get_async_dispatcher()
+    return await dispatcher.wait(loop, dispatcher.queue.submit_file(file, out, key))
 
-        if meta[:3] != b'enc':   #resource file is not encrypted
-            pt_len = None
-            pt_iter = make_iter(ifp)
-        else:
-            pt_len = ifp.seek(0, SEEK_END) - ifp.seek(4, SEEK_SET) - meta[3]
-            cipher = Weakfish() if _is_weak(key) else Twofish(derive_subkey(key, pt_len))
-            pt_iter = CBCIter(cipher, PGMMV_IV, make_iter(ifp), is_decrypt=True)
 
-        for block in pt_iter: ofp.write(block)
-        return ofp.truncate(pt_len)
+async def decrypt_resource_bytes_async(file_bytes: bytes | bytearray, key: bytes | bytearray) -> bytes:
+    loop, dispatcher = _get_async_dispatcher()
+    return await dispatcher.wait(loop, dispatcher.queue.submit_bytes(file_bytes, key))
@@ -1,47 +1,95 @@
-from argparse import ArgumentParser
+from argparse import ArgumentParser, ArgumentTypeError
+from json import dumps
 from pathlib import Path
 
-from . import decrypt_key, decrypt_resource_file
+from . import (decrypt_many, decrypt_resource_file, decrypt_resource_file_inplace, decrypt_tree, peak_inflight_bytes, scan_tree,
+               set_huge_pages, set_max_inflight_bytes)
+from .pgmmv import find_key
+
+
+def positive_int(value: str) -> int:
+    try:
+        if (num := int(value)) > 0:
+            return num
+    except ValueError:
+        pass
+    raise ArgumentTypeError(f'invalid positive int value: {value!r}')
+
+
+def byte_size(value: str) -> int:
+    units = {'': 1, 'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30, 'T': 1 << 40}
+    number = value.rstrip('KMGTkmgt')
+    unit = value[len(number):].upper()
+    try:
+        if unit in units and (size := int(number) * units[unit]) > 0:
+            return size
+    except ValueError:
+        pass
+    raise ArgumentTypeError(f'invalid size value: {value!r}')
 
-PGMMV_INFO_PATHS = (
-    Path('info.json'),
-    Path('data', 'info.json'),
-)
-PGMMV_KEY_DICTKEY = 'key'
 
 parser = ArgumentParser(description='Pixel Game Maker MV Decrypter')
 parser.add_argument('input', type=Path, help='PGMMV resource file or directory')
 parser.add_argument('-o', '--out', metavar='OUTPUT', type=Path, help='specify the output file or directory')
 parser.add_argument('-q', '--query', action='store_true', help='query the key and exit without decryption')
+parser.add_argument('--scan', action='store_true',
+                    help='print the header of each input file and their totals as JSON lines, without decryption')
+parser.add_argument('-j', '--jobs', metavar='N', type=positive_int, help='decrypt with N threads, default to the number of CPUs')
+parser.add_argument('-l', '--link', action='store_true', help='hardlink unencrypted files instead of copying them')
+parser.add_argument('-i', '--in-place', action='store_true', help='decrypt the input files over themselves, without output')
+parser.add_argument('--journal', action='store_true', help='journal --in-place decryption, so that an interrupted one is resumed')
+parser.add_argument('-p', '--pipeline', action='store_true', help='read, decrypt and write in separate thread stages, N being the decryption threads')
+parser.add_argument('--drop-cache', action='store_true', help='drop inputs and outputs from the page cache once decrypted')
+parser.add_argument('--direct', action='store_true', help='write large outputs with O_DIRECT around the page cache, implies --drop-cache')
+parser.add_argument('--disk-order', action='store_true', help='read the files in the order they lie on disk, for spinning disks')
+parser.add_argument('--auto-tune', action='store_true',
+                    help='try other thread counts and chunk sizes on the first files of a directory and keep the fastest')
+parser.add_argument('--tune-profile', metavar='FILE', type=Path,
+                    help='start from the tuning profile saved in FILE, and save the one --auto-tune chooses to it')
+parser.add_argument('--huge-pages', action='store_true', help='back large I/O buffers with transparent huge pages')
+parser.add_argument('--mem-limit', metavar='SIZE', type=byte_size,
+                    help='keep at most SIZE bytes (K, M, G suffixes) of file data in flight, and report the peak memory use')
 exgroup = parser.add_mutually_exclusive_group()
 exgroup.add_argument('-k', '--key', metavar='KEY', help='specify the key in str type')
 exgroup.add_argument('-x', '--hex', metavar='KEY', help='specify the key in hex type')
 
 
-def find_key(cwd: Path) -> bytes | None:
-    from base64 import b64decode
-    from json import loads
+def decrypt_iter_path(src: Path, dst: Path, key: bytes | bytearray, jobs: int | None = None, link: bool = False,
+                      in_place: bool = False, journal: bool = False, pipeline: bool = False, drop_cache: bool = False,
+                      direct: bool = False, disk_order: bool = False, auto_tune: bool = False,
+                      tune_profile: Path | None = None) -> None:
+    if src.is_file() and in_place:
+        decrypt_resource_file_inplace(src, key, journal=journal, drop_cache=drop_cache or direct)
+        return
+    elif src.is_file() and link:
+        decrypt_many([(src, dst)], key, link_plain=True, drop_cache=drop_cache, direct=direct, fail_fast=True)
+        return
+    elif src.is_file():
+        decrypt_resource_file(src, dst, key, drop_cache=drop_cache, direct=direct)
+        return
 
-    while not cwd.samefile(cwd.parent):
-        pths = tuple(cwd/pth for pth in PGMMV_INFO_PATHS if (cwd/pth).exists())
-        if pths:
-            enckey = b64decode(loads(pths[0].read_text('utf-8'))[PGMMV_KEY_DICTKEY])
-            return decrypt_key(enckey)
-        cwd /= '..'
-    return None
+    # the tree is walked natively while the files found so far are decrypted by the pool of `jobs` threads,
+    # no file is started after the first failure, as with the native command line
+    decrypt_tree(src, dst, key, threads=jobs, link_plain=link, in_place=in_place, journal=journal, pipeline=pipeline,
+                 drop_cache=drop_cache, direct=direct, disk_order=disk_order, auto_tune=auto_tune, tune_profile=tune_profile,
+                 fail_fast=True)
 
 
-def decrypt_iter_path(src: Path, dst: Path, key: bytes | bytearray) -> None:
-    from collections import deque
+def scan_path(src: Path, key: bytes | None, jobs: int | None = None) -> int:
+    # the headers alone are read, on `jobs` threads as the tree is walked natively
+    entries, totals = scan_tree(src, key, threads=jobs)
+    for entry in entries:
+        print(dumps(entry))
+    print(dumps({'totals': totals}))
+    return totals['failed']
 
-    tasks = deque(((src, dst),))
-    while tasks:
-        srcp, dstp = tasks.popleft()
-        if srcp.is_file():
-            decrypt_resource_file(srcp, dstp, key)
-        else:
-            dstp.mkdir(parents=True, exist_ok=True)
-            tasks.extend((pth, dstp/pth.name) for pth in srcp.iterdir())
+
+def report_peak() -> None:
+    from resource import RUSAGE_SELF, getrusage
+
+    # ru_maxrss is in KiB on Linux
+    resident = getrusage(RUSAGE_SELF).ru_maxrss << 10
+    print(f'Peak memory: {peak_inflight_bytes() / (1 << 20):.1f} MiB in flight, {resident / (1 << 20):.1f} MiB resident')
 
 
 def main() -> None:
@@ -53,11 +101,30 @@ def main() -> None:
     elif args.input.samefile(args.input.parent):
         raise ValueError(f'cannot use the root directory as input: {args.input}')
 
-    args.out = args.input.with_stem(args.input.stem + '-dec') if args.out is None else args.out.resolve()
-    if args.input.is_file() and args.out == args.input:
-        raise ValueError(f'output cannot be the same as input: {args.out}')
-    elif args.input.is_dir() and (args.out.is_relative_to(args.input) or args.input.is_relative_to(args.out)):
-        raise ValueError(f'output and input directories overlap: {args.out}, {args.input}')
+    if args.scan:
+        # a key only tells the subkeys, none is needed
+        if args.key is not None or args.hex is not None:
+            key = bytes(args.key, encoding='utf-8') if args.key is not None else bytes.fromhex(args.hex)
+        else:
+            key = find_key(args.input.parent if args.input.is_file() else args.input)
+        if scan_path(args.input, None if key is None else key.rstrip(b'\0'), args.jobs):
+            raise SystemExit(1)
+        return
+
+    if args.in_place and args.out is not None:
+        parser.error('argument -o/--out: not allowed with argument -i/--in-place')
+    elif args.journal and not args.in_place:
+        parser.error('argument --journal: only allowed with argument -i/--in-place')
+
+    # decrypted in place, the input is its own output
+    if args.in_place:
+        args.out = args.input
+    else:
+        args.out = args.input.with_stem(args.input.stem + '-dec') if args.out is None else args.out.resolve()
+        if args.input.is_file() and args.out == args.input:
+            raise ValueError(f'output cannot be the same as input: {args.out}')
+        elif args.input.is_dir() and (args.out.is_relative_to(args.input) or args.input.is_relative_to(args.out)):
+            raise ValueError(f'output and input directories overlap: {args.out}, {args.input}')
 
     if args.key is not None:
         key = bytes(args.key, encoding='utf-8')
@@ -73,7 +140,18 @@ def main() -> None:
     print(f'Resource key: {key.hex()} "{key.decode("utf-8", "backslashreplace")}"')
     if not args.query:
         print('Processing...')
-        decrypt_iter_path(args.input, args.out, key)
+        set_huge_pages(args.huge_pages)
+        set_max_inflight_bytes(args.mem_limit)
+        try:
+            decrypt_iter_path(args.input, args.out, key, args.jobs, args.link, args.in_place, args.journal, args.pipeline,
+                              args.drop_cache, args.direct, args.disk_order, args.auto_tune, args.tune_profile)
+        except (OSError, ValueError) as err:
+            # the first failed file, by its path, then the files cancelled after it, as the native command line reports them
+            notes = ''.join(f'{parser.prog}: error: {note}\n' for note in getattr(err, '__notes__', ()))
+            parser.exit(1, f'{parser.prog}: error: {err}\n{notes}')
+        finally:
+            if args.mem_limit is not None:
+                report_peak()
         print('Done')
 
 
@@ -1,6 +1,36 @@
 from setuptools import Extension, setup, find_packages
+from setuptools.command.build_ext import build_ext
+
+
+class build_ext_clib(build_ext):
+    '''Build libpgmmv before the extension, also for a plain `build_ext --inplace`.'''
+
+    def run(self):
+        self.run_command('build_clib')
+        super().run()
+
 
 src__minicrypto = 'pgmmvdec/_minicrypto/'
+lib_pgmmv = ('pgmmv', {
+    'sources': [
+        src__minicrypto + '_C/fatal.c',
+        src__minicrypto + '_C/twofish.c',
+        src__minicrypto + '_C/weakfish.c',
+        src__minicrypto + '_C/pgmmv.c',
+        src__minicrypto + '_C/pgmmv_file.c',
+        src__minicrypto + '_C/pgmmv_batch.c',
+        src__minicrypto + '_C/pgmmv_pool.c',
+        src__minicrypto + '_C/pgmmv_uring.c',
+        src__minicrypto + '_C/pgmmv_stream.c',
+        src__minicrypto + '_C/pgmmv_inplace.c',
+        src__minicrypto + '_C/pgmmv_pipeline.c',
+        src__minicrypto + '_C/pgmmv_tree.c',
+        src__minicrypto + '_C/pgmmv_arena.c',
+        src__minicrypto + '_C/pgmmv_tune.c',
+        src__minicrypto + '_C/pgmmv_reader.c',
+    ],
+    'include_dirs': [src__minicrypto + '_C/'],
+})
 ext__minicrypto = Extension(
     name='pgmmvdec._minicrypto',
     sources=[
@@ -8,11 +38,12 @@ ext__minicrypto = Extension(
         src__minicrypto + 'cipher.c',
         src__minicrypto + 'cipher_iter.c',
         src__minicrypto + 'cipher_mode.c',
-        src__minicrypto + '_C/fatal.c',
-        src__minicrypto + '_C/twofish.c',
-        src__minicrypto + '_C/weakfish.c',
+        src__minicrypto + 'resource.c',
+        src__minicrypto + 'resource_async.c',
+        src__minicrypto + 'resource_file.c',
     ],
     include_dirs=[src__minicrypto, src__minicrypto + '_C/'],
+    extra_link_args=['-pthread'],
 )
 
 setup(
@@ -21,8 +52,11 @@ setup(
     description='Pixel Game Maker MV Decrypter',
     author='blluv and Gee Wang',
     packages=find_packages(),
+    package_data={'pgmmvdec': ['_minicrypto/*.h', '_minicrypto/_C/*.h']},
+    libraries=[lib_pgmmv],
     ext_modules=[ext__minicrypto],
+    cmdclass={'build_ext': build_ext_clib},
     entry_points={'console_scripts': ['pgmmvdec = pgmmvdec.script:main']},
     license='MIT',
-    python_requires='>=3.10',
+    python_requires='>=3.11',
 )